@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "AllocationCounter.h"
+
+// Every replaceable form of operator new and delete is replaced here, rather than relying on the
+// standard library's defaults to forward to the plain ones: the aligned forms don't on every
+// implementation, and memory from them has to be freed differently on Windows.
+
+static std::atomic<size_t> s_allocationCount(0);
+
+static void* Allocate(size_t size) noexcept
+{
+    s_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return malloc((size == 0) ? 1 : size);
+}
+
+static void* AllocateAligned(size_t size, std::align_val_t alignment) noexcept
+{
+    s_allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+    size_t align = static_cast<size_t>(alignment);
+#ifdef _MSC_VER
+    return _aligned_malloc((size == 0) ? 1 : size, align);
+#else
+    // aligned_alloc wants a whole number of alignments.
+    return aligned_alloc(align, (size == 0) ? align : (size + align - 1) / align * align);
+#endif
+}
+
+static void FreeAligned(void* p) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void* operator new(size_t size)
+{
+    void* p = Allocate(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = Allocate(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return Allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    void* p = AllocateAligned(size, alignment);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    void* p = AllocateAligned(size, alignment);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return AllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return AllocateAligned(size, alignment);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    FreeAligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    FreeAligned(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    FreeAligned(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    FreeAligned(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    FreeAligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    FreeAligned(p);
+}
+
+size_t AllocationCount()
+{
+    return s_allocationCount.load(std::memory_order_relaxed);
+}
\ No newline at end of file
@@ -0,0 +1,5 @@
+#pragma once
+
+// The number of heap allocations made with operator new so far, for -bench to report how many
+// building and running a grid takes.
+size_t AllocationCount();
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+// One block of memory that objects are placed in one after another, and that are all destroyed
+// together, newest first, when the arena is. It never grows, so its size has to be worked out up
+// front with Footprint; running out of room is a bug in that calculation.
+class Arena
+{
+private:
+    struct Cleanup
+    {
+        void (*destroy)(void* object);
+        void* object;
+        Cleanup* next;
+    };
+
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_size;
+    size_t m_used;
+    Cleanup* m_cleanups;
+
+public:
+    Arena(size_t size)
+        : m_buffer(new char[size])
+        , m_size(size)
+        , m_used(0)
+        , m_cleanups(nullptr)
+    {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena()
+    {
+        for (Cleanup* pCleanup = m_cleanups; pCleanup != nullptr; pCleanup = pCleanup->next)
+            pCleanup->destroy(pCleanup->object);
+    }
+
+    // The most room that New<T> or NewArray<T> can take for count objects.
+    template <typename T>
+    static constexpr size_t Footprint(size_t count = 1)
+    {
+        return std::is_trivially_destructible<T>::value
+            ? (count * sizeof(T) + alignof(T) - 1)
+            : count * (sizeof(T) + alignof(T) - 1 + sizeof(Cleanup) + alignof(Cleanup) - 1);
+    }
+
+    template <typename T, typename... Args>
+    T* New(Args&&... args)
+    {
+        T* pObject = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            Cleanup* pCleanup = static_cast<Cleanup*>(Allocate(sizeof(Cleanup), alignof(Cleanup)));
+            pCleanup->destroy = [](void* object) { static_cast<T*>(object)->~T(); };
+            pCleanup->object = pObject;
+            pCleanup->next = m_cleanups;
+            m_cleanups = pCleanup;
+        }
+
+        return pObject;
+    }
+
+    // count default-constructed objects in a row. They're never destroyed, so they mustn't need to be.
+    template <typename T>
+    T* NewArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena arrays aren't destroyed");
+
+        T* pArray = static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < count; ++i)
+            new (&pArray[i]) T();
+        return pArray;
+    }
+
+private:
+    void* Allocate(size_t size, size_t alignment)
+    {
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_buffer.get());
+        size_t offset = ((base + m_used + alignment - 1) & ~(alignment - 1)) - base;
+        if (offset + size > m_size)
+            throw std::exception("arena is full");
+
+        m_used = offset + size;
+        return m_buffer.get() + offset;
+    }
+};
\ No newline at end of file
@@ -0,0 +1,571 @@
+#pragma once
+
+// What happened to one test set in a BatchGrid run; the same things RunProgramAndTest reports.
+struct BatchResult
+{
+    int cycleCount;
+    bool success;
+
+    // Set if the program threw partway through, instead of finishing.
+    const char* error;
+};
+
+// Runs one solution against up to BatchLanes test sets at once, for Engine::Batch.
+//
+// This is FlatGrid with every register, channel value and state widened to one lane per test set.
+// The lanes all run the same code, but each one can be at a different instruction and blocked on
+// different ports, so a node's instructions are run once for each distinct PC among its lanes, with
+// a mask of the lanes at that PC. Test sets usually keep in step with each other, so that's usually
+// just once.
+//
+// Each lane produces exactly what RunProgramAndTest would for its test set, cycle counts included.
+template <int GridHeight, int GridWidth>
+class BatchGrid
+{
+private:
+    typedef Puzzle PuzzleType;
+    typedef FlatGrid<GridHeight, GridWidth> Layout;
+    typedef typename Layout::Kind Kind;
+
+    static constexpr int GridCount = Layout::GridCount;
+    static constexpr int MaxNodeCount = Layout::MaxNodeCount;
+    static constexpr int MaxSlotCount = Layout::MaxSlotCount;
+
+    // Node kinds, slots and code.
+    const Layout& m_layout;
+
+    // Lanes with a test set that hasn't finished yet.
+    LaneMask m_active;
+
+    // Lanes that have hit HCF.
+    LaneMask m_halted;
+
+    // Compute node registers, by grid index.
+    LaneVector m_acc[GridCount];
+    LaneVector m_bak[GridCount];
+    LaneVector m_temp[GridCount];
+    LaneVector m_pc[GridCount];
+
+    // Lanes where compute nodes and inputs are in the Write or WriteComplete state. Lanes in
+    // neither are in Run or Read, which are handled the same way.
+    LaneMask m_writing[MaxNodeCount];
+    LaneMask m_writeComplete[MaxNodeCount];
+
+    // Lanes where compute nodes have a port write to post in the write phase.
+    LaneMask m_write[GridCount];
+
+    // Stack nodes.
+    LaneMask m_writeReady[GridCount];
+    std::vector<int> m_stacks[GridCount][BatchLanes];
+
+    // Channel slots.
+    LaneMask m_pending[MaxSlotCount];
+    LaneVector m_value[MaxSlotCount];
+
+    // Inputs.
+    size_t m_position[MaxNodeCount][BatchLanes];
+    const std::vector<int>* m_inputData[MaxNodeCount][BatchLanes];
+
+    // Outputs, with a set of output nodes for each lane.
+    std::vector<OutputNode> m_outputNodes[BatchLanes];
+    std::vector<VisualizationNode> m_vizNodes[BatchLanes];
+    OutputBase* m_outputs[MaxNodeCount][BatchLanes];
+
+public:
+    // Formal Parameters:
+    //  puzzle: the puzzle the grid was built for.
+    //  layout: the grid's FlatGrid, which must outlive this.
+    BatchGrid(const PuzzleType& puzzle, const Layout& layout)
+        : m_layout(layout)
+        , m_active(0)
+        , m_halted(0)
+    {
+        std::fill(&m_inputData[0][0], &m_inputData[0][0] + MaxNodeCount * BatchLanes, nullptr);
+        std::fill(&m_outputs[0][0], &m_outputs[0][0] + MaxNodeCount * BatchLanes, nullptr);
+
+        for (int lane = 0; lane < BatchLanes; ++lane)
+        {
+            m_outputNodes[lane].resize(puzzle.outputs.size());
+            m_vizNodes[lane].reserve(puzzle.visualization.size());
+            for (size_t i = 0; i < puzzle.visualization.size(); ++i)
+                m_vizNodes[lane].emplace_back(puzzle.visualizationWidth, puzzle.visualizationHeight);
+
+            // Same numbering as FlatGrid.
+            int id = GridCount + static_cast<int>(puzzle.inputs.size());
+            for (OutputNode& node : m_outputNodes[lane])
+                m_outputs[id++][lane] = &node;
+            for (VisualizationNode& node : m_vizNodes[lane])
+                m_outputs[id++][lane] = &node;
+        }
+    }
+
+    // Run the solution against a batch of test sets.
+    //
+    // Formal Parameters:
+    //  testSets: the test sets to run; the programs in these are ignored.
+    //  count: how many test sets there are, up to BatchLanes.
+    //  cycleLimit: if non-zero, the maximum number of cycles to execute before assuming failure.
+    //  results: receives the result for each test set.
+    void Run(const PuzzleType* testSets, int count, int cycleLimit, BatchResult* results)
+    {
+        if (count < 1 || count > BatchLanes)
+            throw std::exception("invalid number of test sets for a batch");
+
+        Initialize(testSets, count);
+
+        // The same loop as RunProgramAndTest, for each lane.
+        LaneMask running = AllLanes >> (BatchLanes - count);
+        int cycleCount = 0;
+        for (;;)
+        {
+            for (LaneMask bits = running; bits != 0; bits &= bits - 1)
+            {
+                size_t lane = LowestBitIndex(bits);
+                bool isFailure = false;
+                if (IsOutputFinished(testSets[lane], m_outputNodes[lane], m_vizNodes[lane], &isFailure))
+                {
+                    results[lane] = BatchResult{ cycleCount, !isFailure, nullptr };
+                    running &= ~(1U << lane);
+                }
+            }
+
+            if (running == 0)
+                break;
+
+            ++cycleCount;
+
+            if (cycleCount == cycleLimit)
+            {
+                for (LaneMask bits = running; bits != 0; bits &= bits - 1)
+                    results[LowestBitIndex(bits)] = BatchResult{ cycleCount, false, nullptr };
+                break;
+            }
+
+            m_active = running;
+            Step();
+
+            for (LaneMask bits = running & m_halted; bits != 0; bits &= bits - 1)
+                results[LowestBitIndex(bits)] = BatchResult{ cycleCount, false, "halt and catch fire" }; // lol
+            running &= ~m_halted;
+        }
+    }
+
+private:
+    void Initialize(const PuzzleType* testSets, int count)
+    {
+        m_halted = 0;
+
+        std::fill(std::begin(m_acc), std::end(m_acc), Broadcast(0));
+        std::fill(std::begin(m_bak), std::end(m_bak), Broadcast(0));
+        std::fill(std::begin(m_temp), std::end(m_temp), Broadcast(0));
+        std::fill(std::begin(m_pc), std::end(m_pc), Broadcast(0));
+        std::fill(std::begin(m_writing), std::end(m_writing), 0);
+        std::fill(std::begin(m_writeComplete), std::end(m_writeComplete), 0);
+        std::fill(std::begin(m_write), std::end(m_write), 0);
+        std::fill(std::begin(m_writeReady), std::end(m_writeReady), AllLanes);
+        std::fill(std::begin(m_pending), std::end(m_pending), 0);
+        std::fill(std::begin(m_value), std::end(m_value), Broadcast(0));
+        std::fill(&m_position[0][0], &m_position[0][0] + MaxNodeCount * BatchLanes, 0);
+
+        for (auto& stacks : m_stacks)
+        {
+            for (std::vector<int>& stack : stacks)
+                stack.clear();
+        }
+
+        for (int lane = 0; lane < count; ++lane)
+        {
+            int id = GridCount;
+            for (const PuzzleType::IO& io : testSets[lane].inputs)
+                m_inputData[id++][lane] = &io.data;
+
+            for (OutputNode& node : m_outputNodes[lane])
+                node.Initialize();
+            for (VisualizationNode& node : m_vizNodes[lane])
+                node.Initialize();
+        }
+    }
+
+    // The same two passes as FlatGrid::Step, over the active lanes.
+    void Step()
+    {
+        for (int i = 0; i < m_layout.m_orderCount; ++i)
+        {
+            int id = m_layout.m_order[i];
+            switch (m_layout.m_kind[id])
+            {
+            case Kind::Compute:
+                ForEachPc(id, m_active & ~(m_writing[id] | m_writeComplete[id]), &BatchGrid::ComputeRead);
+                break;
+
+            case Kind::Stack:
+                StackRead(id);
+                break;
+
+            case Kind::Output:
+                OutputRead(id);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        for (int i = 0; i < m_layout.m_orderCount; ++i)
+        {
+            int id = m_layout.m_order[i];
+            switch (m_layout.m_kind[id])
+            {
+            case Kind::Compute:
+                ComputeWrite(id);
+                break;
+
+            case Kind::Stack:
+                StackWrite(id);
+                break;
+
+            case Kind::Input:
+                InputWrite(id);
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    // Split a compute node's lanes up by PC, and call a function for each group.
+    void ForEachPc(int id, LaneMask lanes, void (BatchGrid::*pfn)(int, LaneMask, const FlatInstruction&, int))
+    {
+        while (lanes != 0)
+        {
+            int pc = m_pc[id].lane[LowestBitIndex(lanes)];
+            LaneMask group = lanes & Equal(m_pc[id], Broadcast(pc));
+            lanes &= ~group;
+            (this->*pfn)(id, group, m_layout.m_code[m_layout.m_codeStart[id] + pc], pc);
+        }
+    }
+
+    // Read the values waiting in a slot in some lanes, and tell their sender.
+    void Take(int slot, LaneMask lanes)
+    {
+        m_pending[slot] &= ~lanes;
+        WriteComplete(m_layout.m_sender[slot], lanes);
+    }
+
+    void Post(int slot, LaneMask lanes, const LaneVector& values)
+    {
+        if (slot >= 0)
+        {
+            m_pending[slot] |= lanes;
+            m_value[slot] = Select(lanes, values, m_value[slot]);
+        }
+    }
+
+    void CancelWrites(int id, LaneMask lanes)
+    {
+        for (int8_t slot : m_layout.m_outSlot[id])
+        {
+            if (slot >= 0)
+                m_pending[slot] &= ~lanes;
+        }
+    }
+
+    void WriteComplete(int id, LaneMask lanes)
+    {
+        switch (m_layout.m_kind[id])
+        {
+        case Kind::Compute:
+            m_writing[id] &= ~lanes;
+            m_writeComplete[id] |= lanes;
+            for (LaneMask bits = lanes; bits != 0; bits &= bits - 1)
+            {
+                size_t lane = LowestBitIndex(bits);
+                if (m_layout.m_code[m_layout.m_codeStart[id] + m_pc[id].lane[lane]].dst == Target::ANY)
+                    CancelWrites(id, 1U << lane);
+            }
+            break;
+
+        case Kind::Stack:
+            for (LaneMask bits = lanes; bits != 0; bits &= bits - 1)
+                m_stacks[id][LowestBitIndex(bits)].pop_back();
+            CancelWrites(id, lanes);
+            m_writeReady[id] |= lanes;
+            break;
+
+        case Kind::Input:
+            m_writing[id] &= ~lanes;
+            m_writeComplete[id] |= lanes;
+            break;
+
+        default:
+            throw std::exception("unexpected WriteComplete");
+        }
+    }
+
+    void Advance(int id, LaneMask lanes)
+    {
+        LaneVector next = Add(m_pc[id], Broadcast(1));
+        LaneMask wrap = Equal(next, Broadcast(m_layout.m_codeSize[id]));
+        m_pc[id] = Select(lanes & ~wrap, next, Select(lanes, Broadcast(0), m_pc[id]));
+    }
+
+    // Read and Compute for the lanes of a compute node that are at one instruction; see
+    // FlatGrid::ComputeRead.
+    void ComputeRead(int id, LaneMask lanes, const FlatInstruction& instr, int pc)
+    {
+        LaneVector value;
+        switch (instr.src)
+        {
+        case Target::None:
+            value = Broadcast(instr.immediate);
+            break;
+
+        case Target::NIL:
+        case Target::LAST:
+            value = Broadcast(0);
+            break;
+
+        case Target::ACC:
+            value = m_acc[id];
+            break;
+
+        case Target::ANY:
+        {
+            // Reads everything that's available; the last one read wins. See ComputeNode::Read().
+            LaneMask read = 0;
+            value = Broadcast(0);
+            for (Neighbor port : { Neighbor::LEFT, Neighbor::RIGHT, Neighbor::UP, Neighbor::DOWN })
+            {
+                int slot = m_layout.m_inSlot[id][static_cast<int>(port)];
+                LaneMask ready = (slot >= 0) ? (lanes & m_pending[slot]) : 0;
+                if (ready != 0)
+                {
+                    value = Select(ready, m_value[slot], value);
+                    Take(slot, ready);
+                    read |= ready;
+                }
+            }
+            lanes = read;
+        }
+        break;
+
+        default:
+            if (instr.inSlot < 0)
+                return;
+            lanes &= m_pending[instr.inSlot];
+            if (lanes != 0)
+            {
+                value = m_value[instr.inSlot];
+                Take(instr.inSlot, lanes);
+            }
+            break;
+        }
+
+        // Lanes that didn't get a value are blocked.
+        if (lanes == 0)
+            return;
+
+        LaneVector& acc = m_acc[id];
+        switch (instr.op)
+        {
+        case Opcode::NOP:
+            Advance(id, lanes);
+            break;
+
+        case Opcode::MOV:
+            if (instr.dst == Target::ACC)
+            {
+                acc = Select(lanes, value, acc);
+            }
+            else if (instr.dst != Target::NIL && instr.dst != Target::LAST)
+            {
+                m_temp[id] = Select(lanes, value, m_temp[id]);
+                m_write[id] |= lanes;
+                break;
+            }
+            Advance(id, lanes);
+            break;
+
+        case Opcode::ADD:
+            acc = Select(lanes, Add(acc, value), acc);
+            Advance(id, lanes);
+            break;
+
+        case Opcode::SUB:
+            acc = Select(lanes, Sub(acc, value), acc);
+            Advance(id, lanes);
+            break;
+
+        case Opcode::SAV:
+            m_bak[id] = Select(lanes, acc, m_bak[id]);
+            Advance(id, lanes);
+            break;
+
+        case Opcode::SWP:
+        {
+            LaneVector bak = m_bak[id];
+            m_bak[id] = Select(lanes, acc, bak);
+            acc = Select(lanes, bak, acc);
+            Advance(id, lanes);
+        }
+        break;
+
+        case Opcode::JMP:
+        case Opcode::JEZ:
+        case Opcode::JNZ:
+        case Opcode::JGZ:
+        case Opcode::JLZ:
+        {
+            LaneVector zero = Broadcast(0);
+            LaneMask jump = lanes;
+            switch (instr.op)
+            {
+            case Opcode::JEZ: jump &= Equal(acc, zero); break;
+            case Opcode::JNZ: jump &= ~Equal(acc, zero); break;
+            case Opcode::JGZ: jump &= Greater(acc, zero); break;
+            case Opcode::JLZ: jump &= Greater(zero, acc); break;
+            default: break;
+            }
+
+            m_pc[id] = Select(jump, Broadcast(instr.jumpTarget), m_pc[id]);
+            Advance(id, lanes & ~jump);
+        }
+        break;
+
+        case Opcode::JRO:
+        {
+            // Anything out of range, including negative, goes to the last instruction. Where pc +
+            // value overflows, it comes out negative.
+            int size = m_layout.m_codeSize[id];
+            LaneVector target = Add(Broadcast(pc), value);
+            LaneMask inRange = ~Greater(Broadcast(0), target) & Greater(Broadcast(size), target);
+            m_pc[id] = Select(lanes, Select(inRange, target, Broadcast(size - 1)), m_pc[id]);
+        }
+        break;
+
+        case Opcode::HCF:
+            m_halted |= lanes;
+            break;
+
+        default:
+            throw std::exception("invalid opcode");
+        }
+    }
+
+    // Post the values for the lanes of a compute node that are at one instruction.
+    void ComputePost(int id, LaneMask lanes, const FlatInstruction& instr, int /*pc*/)
+    {
+        if (instr.dst == Target::ANY)
+        {
+            for (Neighbor port : { Neighbor::UP, Neighbor::DOWN, Neighbor::LEFT, Neighbor::RIGHT })
+                Post(m_layout.m_outSlot[id][static_cast<int>(port)], lanes, m_temp[id]);
+        }
+        else
+        {
+            Post(instr.outSlot, lanes, m_temp[id]);
+        }
+    }
+
+    // Write and Step for a compute node.
+    void ComputeWrite(int id)
+    {
+        LaneMask writing = m_write[id];
+        if (writing != 0)
+        {
+            m_write[id] = 0;
+            m_writing[id] |= writing;
+            ForEachPc(id, writing, &BatchGrid::ComputePost);
+        }
+
+        LaneMask complete = m_writeComplete[id] & m_active;
+        if (complete != 0)
+        {
+            m_writeComplete[id] &= ~complete;
+            Advance(id, complete);
+        }
+    }
+
+    void StackRead(int id)
+    {
+        // Each lane reads from the first port with a value waiting.
+        LaneMask lanes = m_active;
+        for (int8_t slot : m_layout.m_inSlot[id])
+        {
+            LaneMask ready = (slot >= 0) ? (lanes & m_pending[slot]) : 0;
+            if (ready == 0)
+                continue;
+
+            for (LaneMask bits = ready; bits != 0; bits &= bits - 1)
+            {
+                size_t lane = LowestBitIndex(bits);
+                m_stacks[id][lane].push_back(m_value[slot].lane[lane]);
+            }
+            Take(slot, ready);
+            CancelWrites(id, ready);
+            m_writeReady[id] |= ready;
+            lanes &= ~ready;
+        }
+    }
+
+    void StackWrite(int id)
+    {
+        LaneMask lanes = 0;
+        LaneVector top = Broadcast(0);
+        for (LaneMask bits = m_active & m_writeReady[id]; bits != 0; bits &= bits - 1)
+        {
+            size_t lane = LowestBitIndex(bits);
+            const std::vector<int>& stack = m_stacks[id][lane];
+            if (!stack.empty())
+            {
+                lanes |= 1U << lane;
+                top.lane[lane] = stack.back();
+            }
+        }
+
+        if (lanes == 0)
+            return;
+        m_writeReady[id] &= ~lanes;
+
+        for (int8_t slot : m_layout.m_outSlot[id])
+            Post(slot, lanes, top);
+    }
+
+    void InputWrite(int id)
+    {
+        LaneMask lanes = 0;
+        LaneVector values = Broadcast(0);
+        for (LaneMask bits = m_active & ~(m_writing[id] | m_writeComplete[id]); bits != 0; bits &= bits - 1)
+        {
+            size_t lane = LowestBitIndex(bits);
+            const std::vector<int>& data = *m_inputData[id][lane];
+            if (m_position[id][lane] < data.size())
+            {
+                lanes |= 1U << lane;
+                values.lane[lane] = data[m_position[id][lane]];
+            }
+        }
+        m_writing[id] |= lanes;
+        Post(m_layout.m_outSlot[id][0], lanes, values);
+
+        LaneMask complete = m_writeComplete[id] & m_active;
+        m_writeComplete[id] &= ~complete;
+        for (LaneMask bits = complete; bits != 0; bits &= bits - 1)
+            ++m_position[id][LowestBitIndex(bits)];
+    }
+
+    void OutputRead(int id)
+    {
+        int slot = m_layout.m_inSlot[id][0];
+        LaneMask lanes = (slot >= 0) ? (m_active & m_pending[slot]) : 0;
+        if (lanes == 0)
+            return;
+
+        Take(slot, lanes);
+        for (LaneMask bits = lanes; bits != 0; bits &= bits - 1)
+        {
+            size_t lane = LowestBitIndex(bits);
+            m_outputs[id][lane]->ReadData(m_value[slot].lane[lane]);
+        }
+    }
+};
\ No newline at end of file
@@ -1,10 +1,89 @@
 #pragma once
 
-template <int GridHeight, int GridWidth>
+// Check a grid's outputs against a puzzle's expected outputs.
+//
+// Formal Parameters:
+//  puzzle: the puzzle being tested.
+//  outputNodes, vizNodes: the grid's outputs, in the same order as the puzzle's.
+//  pIsFailure: if finished, set to whether an output was wrong.
+//
+// Returns true if the outputs are complete, or if one of them has gone wrong.
+template <typename PuzzleType>
+bool IsOutputFinished(
+    const PuzzleType& puzzle,
+    const std::vector<OutputNode>& outputNodes,
+    std::vector<VisualizationNode>& vizNodes,
+    bool* pIsFailure
+    )
+{
+    bool outputFinished = true;
+
+    for (size_t i = 0, n = puzzle.outputs.size(); i < n; ++i)
+    {
+        const std::vector<int>& actual = outputNodes[i].Data;
+        const std::vector<int>& expected = puzzle.outputs[i].data;
+
+        if (!actual.empty() && (actual.back() != expected[actual.size() - 1]))
+        {
+            *pIsFailure = true;
+            return true;
+        }
+
+        if (actual.size() != expected.size())
+            outputFinished = false;
+    }
+
+    bool vizMatch = true;
+    for (size_t i = 0, n = puzzle.visualization.size(); i < n; ++i)
+    {
+        VisualizationNode& vizNode = vizNodes[i];
+
+        for (size_t j = 0, n = vizNode.Grid.Width() * vizNode.Grid.Height(); j < n; ++j)
+        {
+            int expected = 0;
+            // allow under-sizing the expected vector
+            if (puzzle.visualization[i].data.size() > j)
+                expected = puzzle.visualization[i].data[j];
+
+            if (vizNode.Grid[j] != expected)
+            {
+                vizMatch = false;
+                break;
+            }
+        }
+        if (!vizMatch)
+            break;
+    }
+
+    if (outputFinished && vizMatch)
+    {
+        *pIsFailure = false;
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+// The grid can be any size; its width and height come from the puzzle. The engines built on FlatGrid
+// are specialized for the game's grid, so they can only run grids that are NodeGridWidth by
+// NodeGridHeight.
 class ComputeGrid
 {
 private:
-    typedef PuzzleBase<GridHeight * GridWidth> PuzzleType;
+    typedef Puzzle PuzzleType;
+    typedef FlatGrid<NodeGridHeight, NodeGridWidth> GameFlatGrid;
+    typedef MemoGrid<NodeGridHeight, NodeGridWidth> GameMemoGrid;
+
+    // The most cycles FastForward runs at once when it can be stopped or has no limit.
+    static constexpr int StopCheckCycles = 1 << 16;
+
+    // Holds the grid nodes, the channels and the FlatGrid, so building a grid only allocates
+    // once for all of them. Declared first, so that it outlives everything that points into it.
+    Arena m_arena;
+
+    IOChannelTable m_channels;
 
     std::vector<ComputeNode*> m_computeNodes;
     std::vector<StackMemoryNode*> m_stackNodes;
@@ -12,41 +91,182 @@ private:
     std::vector<OutputNode> m_outputNodes;
     std::vector<VisualizationNode> m_vizNodes;
 
-    std::unique_ptr<INode> m_grid[GridHeight * GridWidth];
+    // By node index.
+    std::vector<INode*> m_grid;
+
+    // The compute nodes that have a program; the others never do anything.
+    std::vector<ComputeNode*> m_programmedNodes;
 
+    // The nodes that can do anything, in the order they step in (see ForEachNode). Built once,
+    // since the programs can't change after construction.
     std::vector<INode*> m_allNodes;
 
-public:
-    ComputeGrid(const PuzzleType& puzzle)
+    // m_allNodes, with the compute nodes identified so Engine::Threaded can call them directly.
+    struct ThreadedNode
+    {
+        INode* node;
+        ComputeNode* computeNode;
+    };
+    std::vector<ThreadedNode> m_threadedNodes;
+
+    // For Engine::Scheduled: bitmasks over m_threadedNodes, of the nodes that might have work to
+    // do, and of the nodes that IOChannel has woken up during the current pass.
+    std::vector<uint32_t> m_activeNodes;
+    std::vector<uint32_t> m_wokenNodes;
+
+    // For Engine::Flat, and the engines built on it. Null unless the grid is the game's size.
+    GameFlatGrid* m_pFlatGrid;
+
+    // For Engine::Memo.
+    GameMemoGrid* m_pMemoGrid;
+
+    // For Engine::Specialized.
+    GameFlatGrid::StepFunction m_layoutStep;
+
+    // For Engine::Parallel and Engine::TimeWarp: the threads they run the grid on, while they're
+    // the engine.
+    int m_width;
+    int m_height;
+    int m_threadCount;
+    std::unique_ptr<ParallelGrid> m_spParallelGrid;
+    std::unique_ptr<TimeWarpGrid> m_spTimeWarpGrid;
+
+    Engine m_engine;
+
+    // Call function on every node that can do anything, a list of each kind at a time, with the
+    // node as its own type so that the calls it makes on it don't have to be virtual.
+    //
+    // This is the order the nodes step in, for every engine that steps them. It matters: when
+    // several nodes read from the same ANY write in one cycle, the first one gets the value.
+    template <typename Function>
+    void ForEachNode(Function function)
+    {
+        for (InputNode& node : m_inputNodes)
+            function(node);
+
+        for (OutputNode& node : m_outputNodes)
+            function(node);
+
+        for (VisualizationNode& node : m_vizNodes)
+            function(node);
+
+        for (ComputeNode* node : m_programmedNodes)
+            function(*node);
+
+        for (StackMemoryNode* node : m_stackNodes)
+            function(*node);
+    }
+
+    void BuildNodeLists()
+    {
+        m_programmedNodes.reserve(m_computeNodes.size());
+        for (ComputeNode* node : m_computeNodes)
+        {
+            if (node->InstructionCount() > 0)
+                m_programmedNodes.push_back(node);
+        }
+
+        size_t ioCount = m_inputNodes.size() + m_outputNodes.size() + m_vizNodes.size();
+        m_allNodes.reserve(ioCount + m_programmedNodes.size() + m_stackNodes.size());
+        ForEachNode([this](INode& node) { m_allNodes.push_back(&node); });
+
+        m_threadedNodes.reserve(m_allNodes.size());
+        for (INode* node : m_allNodes)
+        {
+            m_threadedNodes.push_back(ThreadedNode{ node, dynamic_cast<ComputeNode*>(node) });
+        }
+
+        size_t wordCount = (m_threadedNodes.size() + 31) / 32;
+        m_activeNodes.resize(wordCount);
+        m_wokenNodes.resize(wordCount);
+        AttachWakeFlags(true);
+    }
+
+    // Engine::Parallel detaches the nodes from their wake flags, since they would be set from
+    // several threads at once, and nothing looks at them.
+    void AttachWakeFlags(bool attach)
+    {
+        for (size_t i = 0; i < m_threadedNodes.size(); ++i)
+        {
+            if (attach)
+                m_threadedNodes[i].node->SetWakeFlag(&m_wokenNodes[i / 32], 1U << (i % 32));
+            else
+                m_threadedNodes[i].node->SetWakeFlag(nullptr, 0);
+        }
+    }
+
+    static bool IsGameSize(const PuzzleType& puzzle)
     {
-        for (int row = 0; row < GridHeight; ++row)
+        return (puzzle.width == static_cast<int>(NodeGridWidth)) && (puzzle.height == static_cast<int>(NodeGridHeight));
+    }
+
+    // Channels between grid nodes, plus one per input and output.
+    static size_t ChannelCount(const PuzzleType& puzzle)
+    {
+        size_t gridChannelCount = puzzle.height * (puzzle.width - 1) + (puzzle.height - 1) * puzzle.width;
+        return gridChannelCount + puzzle.inputs.size() + puzzle.outputs.size() + puzzle.visualization.size();
+    }
+
+    static size_t ArenaSize(const PuzzleType& puzzle)
+    {
+        size_t size = puzzle.width * puzzle.height * std::max(Arena::Footprint<ComputeNode>(), Arena::Footprint<StackMemoryNode>())
+            + Arena::Footprint<IOChannel>(ChannelCount(puzzle))
+            + Arena::Footprint<INode*>(2 * ChannelCount(puzzle));
+
+        if (IsGameSize(puzzle))
+            size += Arena::Footprint<GameFlatGrid>() + Arena::Footprint<GameMemoGrid>();
+
+        return size;
+    }
+
+    // Build a grid for the puzzle. If pSource isn't null, its programs are shared instead of being
+    // assembled again (see the public constructors).
+    ComputeGrid(const PuzzleType& puzzle, const ComputeGrid* pSource)
+        : m_arena(ArenaSize(puzzle))
+        , m_channels(m_arena, ChannelCount(puzzle))
+        , m_grid(puzzle.width * puzzle.height)
+        , m_pFlatGrid(nullptr)
+        , m_pMemoGrid(nullptr)
+        , m_layoutStep(nullptr)
+        , m_width(puzzle.width)
+        , m_height(puzzle.height)
+        , m_threadCount(1)
+        , m_engine(Engine::Interpreter)
+    {
+        m_computeNodes.reserve(m_grid.size());
+        m_stackNodes.reserve(puzzle.stackNodes.size());
+
+        for (int row = 0; row < puzzle.height; ++row)
         {
-            for (int col = 0; col < GridWidth; ++col)
+            for (int col = 0; col < puzzle.width; ++col)
             {
-                int index = row * GridWidth + col;
+                int index = row * puzzle.width + col;
 
-                std::unique_ptr<INode>& spCurrentNode = m_grid[index];
+                INode*& pCurrentNode = m_grid[index];
 
                 if (puzzle.stackNodes.find(index) != puzzle.stackNodes.end())
                 {
-                    auto pStackNode = new StackMemoryNode();
-                    spCurrentNode.reset(pStackNode);
+                    auto pStackNode = m_arena.New<StackMemoryNode>();
+                    pCurrentNode = pStackNode;
                     m_stackNodes.push_back(pStackNode);
                 }
                 else
                 {
-                    auto pComputeNode = new ComputeNode();
-                    pComputeNode->Assemble(puzzle.programs[index]);
-                    spCurrentNode.reset(pComputeNode);
+                    auto pComputeNode = m_arena.New<ComputeNode>();
+                    if (pSource != nullptr)
+                        pComputeNode->ShareProgram(*static_cast<const ComputeNode*>(pSource->m_grid[index]));
+                    else
+                        pComputeNode->Assemble(puzzle.programs[index]);
+                    pCurrentNode = pComputeNode;
                     m_computeNodes.push_back(pComputeNode);
                 }
 
-                spCurrentNode->NodeId = index;
+                pCurrentNode->NodeId = index;
 
                 if (col > 0)
-                    INode::Join(m_grid[index - 1].get(), Neighbor::RIGHT, spCurrentNode.get());
+                    INode::Join(m_channels, m_grid[index - 1], Neighbor::RIGHT, pCurrentNode);
                 if (row > 0)
-                    INode::Join(m_grid[index - GridWidth].get(), Neighbor::DOWN, spCurrentNode.get());
+                    INode::Join(m_channels, m_grid[index - puzzle.width], Neighbor::DOWN, pCurrentNode);
             }
         }
 
@@ -55,7 +275,7 @@ public:
         {
             m_inputNodes.emplace_back(io.data);
             INode* node = &m_inputNodes.back();
-            INode::Join(m_grid[io.toNode].get(), io.direction, node);
+            INode::Join(m_channels, m_grid[io.toNode], io.direction, node);
         }
 
         m_outputNodes.reserve(puzzle.outputs.size());
@@ -63,7 +283,7 @@ public:
         {
             m_outputNodes.emplace_back();
             INode* node = &m_outputNodes.back();
-            INode::Join(m_grid[io.toNode].get(), io.direction, node);
+            INode::Join(m_channels, m_grid[io.toNode], io.direction, node);
         }
 
         m_vizNodes.reserve(puzzle.visualization.size());
@@ -71,8 +291,128 @@ public:
         {
             m_vizNodes.emplace_back(puzzle.visualizationWidth, puzzle.visualizationHeight);
             INode* node = &m_vizNodes.back();
-            INode::Join(m_grid[io.toNode].get(), io.direction, node);
+            INode::Join(m_channels, m_grid[io.toNode], io.direction, node);
+        }
+
+        if (IsGameSize(puzzle))
+        {
+            m_pFlatGrid = m_arena.New<GameFlatGrid>(puzzle, m_grid.data(), m_inputNodes, m_outputNodes, m_vizNodes);
+            m_layoutStep = m_pFlatGrid->FindLayoutStep();
+            m_pMemoGrid = m_arena.New<GameMemoGrid>(*m_pFlatGrid);
         }
+
+        BuildNodeLists();
+    }
+
+    // Returns puzzle, or throws if a grid built for it wouldn't have its nodes in the same places as
+    // grid.
+    static const PuzzleType& CheckLayout(const PuzzleType& puzzle, const ComputeGrid& grid)
+    {
+        bool match = (puzzle.width == grid.m_width) && (puzzle.height == grid.m_height)
+            && (puzzle.inputs.size() == grid.m_inputNodes.size())
+            && (puzzle.outputs.size() == grid.m_outputNodes.size())
+            && (puzzle.visualization.size() == grid.m_vizNodes.size());
+        for (size_t index = 0; match && (index < grid.m_grid.size()); ++index)
+        {
+            bool isStack = (puzzle.stackNodes.find(static_cast<int>(index)) != puzzle.stackNodes.end());
+            match = (isStack == (dynamic_cast<const StackMemoryNode*>(grid.m_grid[index]) != nullptr));
+        }
+
+        if (!match)
+            throw std::exception("The puzzle's layout isn't the grid's.");
+        return puzzle;
+    }
+
+public:
+    ComputeGrid(const PuzzleType& puzzle)
+        : ComputeGrid(puzzle, nullptr)
+    {
+    }
+
+    // Clone source, for running the same solution on another thread: the clone shares source's
+    // assembled programs, which never change, and has its own nodes, channels and wiring for
+    // everything else. The puzzle gives it its inputs, and has to have the same layout as the one
+    // source was built for. The clone starts out as a newly built grid does, with source's engine
+    // and settings, and has to be initialized before it's run.
+    ComputeGrid(const PuzzleType& puzzle, const ComputeGrid& source)
+        : ComputeGrid(CheckLayout(puzzle, source), &source)
+    {
+        m_threadCount = source.m_threadCount;
+        if (m_pMemoGrid != nullptr)
+            m_pMemoGrid->SetCapacity(source.m_pMemoGrid->Capacity());
+        SetEngine(source.m_engine);
+    }
+
+    ComputeGrid(const ComputeGrid&) = delete;
+    ComputeGrid& operator=(const ComputeGrid&) = delete;
+
+    // Everything about a puzzle that the grid built for it depends on, other than its programs and
+    // inputs: grids built for puzzles with the same key can be reprogrammed for each other's.
+    static std::vector<int> LayoutKey(const PuzzleType& puzzle)
+    {
+        std::vector<int> key = { puzzle.width, puzzle.height, puzzle.visualizationWidth, puzzle.visualizationHeight };
+        key.insert(key.end(), puzzle.stackNodes.begin(), puzzle.stackNodes.end());
+        for (const std::vector<PuzzleType::IO>* pList : { &puzzle.inputs, &puzzle.outputs, &puzzle.visualization })
+        {
+            key.push_back(-1);
+            for (const PuzzleType::IO& io : *pList)
+            {
+                key.push_back(io.toNode);
+                key.push_back(static_cast<int>(io.direction));
+            }
+        }
+        return key;
+    }
+
+    // Give the grid the puzzle's programs and inputs in place of the ones it has, which is the same
+    // as building a new grid for the puzzle, except that only the programs are assembled: the nodes,
+    // channels and everything else are reused. The puzzle must have the same layout as the one the
+    // grid was built for (see LayoutKey). Like a new grid, it's left on Engine::Interpreter, and has
+    // to be initialized before it's run.
+    void Reprogram(const PuzzleType& puzzle)
+    {
+        CheckLayout(puzzle, *this);
+
+        // Frees whatever the previous engine had built for the old programs.
+        SetEngine(Engine::Interpreter);
+
+        for (ComputeNode* node : m_computeNodes)
+            node->Assemble(puzzle.programs[node->NodeId]);
+
+        for (size_t i = 0; i < m_inputNodes.size(); ++i)
+            m_inputNodes[i].SetData(std::vector<int>(puzzle.inputs[i].data));
+
+        m_channels.Reset();
+
+        m_programmedNodes.clear();
+        m_allNodes.clear();
+        m_threadedNodes.clear();
+        BuildNodeLists();
+
+        if (m_pFlatGrid != nullptr)
+        {
+            m_pFlatGrid->LoadPrograms(m_grid.data());
+            m_layoutStep = m_pFlatGrid->FindLayoutStep();
+            m_pMemoGrid->Clear();
+        }
+    }
+
+    const GameFlatGrid& Flat() const
+    {
+        if (m_pFlatGrid == nullptr)
+            throw std::exception("Only grids the size of the game's can be flattened.");
+        return *m_pFlatGrid;
+    }
+
+    const std::vector<ComputeNode*>& ProgrammedNodes() const
+    {
+        return m_programmedNodes;
+    }
+
+    // What each output has read so far, in the same order as the puzzle's outputs.
+    const std::vector<OutputNode>& Outputs() const
+    {
+        return m_outputNodes;
     }
 
     void GetStats(int* pComputeNodeCount, int* pInstructionCount)
@@ -88,109 +428,388 @@ public:
         }
     }
 
-    void Step()
+    void SetEngine(Engine engine)
     {
-        for (auto& node : m_allNodes)
-            node->Read();
+        if (!CanRunEngine(engine))
+            throw std::exception("That engine only runs grids the size of the game's.");
 
-        for (auto& node : m_allNodes)
-            node->Compute();
+        m_engine = engine;
 
-        for (auto& node : m_allNodes)
-            node->Write();
-
-        for (auto& node : m_allNodes)
-            node->Step();
+        for (ComputeNode* node : m_computeNodes)
+            node->SetEngine(engine);
+
+        m_spParallelGrid.reset();
+        m_spTimeWarpGrid.reset();
+        AttachWakeFlags(engine != Engine::Parallel);
+        if (engine == Engine::Parallel)
+            m_spParallelGrid.reset(new ParallelGrid(m_width, m_height, m_threadCount, m_grid, m_allNodes, m_channels));
+        if (engine == Engine::TimeWarp)
+            m_spTimeWarpGrid.reset(new TimeWarpGrid(m_width, m_height, m_threadCount, m_grid, m_allNodes, m_channels, m_outputNodes, m_vizNodes));
+
+        // Nothing is known about the nodes that were skipped under the previous engine.
+        WakeAllNodes();
     }
 
-    bool IsFinished(const PuzzleType& puzzle, bool* pIsFailure)
+    bool CanRunEngine(Engine engine) const
     {
-        bool outputFinished = true;
+        return (m_pFlatGrid != nullptr) || !IsFlatEngine(engine);
+    }
 
-        for (size_t i = 0, n = puzzle.outputs.size(); i < n; ++i)
+    // Whether an engine is built on FlatGrid, and so needs the grid to be the size of the game's.
+    static bool IsFlatEngine(Engine engine)
+    {
+        switch (engine)
         {
-            const std::vector<int>& actual = m_outputNodes[i].Data;
-            const std::vector<int>& expected = puzzle.outputs[i].data;
+        case Engine::Flat:
+        case Engine::Batch:
+        case Engine::Specialized:
+        case Engine::Steady:
+        case Engine::Memo:
+            return true;
 
-            if (!actual.empty() && (actual.back() != expected[actual.size() - 1]))
-            {
-                *pIsFailure = true;
-                return true;
-            }
+        default:
+            return false;
+        }
+    }
 
-            if (actual.size() != expected.size())
-                outputFinished = false;
+    // Set the most threads that Engine::Parallel and Engine::TimeWarp can use, or 0 for one per core. Takes effect the
+    // next time the engine is set.
+    void SetThreadCount(int threadCount)
+    {
+        m_threadCount = (threadCount > 0) ? threadCount : std::max<int>(std::thread::hardware_concurrency(), 1);
+    }
+
+    // For Engine::Parallel: how many tiles the grid is split into, and how many nodes have to do
+    // their read phases one after another on the main thread (see ParallelGrid).
+    void GetTiling(size_t* pTileCount, size_t* pSerialNodeCount) const
+    {
+        *pTileCount = m_spParallelGrid ? m_spParallelGrid->TileCount() : 0;
+        *pSerialNodeCount = m_spParallelGrid ? m_spParallelGrid->SerialNodeCount() : 0;
+    }
+
+    // For Engine::TimeWarp: how many regions the grid is split into, and how many times they have
+    // rolled back (see TimeWarpGrid).
+    void GetRegions(size_t* pRegionCount, int64_t* pRollbackCount) const
+    {
+        *pRegionCount = m_spTimeWarpGrid ? m_spTimeWarpGrid->RegionCount() : 0;
+        *pRollbackCount = m_spTimeWarpGrid ? m_spTimeWarpGrid->RollbackCount() : 0;
+    }
+
+    // Set the most memory, in bytes, that Engine::Memo can use to remember what the grid did.
+    void SetMemoCapacity(size_t capacity)
+    {
+        if (m_pMemoGrid != nullptr)
+            m_pMemoGrid->SetCapacity(capacity);
+    }
+
+    void Step()
+    {
+        m_channels.NextCycle();
+
+        switch (m_engine)
+        {
+        case Engine::Interpreter:
+            StepInterpreter();
+            break;
+
+        case Engine::Threaded:
+            StepThreaded();
+            break;
+
+        case Engine::Scheduled:
+        case Engine::Jit:
+            StepScheduled();
+            break;
+
+        case Engine::Fused:
+            StepFused();
+            break;
+
+        case Engine::Flat:
+        case Engine::Batch:
+            m_pFlatGrid->Step();
+            break;
+
+        case Engine::Specialized:
+            (m_pFlatGrid->*m_layoutStep)();
+            break;
+
+        case Engine::Steady:
+            m_pFlatGrid->StepSteady();
+            break;
+
+        case Engine::Memo:
+            m_pMemoGrid->Step();
+            break;
+
+        case Engine::Parallel:
+            m_spParallelGrid->Step();
+            break;
+
+        case Engine::TimeWarp:
+            m_spTimeWarpGrid->Step();
+            break;
         }
+    }
+
+    void StepInterpreter()
+    {
+        ForEachNode([](auto& node) { node.Read(); });
+        ForEachNode([](auto& node) { node.Compute(); });
+        ForEachNode([](auto& node) { node.Write(); });
+        ForEachNode([](auto& node) { node.Step(); });
+    }
+
+    // Compute only affects the node's own registers, and so can be done right after its Read; the
+    // same goes for Step after Write. That leaves two passes over the nodes instead of four.
+    void StepThreaded()
+    {
+        ForEachNode([](auto& node) { ReadNode(node); });
+        ForEachNode([](auto& node) { WriteNode(node); });
+    }
 
-        bool vizMatch = true;
-        for (size_t i = 0, n = puzzle.visualization.size(); i < n; ++i)
+    // Same passes as StepThreaded, but only over the active nodes, in the same order.
+    //
+    // A node goes inactive at the end of its write phase if it is idle, and IOChannel wakes it up
+    // again when a value is sent to it or its own value is taken. Those are the only things that can
+    // give an idle node work to do: a value sent in the write phase is read in the next cycle's read
+    // phase, and a write completed in the read phase is finished off in the same cycle's write phase.
+    void StepScheduled()
+    {
+        for (size_t word = 0; word < m_activeNodes.size(); ++word)
         {
-            VisualizationNode& vizNode = m_vizNodes[i];
+            for (uint32_t bits = m_activeNodes[word]; bits != 0; bits &= bits - 1)
+                ReadPhase(m_threadedNodes[word * 32 + LowestBitIndex(bits)]);
+        }
 
-            for (size_t j = 0, n = vizNode.Grid.Width() * vizNode.Grid.Height(); j < n; ++j)
+        MergeWokenNodes();
+
+        for (size_t word = 0; word < m_activeNodes.size(); ++word)
+        {
+            for (uint32_t bits = m_activeNodes[word]; bits != 0; bits &= bits - 1)
             {
-                int expected = 0;
-                // allow under-sizing the expected vector
-                if (puzzle.visualization[i].data.size() > j)
-                    expected = puzzle.visualization[i].data[j];
+                const ThreadedNode& entry = m_threadedNodes[word * 32 + LowestBitIndex(bits)];
+                WritePhase(entry);
 
-                if (vizNode.Grid[j] != expected)
-                {
-                    vizMatch = false;
-                    break;
-                }
+                if (entry.node->IsIdle())
+                    m_activeNodes[word] &= ~(bits & (0 - bits));
             }
-            if (!vizMatch)
-                break;
         }
 
-        if (outputFinished && vizMatch)
+        MergeWokenNodes();
+    }
+
+    // One pass over the nodes instead of two: each node does its read phase and then its write
+    // phase before the next node does anything. IOChannel won't let a value sent in this cycle be
+    // read until the next one, so the reads go as though they had all come first.
+    //
+    // That leaves writes taken from nodes that were already stepped this cycle. Their write phase
+    // has to see the write as complete, so it's run again at the end of the cycle; nothing else
+    // looks at the node in between, so it's as if it had run after all the reads.
+    void StepFused()
+    {
+        uint64_t cycle = m_channels.Cycle();
+        ForEachNode([cycle](auto& node)
         {
-            *pIsFailure = false;
-            return true;
-        }
-        else
+            ReadNode(node);
+            WriteNode(node);
+            node.SteppedCycle = cycle;
+        });
+
+        INode* const* lateNodes = m_channels.LateNodes();
+        for (size_t i = 0, count = m_channels.LateNodeCount(); i < count; ++i)
         {
-            return false;
+            lateNodes[i]->Write();
+            lateNodes[i]->Step();
         }
+        m_channels.ClearLateNodes();
     }
 
-    void Initialize()
+    // Run cycles without stepping the whole grid, for the engines that can.
+    //
+    // For Engine::Scheduled and Engine::Jit: if the only node with anything to do is a compute node
+    // running instructions that don't use ports, nothing else can happen until it gets to one that
+    // does, so run it up to there without stepping the rest of the grid. If every node with anything
+    // to do is a compute node that is busy, waiting out instructions it has already run, nothing can
+    // happen until the first of them is done, so wait that long. If no node has anything to do, no
+    // node ever will again.
+    //
+    // For Engine::Memo: skip over cycles the grid has been through before (see
+    // MemoGrid::FastForward), stopping as soon as the outputs are finished.
+    //
+    // For Engine::TimeWarp: let the regions run ahead (see TimeWarpGrid), stopping as soon as the
+    // outputs are finished.
+    //
+    // Formal Parameters:
+    //  puzzle: the puzzle being tested.
+    //  maxCycles: the most cycles to run, or negative for no limit, in which case no more than
+    //             StopCheckCycles are run at once, so that the caller's cycle count can't overflow.
+    //  pStop: if not null, nothing is run once this is set, and no more than StopCheckCycles are run
+    //         at once, so that the caller gets to check it again in between.
+    //
+    // Returns the number of cycles run. They have exactly the same effect as calling Step that many
+    // times, except that once IsFinished is true, the grid mustn't be stepped again.
+    int FastForward(const PuzzleType& puzzle, int maxCycles, const std::atomic<bool>* pStop = nullptr)
     {
-        m_allNodes.clear();
+        int limit = (maxCycles < 0) ? StopCheckCycles : maxCycles;
+        if (pStop != nullptr)
+        {
+            if (pStop->load(std::memory_order_relaxed))
+                return 0;
+            limit = std::min(limit, StopCheckCycles);
+        }
 
-        for (INode& node : m_inputNodes)
+        if (m_engine == Engine::Memo)
         {
-            node.Initialize();
-            m_allNodes.push_back(&node);
+            bool isFailure;
+            return m_pMemoGrid->FastForward(limit, [&]() { return IsFinished(puzzle, &isFailure); });
         }
 
-        for (INode& node : m_outputNodes)
+        if (m_engine == Engine::TimeWarp)
         {
-            node.Initialize();
-            m_allNodes.push_back(&node);
+            bool isFailure;
+            return m_spTimeWarpGrid->FastForward(limit,
+                [&](const std::vector<OutputNode>& outputNodes, std::vector<VisualizationNode>& vizNodes)
+                {
+                    return IsOutputFinished(puzzle, outputNodes, vizNodes, &isFailure);
+                });
         }
 
-        for (INode& node : m_vizNodes)
+        if ((m_engine != Engine::Scheduled) && (m_engine != Engine::Jit))
+            return 0;
+
+        const ThreadedNode* pActive = nullptr;
+        bool severalActive = false;
+        for (size_t word = 0; word < m_activeNodes.size(); ++word)
         {
-            node.Initialize();
-            m_allNodes.push_back(&node);
+            uint32_t bits = m_activeNodes[word];
+            if (bits == 0)
+                continue;
+
+            severalActive = severalActive || (pActive != nullptr) || ((bits & (bits - 1)) != 0);
+            pActive = &m_threadedNodes[word * 32 + LowestBitIndex(bits)];
         }
 
-        for (ComputeNode* node : m_computeNodes)
+        if (severalActive)
+            return WaitBusyNodes(limit);
+
+        if (pActive == nullptr)
         {
-            if (node->InstructionCount() > 0)
+            // Deadlocked. With no limit, it just runs forever like it would otherwise.
+            return (maxCycles < 0) ? 0 : maxCycles;
+        }
+
+        if (pActive->computeNode == nullptr)
+            return 0;
+
+        return pActive->computeNode->RunLocal(limit);
+    }
+
+    // For FastForward: if every active node is a busy compute node, wait out as many cycles as the
+    // first of them to be done is busy for, or maxCycles if that's fewer.
+    int WaitBusyNodes(int maxCycles)
+    {
+        int cycles = maxCycles;
+        for (size_t word = 0; word < m_activeNodes.size(); ++word)
+        {
+            for (uint32_t bits = m_activeNodes[word]; bits != 0; bits &= bits - 1)
             {
-                node->Initialize();
-                m_allNodes.push_back(node);
+                const ComputeNode* node = m_threadedNodes[word * 32 + LowestBitIndex(bits)].computeNode;
+                int busyCycles = (node != nullptr) ? node->BusyCycles() : 0;
+                if (busyCycles == 0)
+                    return 0;
+                cycles = std::min(cycles, busyCycles);
             }
         }
 
-        for (StackMemoryNode* node : m_stackNodes)
+        for (size_t word = 0; word < m_activeNodes.size(); ++word)
         {
-            node->Initialize();
-            m_allNodes.push_back(node);
+            for (uint32_t bits = m_activeNodes[word]; bits != 0; bits &= bits - 1)
+                m_threadedNodes[word * 32 + LowestBitIndex(bits)].computeNode->WaitBusy(cycles);
         }
+        return cycles;
+    }
+
+    // One node's read and write phases, with its type known so the calls can be direct.
+    static void ReadNode(ComputeNode& node)
+    {
+        node.ThreadedRead();
+    }
+
+    template <typename Node>
+    static void ReadNode(Node& node)
+    {
+        node.Read();
+        node.Compute();
+    }
+
+    static void ReadPhase(const ThreadedNode& entry)
+    {
+        if (entry.computeNode != nullptr)
+            ReadNode(*entry.computeNode);
+        else
+            ReadNode(*entry.node);
+    }
+
+    static void WriteNode(ComputeNode& node)
+    {
+        node.ThreadedWrite();
+    }
+
+    template <typename Node>
+    static void WriteNode(Node& node)
+    {
+        node.Write();
+        node.Step();
+    }
+
+    static void WritePhase(const ThreadedNode& entry)
+    {
+        if (entry.computeNode != nullptr)
+            WriteNode(*entry.computeNode);
+        else
+            WriteNode(*entry.node);
+    }
+
+    void MergeWokenNodes()
+    {
+        for (size_t word = 0; word < m_activeNodes.size(); ++word)
+        {
+            m_activeNodes[word] |= m_wokenNodes[word];
+            m_wokenNodes[word] = 0;
+        }
+    }
+
+    void WakeAllNodes()
+    {
+        size_t count = m_threadedNodes.size();
+        for (size_t word = 0; word < m_activeNodes.size(); ++word)
+        {
+            size_t bitsInWord = std::min<size_t>(count - word * 32, 32);
+            m_activeNodes[word] = (bitsInWord == 32) ? ~0U : ((1U << bitsInWord) - 1);
+            m_wokenNodes[word] = 0;
+        }
+    }
+
+    bool IsFinished(const PuzzleType& puzzle, bool* pIsFailure)
+    {
+        return IsOutputFinished(puzzle, m_outputNodes, m_vizNodes, pIsFailure);
+    }
+
+    void Initialize()
+    {
+        ForEachNode([](auto& node) { node.Initialize(); });
+
+        if (m_pFlatGrid != nullptr)
+        {
+            m_pFlatGrid->Initialize();
+            m_pMemoGrid->Initialize();
+        }
+
+        if (m_spTimeWarpGrid)
+            m_spTimeWarpGrid->Initialize();
+
+        WakeAllNodes();
     }
 
     void ResetInputs(PuzzleType&& puzzle)
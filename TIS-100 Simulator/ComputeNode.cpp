@@ -1,7 +1,10 @@
 #include "pch.h"
 #include "Node.h"
-#include "ComputeNode.h"
 #include "IOChannel.h"
+#include "Engine.h"
+#include "ComputeNode.h"
+#include "Superinstructions.h"
+#include "Jit.h"
 
 #ifdef DEBUG_OUTPUT
 #define DEBUG(...) printf("compute%d: ", NodeId), printf(__VA_ARGS__), printf("\n")
@@ -324,18 +327,676 @@ std::string Instruction::ToString()
     return out.str();
 }
 
+#pragma region threaded execution
+
+static constexpr bool IsPortWrite(Target dst)
+{
+    return (dst != Target::None) && (dst != Target::NIL) && (dst != Target::ACC);
+}
+
+// Whether an instruction can run without touching any ports (or halting).
+static bool IsLocal(const DecodedInstruction& instr)
+{
+    return !IsPortWrite(instr.src) && !IsPortWrite(instr.dst) && (instr.op != Opcode::HCF);
+}
+
+// Instruction handlers for Engine::Threaded.
+// Operands are template parameters, so each handler is specialized for one instruction shape and
+// the port and register selection is resolved at compile time.
+struct ThreadedHandlers
+{
+    static bool ReadPort(ComputeNode* node, Target src)
+    {
+        node->m_state = ComputeNode::State::Read;
+        IOPort& port = node->IO(src);
+        if (port.IsConnected() && port.Read(&node->m_temp))
+        {
+            node->m_state = ComputeNode::State::Run;
+            return true;
+        }
+        return false;
+    }
+
+    // Load an operand into m_temp. Returns false if the node is blocked reading a port.
+    template <Target Src>
+    static bool ReadOperand(ComputeNode* node)
+    {
+        switch (Src)
+        {
+        case Target::None:
+            node->m_temp = node->m_spProgram->code[node->m_pc].immediate;
+            return true;
+
+        case Target::NIL:
+            node->m_temp = 0;
+            return true;
+
+        case Target::ACC:
+            node->m_temp = node->m_acc;
+            return true;
+
+        case Target::ANY:
+            node->m_state = ComputeNode::State::Read;
+            for (auto target : { Target::LEFT, Target::RIGHT, Target::UP, Target::DOWN }) // this is the order used in the game
+            {
+                IOPort& port = node->IO(target);
+                if (port.IsConnected() && port.Read(&node->m_temp))
+                    node->m_state = ComputeNode::State::Run;
+            }
+            return (node->m_state == ComputeNode::State::Run);
+
+        case Target::LAST:
+            if (node->m_last == Target::None)
+            {
+                // Same as reading from NIL; see ComputeNode::Read().
+                node->m_temp = 0;
+                return true;
+            }
+            return ReadPort(node, node->m_last);
+
+        default:
+            return ReadPort(node, Src);
+        }
+    }
+
+    static void WritePort(ComputeNode* node, Target dst)
+    {
+        node->m_state = ComputeNode::State::Write;
+        IOPort& port = node->IO(dst);
+        if (port.IsConnected())
+            port.Write(node->m_temp);
+    }
+
+    static void Nop(ComputeNode* node)
+    {
+        node->Advance();
+    }
+
+    static void Sav(ComputeNode* node)
+    {
+        node->m_bak = node->m_acc;
+        node->Advance();
+    }
+
+    static void Swp(ComputeNode* node)
+    {
+        std::swap(node->m_acc, node->m_bak);
+        node->Advance();
+    }
+
+    static void Hcf(ComputeNode* /*node*/)
+    {
+        throw std::exception("halt and catch fire"); // lol
+    }
+
+    // ADD, SUB and JRO: one source operand.
+    template <Opcode Op, Target Src>
+    static void SourceOp(ComputeNode* node)
+    {
+        if (!ReadOperand<Src>(node))
+            return;
+
+        switch (Op)
+        {
+        case Opcode::ADD:
+            node->m_acc += node->m_temp;
+            node->Advance();
+            break;
+
+        case Opcode::SUB:
+            node->m_acc -= node->m_temp;
+            node->Advance();
+            break;
+
+        case Opcode::JRO:
+            node->JumpRelative(node->m_temp);
+            break;
+        }
+    }
+
+    template <Target Src, Target Dst>
+    static void MovRead(ComputeNode* node)
+    {
+        if (!ReadOperand<Src>(node))
+            return;
+
+        if (IsPortWrite(Dst))
+        {
+            node->m_threadedWrite = true;
+        }
+        else
+        {
+            if (Dst == Target::ACC)
+                node->m_acc = node->m_temp;
+            node->Advance();
+        }
+    }
+
+    template <Target Dst>
+    static void MovWrite(ComputeNode* node)
+    {
+        switch (Dst)
+        {
+        case Target::ANY:
+            node->m_state = ComputeNode::State::Write;
+            // See ComputeNode::Write() regarding the order.
+            for (Target target : { Target::UP, Target::DOWN, Target::LEFT, Target::RIGHT })
+            {
+                IOPort& port = node->IO(target);
+                if (port.IsConnected())
+                    port.Write(node->m_temp);
+            }
+            break;
+
+        case Target::LAST:
+            if (node->m_last == Target::None)
+            {
+                // Same as writing to NIL; see ComputeNode::Write().
+                node->Advance();
+            }
+            else
+            {
+                WritePort(node, node->m_last);
+            }
+            break;
+
+        default:
+            WritePort(node, Dst);
+            break;
+        }
+    }
+
+    template <Opcode Op>
+    static void Jump(ComputeNode* node)
+    {
+        int acc = node->m_acc;
+        bool jumpPredicate = (Op == Opcode::JMP)
+            || ((Op == Opcode::JEZ) && (acc == 0))
+            || ((Op == Opcode::JNZ) && (acc != 0))
+            || ((Op == Opcode::JGZ) && (acc > 0))
+            || ((Op == Opcode::JLZ) && (acc < 0));
+
+        if (jumpPredicate)
+            node->m_pc = node->m_spProgram->code[node->m_pc].jumpTarget;
+        else
+            node->Advance();
+    }
+
+    // One instruction of a superinstruction, with its handler picked at compile time.
+    template <uint32_t Shape>
+    static void RunShape(ComputeNode* node)
+    {
+        constexpr Opcode Op = ShapeOpcode(Shape);
+        constexpr Target Src = ShapeSource(Shape);
+        constexpr Target Dst = ShapeDestination(Shape);
+
+        if constexpr (Op == Opcode::NOP)
+            Nop(node);
+        else if constexpr (Op == Opcode::MOV)
+            MovRead<Src, Dst>(node);
+        else if constexpr ((Op == Opcode::ADD) || (Op == Opcode::SUB) || (Op == Opcode::JRO))
+            SourceOp<Op, Src>(node);
+        else if constexpr (Op == Opcode::SAV)
+            Sav(node);
+        else if constexpr (Op == Opcode::SWP)
+            Swp(node);
+        else
+            Jump<Op>(node);
+    }
+
+    // Run all of a superinstruction's instructions now, and spend the rest of the cycles they would
+    // have taken busy.
+    template <uint32_t... Shapes>
+    static void RunSuperinstruction(ComputeNode* node)
+    {
+        (RunShape<Shapes>(node), ...);
+        node->m_state = ComputeNode::State::Busy;
+        node->m_busyCycles = sizeof...(Shapes) - 1;
+    }
+
+    struct SuperinstructionEntry
+    {
+        size_t length;
+        uint32_t shapes[MaxSuperinstructionLength];
+        ComputeNode::Handler handler;
+    };
+
+    template <uint32_t... Shapes>
+    static SuperinstructionEntry MakeEntry(Superinstruction<Shapes...>)
+    {
+        return { sizeof...(Shapes), { Shapes... }, &RunSuperinstruction<Shapes...> };
+    }
+
+    // The superinstructions in a list, followed by one with length 0.
+    template <typename... Superinstructions>
+    static const SuperinstructionEntry* Entries(SuperinstructionList<Superinstructions...>)
+    {
+        static const SuperinstructionEntry s_entries[] = { MakeEntry(Superinstructions())..., { 0, {}, nullptr } };
+        return s_entries;
+    }
+
+    // The first of ActiveSuperinstructions that starts at code[pc], if any.
+    static const SuperinstructionEntry* FindSuperinstruction(const std::vector<DecodedInstruction>& code, size_t pc)
+    {
+        for (const SuperinstructionEntry* pEntry = Entries(ActiveSuperinstructions()); pEntry->length != 0; ++pEntry)
+        {
+            size_t i = 0;
+            while ((i < pEntry->length) && (InstructionShape(code[(pc + i) % code.size()]) == pEntry->shapes[i]))
+                ++i;
+
+            if (i == pEntry->length)
+                return pEntry;
+        }
+        return nullptr;
+    }
+
+    // The number of iterations a counting loop runs before its jump falls through, starting with
+    // acc in ACC, where each iteration adds step. 0 if it never falls through, or only would once
+    // ACC had overflowed.
+    static int64_t CountingLoopIterations(Opcode condition, int64_t acc, int64_t step)
+    {
+        // At the nth jump, ACC is acc + n * step.
+        switch (condition)
+        {
+        case Opcode::JEZ:
+            if (acc + step != 0)
+                return 1;
+            return (step != 0) ? 2 : 0;
+
+        case Opcode::JNZ:
+            if (acc + step == 0)
+                return 1;
+            if ((step == 0) || ((-acc % step) != 0) || ((-acc / step) < 1))
+                return 0;
+            return -acc / step;
+
+        case Opcode::JGZ:
+            if (acc + step <= 0)
+                return 1;
+            if (step >= 0)
+                return 0;
+            return (acc - step - 1) / -step;
+
+        case Opcode::JLZ:
+            if (acc + step >= 0)
+                return 1;
+            if (step <= 0)
+                return 0;
+            return (-acc + step - 1) / step;
+
+        default:
+            return 0;
+        }
+    }
+
+    // Run all of the iterations of the counting loop that starts at the PC now, and spend the rest of
+    // the cycles they would have taken busy. A loop that wouldn't end just runs its first
+    // instruction.
+    static void RunCountingLoop(ComputeNode* node)
+    {
+        const ComputeNode::CountingLoop& loop = node->m_spProgram->countingLoops[node->m_pc];
+        int64_t acc = node->m_acc;
+        int64_t iterations = CountingLoopIterations(loop.condition, acc, loop.accStep);
+        if ((iterations == 0) || (iterations * loop.cycles > std::numeric_limits<int>::max()))
+        {
+            node->m_spProgram->threaded[node->m_pc].read(node);
+            return;
+        }
+
+        switch (loop.bakSource)
+        {
+        case ComputeNode::LoopSource::Acc:
+            node->m_bak = static_cast<int>(acc + (iterations - 1) * loop.accStep + loop.bakStep);
+            break;
+
+        case ComputeNode::LoopSource::Bak:
+            node->m_bak = static_cast<int>(node->m_bak + iterations * loop.bakStep);
+            break;
+
+        case ComputeNode::LoopSource::None:
+            node->m_bak = loop.bakStep;
+            break;
+        }
+
+        node->m_acc = static_cast<int>(acc + iterations * loop.accStep);
+        node->m_pc = loop.exitPc;
+        node->m_state = ComputeNode::State::Busy;
+        node->m_busyCycles = static_cast<int>(iterations * loop.cycles) - 1;
+    }
+
+    // Entries in a transducer's cache.
+    static constexpr size_t TransducerSlots = 256;
+
+    // Transducers stop caching after this many reads if fewer than half of them were found in the
+    // cache: the node keeps state between values, so its entries are rarely used again.
+    static constexpr int64_t TransducerTrialReads = 256;
+
+    // The most cycles that are run ahead after a read. Instructions that take longer are left
+    // partway through, and aren't cached.
+    static constexpr int MaxTransducerCycles = 1024;
+
+    // A port read that begins a transducer: see ComputeNode::Transducer.
+    static void RunTransducer(ComputeNode* node)
+    {
+        size_t head = node->m_pc;
+        node->m_spProgram->threaded[head].read(node);
+        if (node->m_state != ComputeNode::State::Run)
+            return;
+
+        ComputeNode::Transducer& transducer = node->m_transducers[head];
+        ++transducer.reads;
+
+        int acc = node->m_acc;
+        int bak = node->m_bak;
+        ComputeNode::TransducerEntry* pEntry = nullptr;
+        if (!transducer.entries.empty())
+        {
+            uint32_t hash = static_cast<uint32_t>(acc) * 31 + static_cast<uint32_t>(bak);
+            pEntry = &transducer.entries[hash % TransducerSlots];
+            if (pEntry->valid && (pEntry->acc == acc) && (pEntry->bak == bak))
+            {
+                ++transducer.hits;
+                node->m_acc = pEntry->resultAcc;
+                node->m_bak = pEntry->resultBak;
+                node->m_pc = pEntry->resultPc;
+                node->m_state = ComputeNode::State::Busy;
+                node->m_busyCycles = pEntry->cycles;
+                return;
+            }
+        }
+
+        int cycles = node->RunLocal(MaxTransducerCycles);
+        if (node->m_state == ComputeNode::State::Busy)
+            cycles += node->m_busyCycles;
+        else if ((pEntry != nullptr) && (cycles < MaxTransducerCycles))
+            *pEntry = ComputeNode::TransducerEntry{ true, acc, bak, node->m_acc, node->m_bak, node->m_pc, cycles };
+
+        node->m_state = ComputeNode::State::Busy;
+        node->m_busyCycles = cycles;
+
+        if ((transducer.reads == TransducerTrialReads) && (transducer.hits * 2 < transducer.reads))
+            std::vector<ComputeNode::TransducerEntry>().swap(transducer.entries);
+    }
+
+    // Whether the conditional jump at code[tail] closes a counting loop, and if so, what it does.
+    static bool FindCountingLoop(const std::vector<DecodedInstruction>& code, size_t tail, ComputeNode::CountingLoop* pLoop)
+    {
+        const DecodedInstruction& jump = code[tail];
+        if ((jump.op < Opcode::JEZ) || (jump.op > Opcode::JLZ) || (jump.jumpTarget >= tail))
+            return false;
+
+        // What ACC and BAK are after each instruction of an iteration, in terms of what they were at
+        // the start of it.
+        struct Value
+        {
+            ComputeNode::LoopSource source;
+            int64_t step;
+        };
+        Value acc = { ComputeNode::LoopSource::Acc, 0 };
+        Value bak = { ComputeNode::LoopSource::Bak, 0 };
+
+        for (size_t pc = jump.jumpTarget; pc < tail; ++pc)
+        {
+            const DecodedInstruction& instr = code[pc];
+            if (!IsFusableShape(InstructionShape(instr), false))
+                return false;
+
+            Value src = { ComputeNode::LoopSource::None, 0 };
+            if (instr.src == Target::None)
+                src.step = instr.immediate;
+            else if (instr.src == Target::ACC)
+                src = acc;
+
+            switch (instr.op)
+            {
+            case Opcode::NOP:
+                break;
+
+            case Opcode::MOV:
+                if (instr.dst == Target::ACC)
+                    acc = src;
+                break;
+
+            case Opcode::ADD:
+            case Opcode::SUB:
+                // ADD ACC doubles ACC, which isn't a step.
+                if ((src.source != ComputeNode::LoopSource::None) && (instr.src == Target::ACC))
+                    return false;
+                acc.step += (instr.op == Opcode::ADD) ? src.step : -src.step;
+                break;
+
+            case Opcode::SAV:
+                bak = acc;
+                break;
+
+            case Opcode::SWP:
+                std::swap(acc, bak);
+                break;
+
+            default:
+                return false;
+            }
+
+            if ((std::abs(acc.step) > std::numeric_limits<int>::max()) || (std::abs(bak.step) > std::numeric_limits<int>::max()))
+                return false;
+        }
+
+        // Otherwise the jump is either always or never taken after the first iteration.
+        if (acc.source != ComputeNode::LoopSource::Acc)
+            return false;
+
+        pLoop->cycles = static_cast<int>(tail - jump.jumpTarget + 1);
+        pLoop->condition = jump.op;
+        pLoop->exitPc = (tail + 1 < code.size()) ? (tail + 1) : 0;
+        pLoop->accStep = static_cast<int>(acc.step);
+        pLoop->bakSource = bak.source;
+        pLoop->bakStep = static_cast<int>(bak.step);
+        return true;
+    }
+
+    template <Opcode Op>
+    static ComputeNode::Handler SelectSourceOp(Target src)
+    {
+        switch (src)
+        {
+#define SRC(_) case Target::_: return &SourceOp<Op, Target::_>
+            SRC(None);
+            SRC(NIL);
+            SRC(ACC);
+            SRC(UP);
+            SRC(DOWN);
+            SRC(LEFT);
+            SRC(RIGHT);
+            SRC(ANY);
+            SRC(LAST);
+#undef SRC
+        default:
+            throw std::exception("invalid source operand");
+        }
+    }
+
+    template <Target Src>
+    static ComputeNode::ThreadedInstruction SelectMov(Target dst)
+    {
+        switch (dst)
+        {
+#define DST(_) case Target::_: return { &MovRead<Src, Target::_>, IsPortWrite(Target::_) ? &MovWrite<Target::_> : nullptr }
+            DST(None);
+            DST(NIL);
+            DST(ACC);
+            DST(UP);
+            DST(DOWN);
+            DST(LEFT);
+            DST(RIGHT);
+            DST(ANY);
+            DST(LAST);
+#undef DST
+        default:
+            throw std::exception("invalid destination operand");
+        }
+    }
+
+    static ComputeNode::ThreadedInstruction SelectMov(Target src, Target dst)
+    {
+        switch (src)
+        {
+#define SRC(_) case Target::_: return SelectMov<Target::_>(dst)
+            SRC(None);
+            SRC(NIL);
+            SRC(ACC);
+            SRC(UP);
+            SRC(DOWN);
+            SRC(LEFT);
+            SRC(RIGHT);
+            SRC(ANY);
+            SRC(LAST);
+#undef SRC
+        default:
+            throw std::exception("invalid source operand");
+        }
+    }
+
+    static ComputeNode::ThreadedInstruction Select(const DecodedInstruction& instr)
+    {
+        switch (instr.op)
+        {
+        case Opcode::NOP: return { &Nop, nullptr };
+        case Opcode::MOV: return SelectMov(instr.src, instr.dst);
+        case Opcode::ADD: return { SelectSourceOp<Opcode::ADD>(instr.src), nullptr };
+        case Opcode::SUB: return { SelectSourceOp<Opcode::SUB>(instr.src), nullptr };
+        case Opcode::SAV: return { &Sav, nullptr };
+        case Opcode::SWP: return { &Swp, nullptr };
+        case Opcode::JMP: return { &Jump<Opcode::JMP>, nullptr };
+        case Opcode::JEZ: return { &Jump<Opcode::JEZ>, nullptr };
+        case Opcode::JNZ: return { &Jump<Opcode::JNZ>, nullptr };
+        case Opcode::JGZ: return { &Jump<Opcode::JGZ>, nullptr };
+        case Opcode::JLZ: return { &Jump<Opcode::JLZ>, nullptr };
+        case Opcode::JRO: return { SelectSourceOp<Opcode::JRO>(instr.src), nullptr };
+        case Opcode::HCF: return { &Hcf, nullptr };
+        default:
+            throw std::exception("invalid opcode");
+        }
+    }
+};
+
+#pragma endregion
+
+const std::shared_ptr<const ComputeNode::Program> ComputeNode::s_spEmptyProgram(new ComputeNode::Program());
+
 ComputeNode::ComputeNode()
     : m_state(State::Unprogrammed)
     , m_pc(0)
     , m_acc(0)
     , m_bak(0)
     , m_last(Target::None)
+    , m_spProgram(s_spEmptyProgram)
+    , m_handlers(nullptr)
+    , m_threadedWrite(false)
+    , m_busyCycles(0)
+    , m_engine(Engine::Interpreter)
+{
+}
+
+ComputeNode::~ComputeNode()
 {
 }
 
+// Convert a parsed instruction into its executable form.
+//
+// Formal Parameters:
+//  instr: the parsed instruction.
+//  labels: instruction indices of all the labels in the program.
+//  instructionCount: number of instructions in the program.
+//  line: source line of the instruction, for error messages.
+//
+// Throws if the instruction can't be executed, e.g. because it jumps to an undefined label.
+static DecodedInstruction Decode(
+    const Instruction& instr,
+    const std::unordered_map<std::string, size_t>& labels,
+    size_t instructionCount,
+    int line
+    )
+{
+    auto decode_error = [line](const std::string& message)
+    {
+        std::stringstream out;
+        out << "line " << line << ": " << message;
+        return std::exception(out.str().c_str());
+    };
+
+    DecodedInstruction decoded = {};
+    decoded.op = instr.op;
+    decoded.src = Target::None;
+    decoded.dst = Target::None;
+
+    if (IsJumpOpcode(instr.op) && (instr.argsType != InstructionArgsType::JumpTarget))
+        throw decode_error("jump instruction needs a target");
+
+    switch (instr.argsType)
+    {
+    case InstructionArgsType::Immediate:
+        decoded.immediate = instr.args.arg1.immediate;
+        break;
+
+    case InstructionArgsType::Target:
+        decoded.src = instr.args.arg1.target;
+        break;
+
+    case InstructionArgsType::JumpTarget:
+    {
+        const JumpTarget& jumpTarget = *instr.args.jumpTarget;
+        switch (jumpTarget.type)
+        {
+        case JumpTargetType::Indeterminate:
+            throw decode_error("indeterminate jump target");
+
+        case JumpTargetType::Target:
+            if (instr.op != Opcode::JRO)
+                throw decode_error("target jumps are only supported for JRO");
+            decoded.src = jumpTarget.value.target;
+            break;
+
+        case JumpTargetType::Offset:
+            decoded.immediate = jumpTarget.value.offset;
+            break;
+
+        case JumpTargetType::Label:
+        {
+            const std::string& label = *jumpTarget.value.label;
+            auto pair = labels.find(label);
+            if (pair == labels.end())
+            {
+                Target target;
+                if (TryParseTarget(label, &target))
+                    throw decode_error("target jumps are only supported for JRO");
+                else
+                    throw decode_error("undefined label \"" + label + "\"");
+            }
+
+            // A label after the last instruction wraps around to the first one.
+            decoded.jumpTarget = (pair->second < instructionCount) ? pair->second : 0;
+        }
+        break;
+        }
+    }
+    break;
+    }
+
+    if (IsTwoArgOpcode(instr.op))
+        decoded.dst = instr.args.arg2;
+
+    return decoded;
+}
+
 void ComputeNode::Assemble(const std::string& assembly)
 {
-    m_instructions.clear();
+    std::shared_ptr<Program> spProgram(new Program());
+    Program& program = *spProgram;
+
+    std::unordered_map<std::string, size_t> labels;
+    std::vector<int> instructionLines;
+    int instrLine = 0;
+    int wordLine = 0;
 
     Instruction instr;
     int line = 1;
@@ -410,7 +1071,7 @@ void ComputeNode::Assemble(const std::string& assembly)
         else if ((c == ':') && (instr.op == Opcode::Indeterminate))
         {
             // label was defined
-            m_labels.emplace(word, m_instructions.size());
+            labels.emplace(word, program.instructions.size());
             word.clear();
             continue;
         }
@@ -425,7 +1086,7 @@ void ComputeNode::Assemble(const std::string& assembly)
         else if ((c == '!') && ((i == 0) || (assembly[i - 1] == '\n')))
         {
             // line that starts with a bang is a breakpoint
-            m_breakpoints.push_back(m_instructions.size() + 1);
+            program.breakpoints.push_back(program.instructions.size() + 1);
             continue;
         }
 
@@ -434,7 +1095,10 @@ void ComputeNode::Assemble(const std::string& assembly)
             if (instr.op == Opcode::Indeterminate)
             {
                 if (!word.empty())
+                {
                     ParseOpcode(word, &instr.op);
+                    instrLine = wordLine;
+                }
             }
             else if (IsOneArgOpcode(instr.op))
             {
@@ -487,6 +1151,8 @@ void ComputeNode::Assemble(const std::string& assembly)
                 || ((c >= '0' && c <= '9'))
                 || (c == '-'))
             {
+                if (word.empty())
+                    wordLine = line;
                 word.push_back(c);
             }
             else if (c != '\0')
@@ -498,7 +1164,10 @@ void ComputeNode::Assemble(const std::string& assembly)
         if (instrComplete)
         {
             if (instr.op != Opcode::Indeterminate)
-                m_instructions.push_back(std::move(instr));
+            {
+                program.instructions.push_back(std::move(instr));
+                instructionLines.push_back(instrLine);
+            }
             instr.Clear();
             instrComplete = false;
         }
@@ -506,23 +1175,189 @@ void ComputeNode::Assemble(const std::string& assembly)
 
     if (instr.op != Opcode::Indeterminate)
     {
-        m_instructions.push_back(instr);
+        program.instructions.push_back(instr);
+        instructionLines.push_back(instrLine);
+    }
+
+    // Resolve labels now, so that the program never has to look them up while it's running.
+    program.code.reserve(program.instructions.size());
+    for (size_t i = 0; i < program.instructions.size(); ++i)
+    {
+        program.code.push_back(Decode(program.instructions[i], labels, program.instructions.size(), instructionLines[i]));
+    }
+
+    program.threaded.clear();
+    program.threaded.reserve(program.code.size());
+    for (const DecodedInstruction& instr : program.code)
+    {
+        ThreadedInstruction threaded = ThreadedHandlers::Select(instr);
+        threaded.local = IsLocal(instr);
+        threaded.length = 1;
+        program.threaded.push_back(threaded);
+    }
+
+    program.fusedHandlers = program.threaded;
+    for (size_t pc = 0; pc < program.code.size(); ++pc)
+    {
+        auto pEntry = ThreadedHandlers::FindSuperinstruction(program.code, pc);
+        if (pEntry != nullptr)
+        {
+            program.fusedHandlers[pc].read = pEntry->handler;
+            program.fusedHandlers[pc].length = pEntry->length;
+        }
+    }
+
+    // Loops take precedence over superinstructions, since they can skip far more.
+    program.countingLoops.assign(program.code.size(), CountingLoop());
+    for (size_t pc = 0; pc < program.code.size(); ++pc)
+    {
+        CountingLoop loop;
+        if (ThreadedHandlers::FindCountingLoop(program.code, pc, &loop))
+        {
+            size_t head = program.code[pc].jumpTarget;
+            program.countingLoops[head] = loop;
+            program.fusedHandlers[head].read = &ThreadedHandlers::RunCountingLoop;
+            program.fusedHandlers[head].length = 1;
+        }
+    }
+
+    // Reads that go on to instructions that don't use ports. A read that also writes a port, or
+    // that jumps somewhere that depends on the value, is left alone.
+    for (size_t pc = 0; pc < program.code.size(); ++pc)
+    {
+        const DecodedInstruction& instr = program.code[pc];
+        size_t next = (pc + 1 < program.code.size()) ? (pc + 1) : 0;
+        if (IsPortWrite(instr.src) && !IsPortWrite(instr.dst) && (instr.op != Opcode::JRO) && program.threaded[next].local)
+            program.fusedHandlers[pc].read = &ThreadedHandlers::RunTransducer;
+    }
+
+    // Nodes without a program are common, and all the same.
+    if (program.instructions.empty())
+        m_spProgram = s_spEmptyProgram;
+    else
+        m_spProgram = std::move(spProgram);
+    ResetTransducers();
+    SetEngine(m_engine);
+}
+
+void ComputeNode::ShareProgram(const ComputeNode& other)
+{
+    m_spProgram = other.m_spProgram;
+    ResetTransducers();
+    SetEngine(m_engine);
+}
+
+// Each node caches what its own transducers do, since the registers they start from differ from one
+// node to the next.
+void ComputeNode::ResetTransducers()
+{
+    const std::vector<ThreadedInstruction>& handlers = m_spProgram->fusedHandlers;
+    m_transducers.assign(handlers.size(), Transducer());
+    for (size_t pc = 0; pc < handlers.size(); ++pc)
+    {
+        if (handlers[pc].read == &ThreadedHandlers::RunTransducer)
+            m_transducers[pc].entries.resize(ThreadedHandlers::TransducerSlots);
     }
 }
 
+int ComputeNode::RunLocal(int maxCycles)
+{
+    int cycles = 0;
+    for (;;)
+    {
+        if (m_state == State::Busy)
+        {
+            // Wait out a superinstruction or counting loop, or as much of it as fits.
+            int wait = std::min(m_busyCycles, maxCycles - cycles);
+            cycles += wait;
+            m_busyCycles -= wait;
+            if (m_busyCycles > 0)
+                break;
+            m_state = State::Run;
+        }
+
+        if ((m_state != State::Run) || (cycles == maxCycles) || !m_spProgram->threaded[m_pc].local)
+            break;
+
+        m_handlers[m_pc].read(this);
+        ++cycles;
+    }
+    return cycles;
+}
+
+int ComputeNode::BusyCycles() const
+{
+    return (m_state == State::Busy) ? m_busyCycles : 0;
+}
+
+void ComputeNode::WaitBusy(int cycles)
+{
+    m_busyCycles -= cycles;
+    if (m_busyCycles == 0)
+        m_state = State::Run;
+}
+
+void ComputeNode::GetTransducerStats(int64_t* pReads, int64_t* pHits) const
+{
+    *pReads = 0;
+    *pHits = 0;
+    for (const Transducer& transducer : m_transducers)
+    {
+        *pReads += transducer.reads;
+        *pHits += transducer.hits;
+    }
+}
+
+void ComputeNode::SetEngine(Engine engine)
+{
+    m_engine = engine;
+
+    if (engine == Engine::Jit)
+    {
+        JitCompiler::Compile(this);
+        m_handlers = m_jitHandlers.data();
+    }
+    else
+    {
+        m_jitHandlers.clear();
+        m_jitCode.reset();
+        m_handlers = m_spProgram->fusedHandlers.data();
+    }
+}
+
+bool ComputeNode::IsStartingInstruction() const
+{
+    return m_state == State::Run;
+}
+
+size_t ComputeNode::ProgramCounter() const
+{
+    return m_pc;
+}
+
+size_t ComputeNode::HandlerLength(size_t pc) const
+{
+    return m_spProgram->fusedHandlers[pc].length;
+}
+
 int ComputeNode::InstructionCount() const
 {
-    return m_instructions.size();
+    return m_spProgram->instructions.size();
 }
 
-void ComputeNode::SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO)
+const std::vector<DecodedInstruction>& ComputeNode::Code() const
 {
-    m_neighbors[static_cast<size_t>(direction)] = spIO;
+    return m_spProgram->code;
+}
+
+void ComputeNode::SetNeighbor(Neighbor direction, const IOPort& port)
+{
+    m_neighbors[static_cast<size_t>(direction)] = port;
 }
 
 void ComputeNode::Initialize()
 {
-    if (m_instructions.size() > 0)
+    if (m_spProgram->instructions.size() > 0)
     {
         m_state = State::Run;
     }
@@ -534,15 +1369,17 @@ void ComputeNode::Initialize()
     m_acc = 0;
     m_bak = 0;
     m_last = Target::None;
+    m_threadedWrite = false;
+    m_busyCycles = 0;
 
-    for (std::shared_ptr<IOChannel>& io : m_neighbors)
+    for (IOPort& port : m_neighbors)
     {
-        if (io != nullptr)
-            io->CancelWrite(this);
+        if (port.IsConnected())
+            port.CancelWrite();
     }
 }
 
-std::shared_ptr<IOChannel>& ComputeNode::IO(Target target)
+IOPort& ComputeNode::IO(Target target)
 {
     return m_neighbors[static_cast<size_t>(TargetToNeighbor(target))];
 }
@@ -555,44 +1392,16 @@ void ComputeNode::Read()
         return;
     }
 
-    Instruction& instr = m_instructions[m_pc];
-    DEBUG("Read(): %s", instr.ToString().c_str());
+    const DecodedInstruction& instr = m_spProgram->code[m_pc];
+    DEBUG("Read(): %s", m_spProgram->instructions[m_pc].ToString().c_str());
 
-    Target readTarget = Target::None;
-
-    switch (instr.op)
-    {
-    case Opcode::MOV:
-    case Opcode::ADD:
-    case Opcode::SUB:
-        if (instr.argsType == InstructionArgsType::Immediate)
-            m_temp = instr.args.arg1.immediate;
-        else
-            readTarget = instr.args.arg1.target;
-        break;
-
-    case Opcode::JRO:
-        if (instr.args.jumpTarget->type == JumpTargetType::Target)
-        {
-            readTarget = instr.args.jumpTarget->value.target;
-        }
-        break;
-
-    case Opcode::JMP:
-    case Opcode::JEZ:
-    case Opcode::JNZ:
-    case Opcode::JGZ:
-    case Opcode::JLZ:
-        if (instr.args.jumpTarget->type == JumpTargetType::Target)
-        {
-            throw std::exception("target jumps are only supported for JRO");
-        }
-        break;
-    }
+    Target readTarget = instr.src;
 
     switch (readTarget)
     {
     case Target::None:
+        // Immediate value (or JRO offset). Unused by instructions that don't read anything.
+        m_temp = instr.immediate;
         break;
 
     case Target::NIL:
@@ -610,11 +1419,11 @@ void ComputeNode::Read()
 port_read:
     {
         m_state = State::Read;
-        std::shared_ptr<IOChannel>& spIO = IO(readTarget);
-        if (spIO != nullptr)
+        IOPort& port = IO(readTarget);
+        if (port.IsConnected())
         {
             DEBUG("reading from target %s", TargetToString(readTarget).c_str());
-            if (spIO->Read(this, &m_temp))
+            if (port.Read(&m_temp))
                 m_state = State::Run;
         }
         else
@@ -627,11 +1436,11 @@ port_read:
         DEBUG("reading from ANY");
         for (auto target : { Target::LEFT, Target::RIGHT, Target::UP, Target::DOWN }) // this is the order used in the game
         {
-            std::shared_ptr<IOChannel>& spIO = IO(target);
-            if (spIO != nullptr)
+            IOPort& port = IO(target);
+            if (port.IsConnected())
             {
                 DEBUG("reading from target %s", TargetToString(readTarget).c_str());
-                if (spIO->Read(this, &m_temp))
+                if (port.Read(&m_temp))
                     m_state = State::Run;
             }
         }
@@ -663,8 +1472,8 @@ void ComputeNode::Compute()
         return;
     }
 
-    Instruction& instr = m_instructions[m_pc];
-    DEBUG("Compute(): %s", instr.ToString().c_str());
+    const DecodedInstruction& instr = m_spProgram->code[m_pc];
+    DEBUG("Compute(): %s", m_spProgram->instructions[m_pc].ToString().c_str());
 
     switch (instr.op)
     {
@@ -697,17 +1506,10 @@ void ComputeNode::Write()
         return;
     }
 
-    Instruction& instr = m_instructions[m_pc];
-    DEBUG("Write(): %s", instr.ToString().c_str());
+    const DecodedInstruction& instr = m_spProgram->code[m_pc];
+    DEBUG("Write(): %s", m_spProgram->instructions[m_pc].ToString().c_str());
 
-    Target writeTarget = Target::None;
-
-    switch (instr.op)
-    {
-    case Opcode::MOV:
-        writeTarget = instr.args.arg2;
-        break;
-    }
+    Target writeTarget = instr.dst;
 
     switch (writeTarget)
     {
@@ -726,11 +1528,11 @@ void ComputeNode::Write()
 port_write:
     {
         m_state = State::Write;
-        std::shared_ptr<IOChannel>& spIO = IO(writeTarget);
-        if (spIO != nullptr)
+        IOPort& port = IO(writeTarget);
+        if (port.IsConnected())
         {
             DEBUG("writing to target %s", TargetToString(writeTarget).c_str());
-            spIO->Write(this, m_temp);
+            port.Write(m_temp);
         }
         else
             DEBUG("nobody to write to at %s", TargetToString(writeTarget).c_str());
@@ -745,11 +1547,11 @@ port_write:
         // This will pose a compatibility problem if we don't execute the nodes in the same order.
         for (Target target : { Target::UP, Target::DOWN, Target::LEFT, Target::RIGHT })
         {
-            std::shared_ptr<IOChannel> spIO = IO(target);
-            if (spIO != nullptr)
+            IOPort& port = IO(target);
+            if (port.IsConnected())
             {
                 DEBUG("writing to target %s", TargetToString(target).c_str());
-                spIO->Write(this, m_temp);
+                port.Write(m_temp);
             }
         }
         break;
@@ -778,19 +1580,18 @@ void ComputeNode::WriteComplete()
     case State::Write:
         DEBUG("write complete");
         m_state = State::WriteComplete;
-        if ((m_instructions[m_pc].op == Opcode::MOV)
-            && m_instructions[m_pc].args.arg2 == Target::ANY)
+        if (m_spProgram->code[m_pc].dst == Target::ANY)
         {
             // Cancel the other writes.
             // This is not thread-safe, and so assumes the nodes are executed sequentially.
             DEBUG("cancelling other writes");
             for (Target target : { Target::UP, Target::DOWN, Target::LEFT, Target::RIGHT })
             {
-                std::shared_ptr<IOChannel> spIO = IO(target);
-                if (spIO != nullptr)
+                IOPort& port = IO(target);
+                if (port.IsConnected())
                 {
                     DEBUG("cancelling write to %s", TargetToString(target).c_str());
-                    spIO->CancelWrite(this);
+                    port.CancelWrite();
                 }
             }
         }
@@ -810,6 +1611,7 @@ void ComputeNode::Step()
     case State::Unprogrammed:
     case State::Read:
     case State::Write:
+    case State::Busy:
         DEBUG("Step(): blocked");
         return;
 
@@ -819,7 +1621,7 @@ void ComputeNode::Step()
         break;
     }
 
-    Instruction& instr = m_instructions[m_pc];
+    const DecodedInstruction& instr = m_spProgram->code[m_pc];
 
     bool jumpPredicate = false;
 
@@ -852,20 +1654,15 @@ void ComputeNode::Step()
 
     if (jumpPredicate)
     {
-        switch (instr.args.jumpTarget->type)
+        if (instr.op == Opcode::JRO)
         {
-        case JumpTargetType::Indeterminate:
-            throw std::exception("indeterminate jump target");
-        case JumpTargetType::Label:
-            m_pc = m_labels.find(*instr.args.jumpTarget->value.label)->second;
-            break;
-        case JumpTargetType::Offset:
-            m_pc += instr.args.jumpTarget->value.offset;
-            break;
-        case JumpTargetType::Target:
             // offset was loaded by Read()
             m_pc += m_temp;
         }
+        else
+        {
+            m_pc = instr.jumpTarget;
+        }
         DEBUG("Step(): jumping");
     }
     else
@@ -874,12 +1671,12 @@ void ComputeNode::Step()
         ++m_pc;
     }
 
-    if (m_pc >= m_instructions.size())
+    if (m_pc >= m_spProgram->code.size())
     {
         if ((instr.op == Opcode::JRO) && jumpPredicate)
         {
             // if you JRO to an out-of-range instruction, the pc goes to the last instruction.
-            m_pc = m_instructions.size() - 1;
+            m_pc = m_spProgram->code.size() - 1;
         }
         else
         {
@@ -892,4 +1689,34 @@ void ComputeNode::Step()
     }
 
     DEBUG("Step(): new PC is %d", m_pc);
+}
+bool ComputeNode::IsIdle() const
+{
+    // Blocked on a read or write; IOChannel wakes it up when that can go through.
+    return (m_state == State::Read) || (m_state == State::Write) || (m_state == State::Unprogrammed);
+}
+
+void ComputeNode::SaveState(std::vector<int>& state) const
+{
+    state.push_back(static_cast<int>(m_state));
+    state.push_back(static_cast<int>(m_pc));
+    state.push_back(m_acc);
+    state.push_back(m_bak);
+    state.push_back(m_temp);
+    state.push_back(static_cast<int>(m_last));
+    state.push_back(m_threadedWrite ? 1 : 0);
+    state.push_back(m_busyCycles);
+}
+
+const int* ComputeNode::RestoreState(const int* state)
+{
+    m_state = static_cast<State>(state[0]);
+    m_pc = static_cast<size_t>(state[1]);
+    m_acc = state[2];
+    m_bak = state[3];
+    m_temp = state[4];
+    m_last = static_cast<Target>(state[5]);
+    m_threadedWrite = (state[6] != 0);
+    m_busyCycles = state[7];
+    return state + 8;
 }
\ No newline at end of file
@@ -1,6 +1,6 @@
 #pragma once
 
-enum class Opcode
+enum class Opcode : uint8_t
 {
     Indeterminate,
     NOP,
@@ -18,7 +18,7 @@ enum class Opcode
     HCF // lol
 };
 
-enum class Target
+enum class Target : uint8_t
 {
     None,
     NIL,
@@ -90,8 +90,33 @@ public:
     std::string ToString();
 };
 
-class ComputeNode : public INode
+// Executable form of an Instruction, produced by ComputeNode::Assemble.
+// Labels are already resolved to absolute instruction indices, so running it never needs to look at
+// strings or follow pointers.
+struct DecodedInstruction
 {
+    Opcode op;
+
+    // Where the value comes from: a register or port, or Target::None for the immediate.
+    Target src;
+
+    // Where the value goes, for MOV. Target::None otherwise.
+    Target dst;
+
+    // The literal source value for MOV/ADD/SUB, or the offset for JRO.
+    int immediate;
+
+    // Instruction index to go to when a label jump is taken.
+    size_t jumpTarget;
+};
+
+class ExecutableBuffer;
+
+class ComputeNode final : public INode
+{
+    friend struct ThreadedHandlers;
+    friend class JitCompiler;
+
 private:
     enum class State
     {
@@ -100,10 +125,91 @@ private:
         Read,
         Write,
         WriteComplete,
+
+        // Waiting out the cycles of a superinstruction, counting loop, transducer or compiled run of
+        // instructions that has already run (see Superinstructions.h, CountingLoop, Transducer and
+        // JitCompiler).
+        Busy,
     };
 
     static int s_nextNodeId;
 
+    typedef void (*Handler)(ComputeNode* node);
+
+    // Handlers used by Engine::Threaded for one instruction, specialized for its opcode and operands.
+    // read does as much of the instruction as can be done in the read phase, which is all of it
+    // unless it writes to a port. write posts the port write.
+    // local is set if the instruction doesn't use any ports, so read always does all of it.
+    // length is the number of instructions read runs, which is more than 1 for a superinstruction.
+    struct ThreadedInstruction
+    {
+        Handler read;
+        Handler write;
+        bool local = false;
+        size_t length = 1;
+    };
+
+    // Where a register's value at the end of an iteration of a CountingLoop comes from, before its
+    // step is added.
+    enum class LoopSource
+    {
+        Acc, // ACC at the start of the iteration
+        Bak, // BAK at the start of the iteration
+        None // nothing; the value is just the step
+    };
+
+    // A loop that doesn't use any ports and only counts: each iteration adds the same amount to ACC,
+    // and the conditional jump at the end of it goes back to the first instruction. From the first
+    // instruction, ThreadedHandlers::RunCountingLoop works out how many iterations there will be and
+    // what the registers will be after them, then spends the cycles they would have taken busy.
+    struct CountingLoop
+    {
+        int cycles; // per iteration; 0 if no loop starts at this instruction
+        Opcode condition;
+        size_t exitPc;
+        int accStep;
+        LoopSource bakSource;
+        int bakStep;
+    };
+
+    // What the instructions after a port read did, from one set of registers right after the read:
+    // the registers and PC they left, and how many cycles they took.
+    struct TransducerEntry
+    {
+        bool valid;
+        int acc;
+        int bak;
+        int resultAcc;
+        int resultBak;
+        size_t resultPc;
+        int cycles;
+    };
+
+    // An instruction that reads a port and is followed by instructions that don't use any. Once the
+    // read is done, ThreadedHandlers::RunTransducer runs those straight away and spends the cycles
+    // they would have taken busy. For nodes that transform each value they're sent and then come
+    // back to the same registers, what they do for each value is looked up here instead.
+    struct Transducer
+    {
+        std::vector<TransducerEntry> entries; // empty if the cache isn't in use
+        int64_t reads;
+        int64_t hits;
+    };
+
+    // What Assemble makes of a program. It never changes after that, so nodes in other grids built
+    // for the same program share it (see ShareProgram).
+    struct Program
+    {
+        std::vector<Instruction> instructions;
+        std::vector<DecodedInstruction> code;
+        std::vector<ThreadedInstruction> threaded;
+        std::vector<ThreadedInstruction> fusedHandlers; // threaded, with superinstructions and counting loops where they fit
+        std::vector<CountingLoop> countingLoops; // by the PC of the loop's first instruction
+        std::vector<size_t> breakpoints;
+    };
+
+    static const std::shared_ptr<const Program> s_spEmptyProgram;
+
 private:
     State m_state;
     size_t m_pc;
@@ -111,18 +217,33 @@ private:
     int m_bak;
     int m_temp;
     Target m_last;
-    std::vector<Instruction> m_instructions;
-    std::unordered_map<std::string, size_t> m_labels;
-    std::vector<size_t> m_breakpoints;
-    std::shared_ptr<IOChannel> m_neighbors[static_cast<size_t>(Neighbor::COUNT)];
+    std::shared_ptr<const Program> m_spProgram;
+    std::vector<Transducer> m_transducers; // by the PC of the port read
+    std::vector<ThreadedInstruction> m_jitHandlers;
+    std::unique_ptr<ExecutableBuffer> m_jitCode;
+    const ThreadedInstruction* m_handlers; // the program's fusedHandlers or m_jitHandlers, depending on m_engine
+    bool m_threadedWrite;
+    int m_busyCycles;
+    Engine m_engine;
+    IOPort m_neighbors[static_cast<size_t>(Neighbor::COUNT)];
 
 public:
     ComputeNode();
+    virtual ~ComputeNode();
 
     void Assemble(const std::string& assembly);
+
+    // Run the same program as other, which has been assembled, without assembling it again.
+    void ShareProgram(const ComputeNode& other);
+
     int InstructionCount() const;
+    const std::vector<DecodedInstruction>& Code() const;
+
+    // Select the handlers used by ThreadedRead/ThreadedWrite. Engine::Jit compiles the program to
+    // native code, now and whenever it is re-assembled.
+    void SetEngine(Engine engine);
 
-    virtual void SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO);
+    virtual void SetNeighbor(Neighbor direction, const IOPort& port);
     virtual void Initialize();
 
     virtual void Read();
@@ -130,7 +251,86 @@ public:
     virtual void Write();
     virtual void WriteComplete();
     virtual void Step();
+    virtual bool IsIdle() const;
+    virtual void SaveState(std::vector<int>& state) const;
+    virtual const int* RestoreState(const int* state);
+
+    // Engine::Threaded entry points. ThreadedRead is called on every node in the read phase, then
+    // ThreadedWrite on every node in the write phase; together they have the same effect as
+    // Read, Compute, Write and Step.
+    void ThreadedRead();
+    void ThreadedWrite();
+
+    // For profiling: whether the node starts the instruction at its PC in the next cycle, as
+    // opposed to being blocked partway through one.
+    bool IsStartingInstruction() const;
+    size_t ProgramCounter() const;
+
+    // The number of instructions that Engine::Threaded runs at once from pc: more than 1 where a
+    // superinstruction starts.
+    size_t HandlerLength(size_t pc) const;
+
+    // Run instructions that don't use ports as though the rest of the grid were idle, with the
+    // engine's handlers, so skipping straight past counting loops. Stops at the first instruction
+    // that does use a port, or after maxCycles cycles. Returns the number of cycles run.
+    int RunLocal(int maxCycles);
+
+    // How many more cycles the node is busy for, waiting out a superinstruction, counting loop,
+    // transducer or compiled run of instructions that has already run, or 0 if it isn't busy.
+    int BusyCycles() const;
+
+    // Wait out cycles of being busy, no more than BusyCycles, as stepping the node would.
+    void WaitBusy(int cycles);
+
+    // How many port reads Engine::Threaded has run as transducers, and how many of those had what
+    // came after them looked up instead of run (see Transducer).
+    void GetTransducerStats(int64_t* pReads, int64_t* pHits) const;
 
 private:
-    std::shared_ptr<IOChannel>& IO(Target target);
-};
\ No newline at end of file
+    IOPort& IO(Target target);
+    void ResetTransducers();
+    void Advance();
+    void JumpRelative(int offset);
+};
+
+inline void ComputeNode::ThreadedRead()
+{
+    if (m_state == State::Run || m_state == State::Read)
+    {
+        m_handlers[m_pc].read(this);
+    }
+    else if (m_state == State::Busy)
+    {
+        if (--m_busyCycles == 0)
+            m_state = State::Run;
+    }
+}
+
+inline void ComputeNode::ThreadedWrite()
+{
+    if (m_threadedWrite)
+    {
+        m_threadedWrite = false;
+        m_handlers[m_pc].write(this);
+    }
+    else if (m_state == State::WriteComplete)
+    {
+        m_state = State::Run;
+        Advance();
+    }
+}
+
+inline void ComputeNode::Advance()
+{
+    if (++m_pc >= m_spProgram->code.size())
+        m_pc = 0;
+}
+
+inline void ComputeNode::JumpRelative(int offset)
+{
+    m_pc += offset;
+
+    // if you JRO to an out-of-range instruction, the pc goes to the last instruction.
+    if (m_pc >= m_spProgram->code.size())
+        m_pc = m_spProgram->code.size() - 1;
+}
\ No newline at end of file
@@ -5,6 +5,4 @@ static constexpr size_t NodeGridWidth = 4;
 static constexpr size_t NodeGridHeight = 3;
 static constexpr size_t NodeGridCount = NodeGridWidth * NodeGridHeight;
 static constexpr size_t VisualizationWidth = 30;
-static constexpr size_t VisualizationHeight = 18;
-
-typedef PuzzleBase<NodeGridCount> Puzzle;
\ No newline at end of file
+static constexpr size_t VisualizationHeight = 18;
\ No newline at end of file
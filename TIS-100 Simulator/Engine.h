@@ -0,0 +1,96 @@
+#pragma once
+
+// Ways of executing a ComputeGrid. They all produce identical results; they differ only in speed.
+enum class Engine
+{
+    // Read, Compute, Write and Step are called on every node, in four separate passes.
+    Interpreter,
+
+    // Each instruction is pre-bound to handlers specialized for its shape, and each node is visited
+    // twice per cycle instead of four times. Common runs of instructions that don't use ports share
+    // one handler (see Superinstructions.h), loops that only count are skipped to their end (see
+    // ComputeNode::CountingLoop), and what a node does with each value it reads is cached (see
+    // ComputeNode::Transducer).
+    Threaded,
+
+    // Like Scheduled, but runs of instructions that don't use ports are compiled to native code that
+    // keeps ACC and BAK in registers (see JitCompiler). A node runs all of them at once and is then
+    // busy for the cycles they would have taken. Falls back to Scheduled where native code
+    // generation isn't supported.
+    Jit,
+
+    // Like Threaded, but nodes that are blocked on a port are skipped until the other side of it
+    // does something. When only one node can run, it runs on its own until it uses a port, and when
+    // every node that can run is busy, the grid skips ahead to when the first of them is done.
+    Scheduled,
+
+    // Same two passes as Threaded, but over a copy of the grid's state kept in flat arrays (see
+    // FlatGrid) instead of in the node objects.
+    Flat,
+
+    // Runs a batch of test sets at once, one per vector lane (see BatchGrid). A single grid is a
+    // batch of one, and steps like Flat.
+    Batch,
+
+    // Like Flat, but stepped by code generated at compile time for the puzzle's layout (see
+    // PuzzleLayout.h). Falls back to Flat for puzzles without one.
+    Specialized,
+
+    // Like Threaded, but with one pass over the nodes instead of two: each node's read and write
+    // phases are done together (see ComputeGrid::StepFused).
+    Fused,
+
+    // Like Flat, but once the grid keeps doing the same thing over and over, it runs a straight-line
+    // schedule of that until the data takes it somewhere else (see FlatGrid::StepSteady).
+    Steady,
+
+    // Like Flat, but what each run of cycles did is remembered, and skipped to the end of whenever
+    // the grid is back in the same state with the same inputs ahead of it (see MemoGrid).
+    Memo,
+
+    // Like Threaded, but the grid is split into tiles that are stepped on separate threads (see
+    // ParallelGrid).
+    Parallel,
+
+    // Like Scheduled, but the grid is split into regions that each run ahead on their own thread,
+    // and roll back when something arrives from another region too late (see TimeWarpGrid).
+    TimeWarp,
+};
+
+static const std::pair<const char*, Engine> s_engineNames[] = {
+    { "interpreter", Engine::Interpreter },
+    { "threaded", Engine::Threaded },
+    { "jit", Engine::Jit },
+    { "scheduled", Engine::Scheduled },
+    { "flat", Engine::Flat },
+    { "batch", Engine::Batch },
+    { "specialized", Engine::Specialized },
+    { "fused", Engine::Fused },
+    { "steady", Engine::Steady },
+    { "memo", Engine::Memo },
+    { "parallel", Engine::Parallel },
+    { "timewarp", Engine::TimeWarp },
+};
+
+inline const char* EngineName(Engine engine)
+{
+    for (const auto& pair : s_engineNames)
+    {
+        if (pair.second == engine)
+            return pair.first;
+    }
+    throw std::exception("invalid engine");
+}
+
+inline bool TryParseEngine(const std::wstring& name, Engine* pEngine)
+{
+    for (const auto& pair : s_engineNames)
+    {
+        if (name == std::wstring(pair.first, pair.first + strlen(pair.first)))
+        {
+            *pEngine = pair.second;
+            return true;
+        }
+    }
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,1382 @@
+#pragma once
+
+// An instruction in FlatGrid's code buffer: a DecodedInstruction with its ports already resolved to
+// channel slots.
+struct FlatInstruction
+{
+    Opcode op;
+    Target src;
+    Target dst;
+
+    // Slot to read from if src is a single port, and to write to if dst is; -1 if there's no channel
+    // on that side.
+    int8_t inSlot;
+    int8_t outSlot;
+
+    uint16_t jumpTarget;
+    int immediate;
+};
+
+// State for Engine::Flat: everything ComputeGrid's nodes and IOChannels keep track of while running,
+// in fixed-size arrays indexed by node, instead of in separately allocated objects.
+//
+// Grid nodes are numbered by their index in the grid, followed by the inputs, outputs and
+// visualization nodes. Each channel between two nodes is a pair of slots, one for each direction.
+// Outputs are still collected in ComputeGrid's OutputNode and VisualizationNode objects, so that
+// IsFinished works the same way for every engine.
+//
+// Everything the grid does is either control (which instruction each node is on, whether it's
+// blocked, which slots hold values) or data (registers, values in slots, input and output values).
+// Control only depends on data through conditional jumps, JRO and inputs running out, which is what
+// StepSteady relies on.
+template <int GridHeight, int GridWidth>
+class FlatGrid
+{
+private:
+    // BatchGrid runs the same code over the same slots.
+    template <int, int> friend class BatchGrid;
+
+    // MemoGrid saves and restores the whole state.
+    template <int, int> friend class MemoGrid;
+
+    typedef Puzzle PuzzleType;
+
+    static constexpr int GridCount = GridHeight * GridWidth;
+
+    // Inputs and outputs can only go on the edges of the grid.
+    static constexpr int MaxIOCount = 2 * (GridHeight + GridWidth);
+    static constexpr int MaxNodeCount = GridCount + MaxIOCount;
+    static constexpr int MaxSlotCount = 2 * ((GridHeight * (GridWidth - 1)) + ((GridHeight - 1) * GridWidth) + MaxIOCount);
+
+    static constexpr int PortCount = static_cast<int>(Neighbor::COUNT);
+
+    static_assert(MaxSlotCount <= INT8_MAX && MaxNodeCount <= UINT8_MAX, "grid is too big for FlatGrid's index types");
+
+    enum class Kind : uint8_t
+    {
+        Unprogrammed,
+        Compute,
+        Stack,
+        Input,
+        Output,
+    };
+
+    // For compute nodes, the same as ComputeNode::State. Inputs use Run for "ready".
+    enum class State : uint8_t
+    {
+        Run,
+        Read,
+        Write,
+        WriteComplete,
+    };
+
+    // The control part of the state, for StepSteady. Inputs' positions are data, but whether they
+    // have run out isn't; a schedule checks that as it goes.
+    struct ControlState
+    {
+        int pc[GridCount];
+        State state[MaxNodeCount];
+        bool write[GridCount];
+        bool pending[MaxSlotCount];
+    };
+
+    // One step of a schedule: something the passes did to the data.
+    enum class ScheduleOpKind : uint8_t
+    {
+        Set, // *pDst = constant
+        Copy, // *pDst = *pSrc
+        Add, // *pDst += *pSrc
+        Sub, // *pDst -= *pSrc
+        AddConstant, // *pDst += constant
+        Swap, // swap *pDst and *pSrc
+        Input, // *pDst = input id's next value
+        NextInput, // input id moves on to its next value
+        Output, // output id reads *pSrc
+    };
+
+    struct ScheduleOp
+    {
+        ScheduleOpKind kind;
+        int id;
+        int* pDst;
+        int* pSrc;
+        int constant;
+    };
+
+    // Something the data has to agree with for a cycle of a schedule to do what the passes would.
+    // Each node only runs one instruction per cycle, and slots only change in the write pass, so
+    // they can all be checked at the start of the cycle.
+    enum class ScheduleGuardKind : uint8_t
+    {
+        Jump, // conditional jump op on *pValue is taken if expected is 1, not if 0
+        JumpRelative, // JRO by *pValue from pc on node id goes to expected
+        Input, // input id has another value
+    };
+
+    struct ScheduleGuard
+    {
+        ScheduleGuardKind kind;
+        Opcode op;
+        int id;
+        int pc;
+        int expected;
+        const int* pValue;
+    };
+
+    enum class SteadyPhase
+    {
+        Searching, // for a control state that has been seen before
+        Recording, // a schedule of the cycles since then, by running them again
+        Replaying, // the schedule, over and over
+    };
+
+    // The longest schedule StepSteady will look for.
+    static constexpr size_t MaxSchedulePeriod = 1024;
+
+    // Compute node registers, by grid index.
+    // ComputeNode never sets m_last, so LAST always acts like NIL and needs no register here.
+    int m_acc[GridCount];
+    int m_bak[GridCount];
+    int m_temp[GridCount];
+    uint16_t m_pc[GridCount];
+
+    // Compute nodes and inputs.
+    State m_state[MaxNodeCount];
+
+    // Compute nodes with a port write to post in the write phase.
+    bool m_write[GridCount];
+
+    // Stack nodes.
+    bool m_writeReady[GridCount];
+
+    // Channel slots, each holding a value offered by its sender.
+    bool m_pending[MaxSlotCount];
+    int m_value[MaxSlotCount];
+    uint8_t m_sender[MaxSlotCount];
+
+    // The slots each node reads from and writes to, by Neighbor, or -1 where there's no channel.
+    // Inputs and outputs only use the first entry.
+    int8_t m_inSlot[MaxNodeCount][PortCount];
+    int8_t m_outSlot[MaxNodeCount][PortCount];
+
+    Kind m_kind[MaxNodeCount];
+
+    // Input positions.
+    size_t m_position[MaxNodeCount];
+
+    // Nodes in the order ComputeGrid::Initialize puts them in.
+    uint8_t m_order[MaxNodeCount];
+    int m_orderCount;
+
+    // The grid's nodes and then its I/O nodes, by ID.
+    int m_nodeCount;
+
+    // Every program, one after another.
+    uint16_t m_codeStart[GridCount];
+    uint16_t m_codeSize[GridCount];
+    std::vector<FlatInstruction> m_code;
+
+    // Things that live elsewhere.
+    std::vector<int> m_stacks[GridCount];
+    const std::vector<int>* m_inputData[MaxNodeCount];
+    OutputBase* m_outputs[MaxNodeCount];
+
+    // For StepSteady. Stacks hold control in how many values they have, so grids with any are
+    // always stepped.
+    bool m_hasStacks;
+    SteadyPhase m_steadyPhase;
+
+    // Control states seen while searching, in order, and a hash table of indices into them, with
+    // the buckets that are in use so that it can be cleared quickly.
+    std::vector<ControlState> m_history;
+    std::vector<int> m_historyTable;
+    std::vector<size_t> m_historyBuckets;
+
+    // The schedule: by cycle, the control state at its start, and where its guards and ops start.
+    // Both lists of starts have an extra entry at the end, where the last cycle's guards and ops end.
+    size_t m_schedulePeriod;
+    size_t m_scheduleCycle;
+    std::vector<ControlState> m_scheduleStates;
+    std::vector<size_t> m_scheduleGuardStart;
+    std::vector<size_t> m_scheduleOpStart;
+    std::vector<ScheduleGuard> m_scheduleGuards;
+    std::vector<ScheduleOp> m_scheduleOps;
+
+    // Set while a cycle is being recorded, and if it did something a schedule can't.
+    bool m_recording;
+    bool m_recordFailed;
+
+    // Grids that never settle would spend all their time searching and recording, so each schedule
+    // that doesn't last a whole period doubles how long the search waits before starting again.
+    size_t m_replayedCycles;
+    size_t m_searchDelay;
+    size_t m_failureDelay;
+
+    // For MemoGrid: if set, Step adds the values the outputs take to it, with their node IDs.
+    std::vector<std::pair<int, int>>* m_pOutputLog;
+
+public:
+    // Formal Parameters:
+    //  puzzle: the puzzle the grid was built for.
+    //  grid: the grid's GridCount nodes, by index, already assembled.
+    //  inputs, outputs, vizNodes: the grid's I/O nodes, which must stay where they are.
+    FlatGrid(
+        const PuzzleType& puzzle,
+        INode* const* grid,
+        const std::vector<InputNode>& inputs,
+        std::vector<OutputNode>& outputs,
+        std::vector<VisualizationNode>& vizNodes
+        )
+        : m_orderCount(0)
+        , m_nodeCount(0)
+        , m_hasStacks(false)
+        , m_steadyPhase(SteadyPhase::Searching)
+        , m_schedulePeriod(0)
+        , m_scheduleCycle(0)
+        , m_recording(false)
+        , m_recordFailed(false)
+        , m_replayedCycles(0)
+        , m_searchDelay(0)
+        , m_failureDelay(0)
+        , m_pOutputLog(nullptr)
+    {
+        if (inputs.size() + outputs.size() + vizNodes.size() > MaxIOCount)
+            throw std::exception("too many inputs and outputs");
+
+        std::fill(&m_inSlot[0][0], &m_inSlot[0][0] + MaxNodeCount * PortCount, static_cast<int8_t>(-1));
+        std::fill(&m_outSlot[0][0], &m_outSlot[0][0] + MaxNodeCount * PortCount, static_cast<int8_t>(-1));
+        std::fill(std::begin(m_inputData), std::end(m_inputData), nullptr);
+        std::fill(std::begin(m_outputs), std::end(m_outputs), nullptr);
+
+        int slotCount = 0;
+        auto join = [this, &slotCount](int a, int aPort, int b, int bPort)
+        {
+            int slot = slotCount;
+            slotCount += 2;
+            m_outSlot[a][aPort] = m_inSlot[b][bPort] = static_cast<int8_t>(slot);
+            m_outSlot[b][bPort] = m_inSlot[a][aPort] = static_cast<int8_t>(slot + 1);
+            m_sender[slot] = static_cast<uint8_t>(a);
+            m_sender[slot + 1] = static_cast<uint8_t>(b);
+        };
+
+        // Same topology as ComputeGrid's constructor. Compute nodes get their kind from their
+        // programs, in LoadPrograms.
+        for (int index = 0; index < GridCount; ++index)
+        {
+            m_kind[index] = (dynamic_cast<const ComputeNode*>(grid[index]) == nullptr) ? Kind::Stack : Kind::Unprogrammed;
+
+            int col = index % GridWidth;
+            int row = index / GridWidth;
+            if (col > 0)
+                join(index - 1, static_cast<int>(Neighbor::RIGHT), index, static_cast<int>(Neighbor::LEFT));
+            if (row > 0)
+                join(index - GridWidth, static_cast<int>(Neighbor::DOWN), index, static_cast<int>(Neighbor::UP));
+        }
+
+        int id = GridCount;
+        for (size_t i = 0; i < inputs.size(); ++i, ++id)
+        {
+            m_kind[id] = Kind::Input;
+            m_inputData[id] = &inputs[i].Data();
+            join(puzzle.inputs[i].toNode, static_cast<int>(puzzle.inputs[i].direction), id, 0);
+        }
+        for (size_t i = 0; i < outputs.size(); ++i, ++id)
+        {
+            m_kind[id] = Kind::Output;
+            m_outputs[id] = &outputs[i];
+            join(puzzle.outputs[i].toNode, static_cast<int>(puzzle.outputs[i].direction), id, 0);
+        }
+        for (size_t i = 0; i < vizNodes.size(); ++i, ++id)
+        {
+            m_kind[id] = Kind::Output;
+            m_outputs[id] = &vizNodes[i];
+            join(puzzle.visualization[i].toNode, static_cast<int>(puzzle.visualization[i].direction), id, 0);
+        }
+        m_nodeCount = id;
+
+        LoadPrograms(grid);
+    }
+
+    // Take the compute nodes' programs from grid again, after they have been re-assembled (see
+    // ComputeGrid::Reprogram). Everything else about the grid stays as it is.
+    void LoadPrograms(INode* const* grid)
+    {
+        for (int index = 0; index < GridCount; ++index)
+        {
+            if (m_kind[index] != Kind::Stack)
+            {
+                const ComputeNode* pComputeNode = static_cast<const ComputeNode*>(grid[index]);
+                m_kind[index] = (pComputeNode->InstructionCount() > 0) ? Kind::Compute : Kind::Unprogrammed;
+            }
+        }
+
+        m_orderCount = 0;
+        for (int i = GridCount; i < m_nodeCount; ++i)
+            m_order[m_orderCount++] = static_cast<uint8_t>(i);
+        for (int index = 0; index < GridCount; ++index)
+        {
+            if (m_kind[index] == Kind::Compute)
+                m_order[m_orderCount++] = static_cast<uint8_t>(index);
+        }
+        for (int index = 0; index < GridCount; ++index)
+        {
+            if (m_kind[index] == Kind::Stack)
+            {
+                m_order[m_orderCount++] = static_cast<uint8_t>(index);
+                m_hasStacks = true;
+            }
+        }
+
+        m_code.clear();
+        for (int index = 0; index < GridCount; ++index)
+        {
+            m_codeStart[index] = static_cast<uint16_t>(m_code.size());
+            m_codeSize[index] = 0;
+            if (m_kind[index] != Kind::Compute)
+                continue;
+
+            const ComputeNode* pComputeNode = static_cast<const ComputeNode*>(grid[index]);
+            for (const DecodedInstruction& instr : pComputeNode->Code())
+            {
+                FlatInstruction flat;
+                flat.op = instr.op;
+                flat.src = instr.src;
+                flat.dst = instr.dst;
+                flat.inSlot = IsPort(instr.src) ? m_inSlot[index][PortIndex(instr.src)] : -1;
+                flat.outSlot = IsPort(instr.dst) ? m_outSlot[index][PortIndex(instr.dst)] : -1;
+                flat.jumpTarget = static_cast<uint16_t>(instr.jumpTarget);
+                flat.immediate = instr.immediate;
+                m_code.push_back(flat);
+            }
+            m_codeSize[index] = static_cast<uint16_t>(m_code.size() - m_codeStart[index]);
+        }
+    }
+
+    void Initialize()
+    {
+        std::fill(std::begin(m_acc), std::end(m_acc), 0);
+        std::fill(std::begin(m_bak), std::end(m_bak), 0);
+        std::fill(std::begin(m_temp), std::end(m_temp), 0);
+        std::fill(std::begin(m_pc), std::end(m_pc), static_cast<uint16_t>(0));
+        std::fill(std::begin(m_state), std::end(m_state), State::Run);
+        std::fill(std::begin(m_write), std::end(m_write), false);
+        std::fill(std::begin(m_writeReady), std::end(m_writeReady), true);
+        std::fill(std::begin(m_pending), std::end(m_pending), false);
+        std::fill(std::begin(m_position), std::end(m_position), 0);
+
+        for (std::vector<int>& stack : m_stacks)
+            stack.clear();
+
+        ResetSteady();
+        m_searchDelay = 0;
+        m_failureDelay = 0;
+    }
+
+    // The same two passes as ComputeGrid::StepThreaded, a node at a time. Running the compute nodes
+    // all at once, one per vector lane, was slower: with a dozen nodes that are mostly blocked on
+    // ports, the gathers and masks cost more than they save (Signal Multiplier ran at 6.0M cycles/sec
+    // that way with AVX2, against 17.4M for this).
+    void Step()
+    {
+        ReadPass();
+        WritePass();
+    }
+
+    // Same as Step, for Engine::Steady: once the grid settles into doing the same thing over and
+    // over, it runs a schedule of that instead.
+    //
+    // Whenever the control state is one that has been seen before, the cycles since then are
+    // stepped again and recorded as a straight-line list of what they did to the data, along with
+    // what the data had to be for them to go that way. If they came back round to the same control
+    // state, that schedule is replayed from then on without looking at which nodes are blocked or
+    // what instruction they're on. As soon as the data would go a different way, the control state
+    // is put back and the grid steps as usual until it settles again.
+    void StepSteady()
+    {
+        if (m_steadyPhase == SteadyPhase::Replaying)
+        {
+            if (ReplayCycle())
+                return;
+
+            if (m_replayedCycles >= m_schedulePeriod)
+                ResetSteady();
+            else
+                GiveUp();
+        }
+
+        if (m_steadyPhase == SteadyPhase::Searching && !m_hasStacks)
+        {
+            if (m_searchDelay > 0)
+                --m_searchDelay;
+            else
+                Search();
+        }
+
+        if (m_steadyPhase != SteadyPhase::Recording)
+        {
+            Step();
+            return;
+        }
+
+        m_scheduleStates.emplace_back();
+        SaveControl(&m_scheduleStates.back());
+        m_scheduleGuardStart.push_back(m_scheduleGuards.size());
+        m_scheduleOpStart.push_back(m_scheduleOps.size());
+
+        m_recording = true;
+        Step();
+        m_recording = false;
+
+        if (m_recordFailed)
+        {
+            GiveUp();
+        }
+        else if (m_scheduleStates.size() == m_schedulePeriod)
+        {
+            m_scheduleGuardStart.push_back(m_scheduleGuards.size());
+            m_scheduleOpStart.push_back(m_scheduleOps.size());
+
+            ControlState state;
+            SaveControl(&state);
+            if (SameControl(state, m_scheduleStates[0]))
+            {
+                m_steadyPhase = SteadyPhase::Replaying;
+                m_scheduleCycle = 0;
+                m_replayedCycles = 0;
+            }
+            else
+            {
+                GiveUp();
+            }
+        }
+    }
+
+    typedef void (FlatGrid::*StepFunction)();
+
+    // The StepLayout for the first of BuiltInPuzzleLayouts that this grid was built from, or Step if
+    // there isn't one.
+    StepFunction FindLayoutStep() const
+    {
+        return FindLayoutStep(BuiltInPuzzleLayouts());
+    }
+
+    // Same as Step, for Engine::Specialized, with the grid's layout known at compile time: what kind
+    // each node is, and which slot each of its ports uses. The passes are unrolled over only the
+    // nodes that can do anything, and ANY, stack nodes and outputs only look at connected ports.
+    //
+    // Whether a compute node has a program is still only known at runtime.
+    template <const PuzzleLayout& Layout>
+    void StepLayout()
+    {
+        constexpr int count = s_layoutTopology<Layout>.orderCount;
+        LayoutReadPass<Layout>(std::make_integer_sequence<int, count>());
+        LayoutWritePass<Layout>(std::make_integer_sequence<int, count>());
+    }
+
+private:
+    // A puzzle layout's nodes and slots, numbered the same way as the constructor numbers them.
+    struct LayoutTopology
+    {
+        Kind kind[MaxNodeCount];
+        int8_t inSlot[MaxNodeCount][PortCount];
+        int8_t outSlot[MaxNodeCount][PortCount];
+
+        // Like m_order, but with every compute node that isn't bad, programmed or not.
+        uint8_t order[MaxNodeCount];
+        int orderCount;
+    };
+
+    static constexpr void JoinTopology(LayoutTopology& topology, int& slotCount, int a, int aPort, int b, int bPort)
+    {
+        int slot = slotCount;
+        slotCount += 2;
+        topology.outSlot[a][aPort] = topology.inSlot[b][bPort] = static_cast<int8_t>(slot);
+        topology.outSlot[b][bPort] = topology.inSlot[a][aPort] = static_cast<int8_t>(slot + 1);
+    }
+
+    // Same topology as the constructor.
+    static constexpr LayoutTopology BuildTopology(const PuzzleLayout& layout)
+    {
+        LayoutTopology topology = {};
+        for (int id = 0; id < MaxNodeCount; ++id)
+        {
+            topology.kind[id] = Kind::Unprogrammed;
+            for (int port = 0; port < PortCount; ++port)
+                topology.inSlot[id][port] = topology.outSlot[id][port] = -1;
+        }
+
+        int slotCount = 0;
+        for (int index = 0; index < GridCount; ++index)
+        {
+            if ((layout.stackNodes >> index) & 1)
+                topology.kind[index] = Kind::Stack;
+            else if (((layout.badNodes >> index) & 1) == 0)
+                topology.kind[index] = Kind::Compute;
+
+            int col = index % GridWidth;
+            int row = index / GridWidth;
+            if (col > 0)
+                JoinTopology(topology, slotCount, index - 1, static_cast<int>(Neighbor::RIGHT), index, static_cast<int>(Neighbor::LEFT));
+            if (row > 0)
+                JoinTopology(topology, slotCount, index - GridWidth, static_cast<int>(Neighbor::DOWN), index, static_cast<int>(Neighbor::UP));
+        }
+
+        int id = GridCount;
+        for (int i = 0; i < layout.inputCount; ++i, ++id)
+        {
+            topology.kind[id] = Kind::Input;
+            JoinTopology(topology, slotCount, layout.inputs[i].toNode, static_cast<int>(layout.inputs[i].direction), id, 0);
+        }
+        for (int i = 0; i < layout.outputCount; ++i, ++id)
+        {
+            topology.kind[id] = Kind::Output;
+            JoinTopology(topology, slotCount, layout.outputs[i].toNode, static_cast<int>(layout.outputs[i].direction), id, 0);
+        }
+        for (int i = 0; i < layout.visualizationCount; ++i, ++id)
+        {
+            topology.kind[id] = Kind::Output;
+            JoinTopology(topology, slotCount, layout.visualization[i].toNode, static_cast<int>(layout.visualization[i].direction), id, 0);
+        }
+
+        for (int i = GridCount; i < id; ++i)
+            topology.order[topology.orderCount++] = static_cast<uint8_t>(i);
+        for (int index = 0; index < GridCount; ++index)
+        {
+            if (topology.kind[index] == Kind::Compute)
+                topology.order[topology.orderCount++] = static_cast<uint8_t>(index);
+        }
+        for (int index = 0; index < GridCount; ++index)
+        {
+            if (topology.kind[index] == Kind::Stack)
+                topology.order[topology.orderCount++] = static_cast<uint8_t>(index);
+        }
+
+        return topology;
+    }
+
+    template <const PuzzleLayout& Layout>
+    static constexpr LayoutTopology s_layoutTopology = BuildTopology(Layout);
+
+    template <const PuzzleLayout& Layout>
+    bool MatchesLayout() const
+    {
+        const LayoutTopology& topology = s_layoutTopology<Layout>;
+        for (int id = 0; id < MaxNodeCount; ++id)
+        {
+            for (int port = 0; port < PortCount; ++port)
+            {
+                if (m_inSlot[id][port] != topology.inSlot[id][port] || m_outSlot[id][port] != topology.outSlot[id][port])
+                    return false;
+            }
+        }
+
+        // A bad node is an unprogrammed compute node.
+        for (int index = 0; index < GridCount; ++index)
+        {
+            if ((m_kind[index] == Kind::Stack) != (topology.kind[index] == Kind::Stack))
+                return false;
+            if (topology.kind[index] == Kind::Unprogrammed && m_kind[index] != Kind::Unprogrammed)
+                return false;
+        }
+
+        // Inputs and outputs attached to the same ports have the same slots.
+        for (int id = GridCount; id < MaxNodeCount; ++id)
+        {
+            if (topology.inSlot[id][0] >= 0 && m_kind[id] != topology.kind[id])
+                return false;
+        }
+
+        return true;
+    }
+
+    template <const PuzzleLayout&... Layouts>
+    StepFunction FindLayoutStep(PuzzleLayoutList<Layouts...>) const
+    {
+        StepFunction step = &FlatGrid::Step;
+        (void)((MatchesLayout<Layouts>() && ((step = &FlatGrid::StepLayout<Layouts>), true)) || ...);
+        return step;
+    }
+
+    // Calls fn with each of node Id's connected slots under Layout, either the ones it reads from or
+    // the ones it writes to, in the order of Ports, until it returns true.
+    template <const PuzzleLayout& Layout, int Id, bool Outputs, Neighbor... Ports, typename Fn>
+    static void ForEachLayoutSlot(Fn fn)
+    {
+        (void)(CallLayoutSlot<Layout, Id, Outputs, Ports>(fn) || ...);
+    }
+
+    template <const PuzzleLayout& Layout, int Id, bool Outputs, Neighbor Port, typename Fn>
+    static bool CallLayoutSlot(Fn& fn)
+    {
+        constexpr int slot = Outputs
+            ? s_layoutTopology<Layout>.outSlot[Id][static_cast<int>(Port)]
+            : s_layoutTopology<Layout>.inSlot[Id][static_cast<int>(Port)];
+        if constexpr (slot < 0)
+            return false;
+        else
+            return fn(slot);
+    }
+
+    template <const PuzzleLayout& Layout, int... Positions>
+    void LayoutReadPass(std::integer_sequence<int, Positions...>)
+    {
+        (LayoutRead<Layout, s_layoutTopology<Layout>.order[Positions]>(), ...);
+    }
+
+    template <const PuzzleLayout& Layout, int... Positions>
+    void LayoutWritePass(std::integer_sequence<int, Positions...>)
+    {
+        (LayoutWrite<Layout, s_layoutTopology<Layout>.order[Positions]>(), ...);
+    }
+
+    // The read pass for one node; see ReadPass.
+    template <const PuzzleLayout& Layout, int Id>
+    void LayoutRead()
+    {
+        constexpr Kind kind = s_layoutTopology<Layout>.kind[Id];
+        if constexpr (kind == Kind::Compute)
+        {
+            if (m_kind[Id] != Kind::Compute || (m_state[Id] != State::Run && m_state[Id] != State::Read))
+                return;
+
+            const FlatInstruction& instr = m_code[m_codeStart[Id] + m_pc[Id]];
+            if (instr.src != Target::ANY)
+            {
+                ComputeRead(Id);
+                return;
+            }
+
+            // Same order as ComputeRead: the last one read wins.
+            int value = 0;
+            m_state[Id] = State::Read;
+            ForEachLayoutSlot<Layout, Id, false, Neighbor::LEFT, Neighbor::RIGHT, Neighbor::UP, Neighbor::DOWN>([&](int slot)
+            {
+                if (m_pending[slot])
+                {
+                    value = Take(slot);
+                    m_state[Id] = State::Run;
+                }
+                return false;
+            });
+
+            if (m_state[Id] == State::Run)
+                Execute(Id, instr, value);
+        }
+        else if constexpr (kind == Kind::Stack)
+        {
+            ForEachLayoutSlot<Layout, Id, false, Neighbor::UP, Neighbor::DOWN, Neighbor::LEFT, Neighbor::RIGHT>([&](int slot)
+            {
+                if (!m_pending[slot])
+                    return false;
+
+                m_stacks[Id].push_back(Take(slot));
+                LayoutCancelWrites<Layout, Id>();
+                m_writeReady[Id] = true;
+
+                // Don't bother attempting any other reads.
+                return true;
+            });
+        }
+        else if constexpr (kind == Kind::Output)
+        {
+            constexpr int slot = s_layoutTopology<Layout>.inSlot[Id][0];
+            if (m_pending[slot])
+                m_outputs[Id]->ReadData(Take(slot));
+        }
+    }
+
+    // The write pass for one node; see WritePass.
+    template <const PuzzleLayout& Layout, int Id>
+    void LayoutWrite()
+    {
+        constexpr Kind kind = s_layoutTopology<Layout>.kind[Id];
+        if constexpr (kind == Kind::Compute)
+        {
+            if (m_kind[Id] != Kind::Compute)
+                return;
+
+            if (!m_write[Id] || m_code[m_codeStart[Id] + m_pc[Id]].dst != Target::ANY)
+            {
+                ComputeWrite(Id);
+                return;
+            }
+
+            m_write[Id] = false;
+            m_state[Id] = State::Write;
+            ForEachLayoutSlot<Layout, Id, true, Neighbor::UP, Neighbor::DOWN, Neighbor::LEFT, Neighbor::RIGHT>([&](int slot)
+            {
+                Post(slot, m_temp[Id]);
+                return false;
+            });
+        }
+        else if constexpr (kind == Kind::Stack)
+        {
+            if (!m_writeReady[Id] || m_stacks[Id].empty())
+                return;
+            m_writeReady[Id] = false;
+
+            ForEachLayoutSlot<Layout, Id, true, Neighbor::UP, Neighbor::DOWN, Neighbor::LEFT, Neighbor::RIGHT>([&](int slot)
+            {
+                Post(slot, m_stacks[Id].back());
+                return false;
+            });
+        }
+        else if constexpr (kind == Kind::Input)
+        {
+            InputWrite(Id);
+        }
+    }
+
+    template <const PuzzleLayout& Layout, int Id>
+    void LayoutCancelWrites()
+    {
+        ForEachLayoutSlot<Layout, Id, true, Neighbor::UP, Neighbor::DOWN, Neighbor::LEFT, Neighbor::RIGHT>([&](int slot)
+        {
+            m_pending[slot] = false;
+            return false;
+        });
+    }
+
+    void ReadPass()
+    {
+        for (int i = 0; i < m_orderCount; ++i)
+        {
+            int id = m_order[i];
+            switch (m_kind[id])
+            {
+            case Kind::Compute:
+                if (m_state[id] == State::Run || m_state[id] == State::Read)
+                    ComputeRead(id);
+                break;
+
+            case Kind::Stack:
+                StackRead(id);
+                break;
+
+            case Kind::Output:
+            {
+                int slot = m_inSlot[id][0];
+                if (slot >= 0 && m_pending[slot])
+                {
+                    int value = Take(slot);
+                    m_outputs[id]->ReadData(value);
+                    if (m_recording)
+                        RecordOp(ScheduleOpKind::Output, id, nullptr, &m_value[slot], 0);
+                    if (m_pOutputLog != nullptr)
+                        m_pOutputLog->emplace_back(id, value);
+                }
+            }
+            break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    void WritePass()
+    {
+        for (int i = 0; i < m_orderCount; ++i)
+        {
+            int id = m_order[i];
+            switch (m_kind[id])
+            {
+            case Kind::Compute:
+                ComputeWrite(id);
+                break;
+
+            case Kind::Stack:
+                StackWrite(id);
+                break;
+
+            case Kind::Input:
+                InputWrite(id);
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    void SaveControl(ControlState* pState) const
+    {
+        std::copy(m_pc, m_pc + GridCount, pState->pc);
+        std::copy(std::begin(m_state), std::end(m_state), pState->state);
+        std::copy(std::begin(m_write), std::end(m_write), pState->write);
+        std::copy(std::begin(m_pending), std::end(m_pending), pState->pending);
+    }
+
+    void RestoreControl(const ControlState& state)
+    {
+        std::copy(std::begin(state.pc), std::end(state.pc), m_pc);
+        std::copy(std::begin(state.state), std::end(state.state), m_state);
+        std::copy(std::begin(state.write), std::end(state.write), m_write);
+        std::copy(std::begin(state.pending), std::end(state.pending), m_pending);
+    }
+
+    static bool SameControl(const ControlState& a, const ControlState& b)
+    {
+        return std::equal(std::begin(a.pc), std::end(a.pc), b.pc)
+            && std::equal(std::begin(a.state), std::end(a.state), b.state)
+            && std::equal(std::begin(a.write), std::end(a.write), b.write)
+            && std::equal(std::begin(a.pending), std::end(a.pending), b.pending);
+    }
+
+    // FNV-1a, a word at a time, over one field of something being hashed. Hashing the fields one
+    // at a time leaves out any padding between them.
+    static void HashWords(uint64_t* pHash, const void* p, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(p);
+        for (size_t i = 0; i < size; i += sizeof(uint64_t))
+        {
+            uint64_t word = 0;
+            memcpy(&word, bytes + i, std::min(sizeof(uint64_t), size - i));
+            *pHash = (*pHash ^ word) * 1099511628211ULL;
+        }
+        *pHash ^= *pHash >> 32;
+    }
+
+    static uint64_t HashControl(const ControlState& state)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        HashWords(&hash, state.pc, sizeof(state.pc));
+        HashWords(&hash, state.state, sizeof(state.state));
+        HashWords(&hash, state.write, sizeof(state.write));
+        HashWords(&hash, state.pending, sizeof(state.pending));
+        return hash;
+    }
+
+    void ClearHistory()
+    {
+        if (m_historyTable.empty())
+            m_historyTable.assign(2 * MaxSchedulePeriod, -1);
+
+        for (size_t bucket : m_historyBuckets)
+            m_historyTable[bucket] = -1;
+        m_historyBuckets.clear();
+        m_history.clear();
+    }
+
+    // Start searching for a schedule all over again.
+    void ResetSteady()
+    {
+        m_steadyPhase = SteadyPhase::Searching;
+        ClearHistory();
+        m_schedulePeriod = 0;
+        m_scheduleCycle = 0;
+        m_scheduleStates.clear();
+        m_scheduleGuardStart.clear();
+        m_scheduleOpStart.clear();
+        m_scheduleGuards.clear();
+        m_scheduleOps.clear();
+        m_recording = false;
+        m_recordFailed = false;
+        m_replayedCycles = 0;
+    }
+
+    // Start searching again after a schedule that didn't work out, but not straight away.
+    void GiveUp()
+    {
+        ResetSteady();
+        m_failureDelay = std::min(std::max<size_t>(2 * m_failureDelay, 16), MaxSchedulePeriod);
+        m_searchDelay = m_failureDelay;
+    }
+
+    // Look the current control state up in the history, and start recording if it's there.
+    void Search()
+    {
+        m_history.emplace_back();
+        ControlState& state = m_history.back();
+        SaveControl(&state);
+
+        size_t mask = m_historyTable.size() - 1;
+        size_t bucket = static_cast<size_t>(HashControl(state)) & mask;
+        for (; m_historyTable[bucket] >= 0; bucket = (bucket + 1) & mask)
+        {
+            size_t seen = static_cast<size_t>(m_historyTable[bucket]);
+            if (SameControl(m_history[seen], state))
+            {
+                m_schedulePeriod = m_history.size() - 1 - seen;
+                m_steadyPhase = SteadyPhase::Recording;
+                return;
+            }
+        }
+
+        if (m_history.size() > MaxSchedulePeriod)
+        {
+            // Nothing has repeated for a while; forget the oldest states rather than keep them all.
+            ControlState latest = state;
+            ClearHistory();
+            m_history.push_back(latest);
+            bucket = static_cast<size_t>(HashControl(latest)) & mask;
+        }
+        m_historyTable[bucket] = static_cast<int>(m_history.size() - 1);
+        m_historyBuckets.push_back(bucket);
+    }
+
+    // Run the schedule's current cycle, unless its guards say the data would go a different way, in
+    // which case the control state is put back to the start of the cycle and false is returned.
+    bool ReplayCycle()
+    {
+        size_t cycle = m_scheduleCycle;
+        for (size_t i = m_scheduleGuardStart[cycle]; i < m_scheduleGuardStart[cycle + 1]; ++i)
+        {
+            if (!GuardHolds(m_scheduleGuards[i]))
+            {
+                RestoreControl(m_scheduleStates[cycle]);
+                return false;
+            }
+        }
+
+        for (size_t i = m_scheduleOpStart[cycle], end = m_scheduleOpStart[cycle + 1]; i < end; ++i)
+        {
+            const ScheduleOp& op = m_scheduleOps[i];
+            switch (op.kind)
+            {
+            case ScheduleOpKind::Set:
+                *op.pDst = op.constant;
+                break;
+
+            case ScheduleOpKind::Copy:
+                *op.pDst = *op.pSrc;
+                break;
+
+            case ScheduleOpKind::Add:
+                *op.pDst += *op.pSrc;
+                break;
+
+            case ScheduleOpKind::Sub:
+                *op.pDst -= *op.pSrc;
+                break;
+
+            case ScheduleOpKind::AddConstant:
+                *op.pDst += op.constant;
+                break;
+
+            case ScheduleOpKind::Swap:
+                std::swap(*op.pDst, *op.pSrc);
+                break;
+
+            case ScheduleOpKind::Input:
+                *op.pDst = (*m_inputData[op.id])[m_position[op.id]];
+                break;
+
+            case ScheduleOpKind::NextInput:
+                ++m_position[op.id];
+                break;
+
+            case ScheduleOpKind::Output:
+                m_outputs[op.id]->ReadData(*op.pSrc);
+                break;
+            }
+        }
+
+        if (++m_scheduleCycle == m_schedulePeriod)
+            m_scheduleCycle = 0;
+        if (++m_replayedCycles == m_schedulePeriod)
+            m_failureDelay = 0;
+        return true;
+    }
+
+    bool GuardHolds(const ScheduleGuard& guard) const
+    {
+        switch (guard.kind)
+        {
+        case ScheduleGuardKind::Jump:
+            return IsJumpTaken(guard.op, *guard.pValue) == (guard.expected != 0);
+
+        case ScheduleGuardKind::JumpRelative:
+            return RelativeJumpTarget(guard.id, guard.pc, *guard.pValue) == guard.expected;
+
+        case ScheduleGuardKind::Input:
+            return m_position[guard.id] < m_inputData[guard.id]->size();
+
+        default:
+            return false;
+        }
+    }
+
+    void RecordOp(ScheduleOpKind kind, int id, int* pDst, int* pSrc, int constant)
+    {
+        m_scheduleOps.push_back(ScheduleOp{ kind, id, pDst, pSrc, constant });
+    }
+
+    void RecordGuard(ScheduleGuardKind kind, Opcode op, int id, int pc, int expected, const int* pValue)
+    {
+        m_scheduleGuards.push_back(ScheduleGuard{ kind, op, id, pc, expected, pValue });
+    }
+
+    // Record what Execute is about to do. pSource is where its value comes from, or null if it's
+    // the instruction's immediate or zero.
+    void RecordExecute(int id, const FlatInstruction& instr, int* pSource)
+    {
+        int constant = (instr.src == Target::None) ? instr.immediate : 0;
+        auto load = [&](int* pDst)
+        {
+            if (pSource != nullptr)
+                RecordOp(ScheduleOpKind::Copy, id, pDst, pSource, 0);
+            else
+                RecordOp(ScheduleOpKind::Set, id, pDst, nullptr, constant);
+        };
+
+        switch (instr.op)
+        {
+        case Opcode::MOV:
+            if (instr.dst == Target::ACC)
+                load(&m_acc[id]);
+            else if (instr.dst != Target::NIL && instr.dst != Target::LAST)
+                load(&m_temp[id]);
+            break;
+
+        case Opcode::ADD:
+        case Opcode::SUB:
+            if (pSource != nullptr)
+                RecordOp((instr.op == Opcode::ADD) ? ScheduleOpKind::Add : ScheduleOpKind::Sub, id, &m_acc[id], pSource, 0);
+            else
+                RecordOp(ScheduleOpKind::AddConstant, id, &m_acc[id], nullptr, (instr.op == Opcode::ADD) ? constant : -constant);
+            break;
+
+        case Opcode::SAV:
+            RecordOp(ScheduleOpKind::Copy, id, &m_bak[id], &m_acc[id], 0);
+            break;
+
+        case Opcode::SWP:
+            RecordOp(ScheduleOpKind::Swap, id, &m_acc[id], &m_bak[id], 0);
+            break;
+
+        case Opcode::JEZ:
+        case Opcode::JNZ:
+        case Opcode::JGZ:
+        case Opcode::JLZ:
+            RecordGuard(ScheduleGuardKind::Jump, instr.op, id, 0, IsJumpTaken(instr.op, m_acc[id]) ? 1 : 0, &m_acc[id]);
+            break;
+
+        case Opcode::JRO:
+            if (pSource != nullptr)
+                RecordGuard(ScheduleGuardKind::JumpRelative, instr.op, id, m_pc[id], RelativeJumpTarget(id, m_pc[id], *pSource), pSource);
+            break;
+
+        case Opcode::HCF:
+            m_recordFailed = true;
+            break;
+
+        default:
+            // NOP changes nothing, and where JMP goes is fixed by the control state.
+            break;
+        }
+    }
+
+    static bool IsPort(Target target)
+    {
+        return (target == Target::UP) || (target == Target::DOWN) || (target == Target::LEFT) || (target == Target::RIGHT);
+    }
+
+    static int PortIndex(Target target)
+    {
+        switch (target)
+        {
+        case Target::UP: return static_cast<int>(Neighbor::UP);
+        case Target::DOWN: return static_cast<int>(Neighbor::DOWN);
+        case Target::LEFT: return static_cast<int>(Neighbor::LEFT);
+        case Target::RIGHT: return static_cast<int>(Neighbor::RIGHT);
+        default:
+            throw std::exception("Target is not a neighbor direction");
+        }
+    }
+
+    // Read the value waiting in a slot, and tell its sender.
+    int Take(int slot)
+    {
+        int value = m_value[slot];
+        m_pending[slot] = false;
+        WriteComplete(m_sender[slot]);
+        return value;
+    }
+
+    void Post(int slot, int value)
+    {
+        if (slot >= 0)
+        {
+            m_pending[slot] = true;
+            m_value[slot] = value;
+        }
+    }
+
+    void CancelWrites(int id)
+    {
+        for (int8_t slot : m_outSlot[id])
+        {
+            if (slot >= 0)
+                m_pending[slot] = false;
+        }
+    }
+
+    void WriteComplete(int id)
+    {
+        switch (m_kind[id])
+        {
+        case Kind::Compute:
+            m_state[id] = State::WriteComplete;
+            if (m_code[m_codeStart[id] + m_pc[id]].dst == Target::ANY)
+                CancelWrites(id);
+            break;
+
+        case Kind::Stack:
+            m_stacks[id].pop_back();
+            CancelWrites(id);
+            m_writeReady[id] = true;
+            break;
+
+        case Kind::Input:
+            m_state[id] = State::WriteComplete;
+            break;
+
+        default:
+            throw std::exception("unexpected WriteComplete");
+        }
+    }
+
+    void Advance(int id)
+    {
+        if (++m_pc[id] >= m_codeSize[id])
+            m_pc[id] = 0;
+    }
+
+    // Read and Compute for a compute node; see ThreadedHandlers.
+    void ComputeRead(int id)
+    {
+        const FlatInstruction& instr = m_code[m_codeStart[id] + m_pc[id]];
+
+        // Where value came from, for StepSteady; null for the immediate or zero.
+        int* pSource = nullptr;
+
+        int value = 0;
+        switch (instr.src)
+        {
+        case Target::None:
+            value = instr.immediate;
+            break;
+
+        case Target::NIL:
+        case Target::LAST:
+            value = 0;
+            break;
+
+        case Target::ACC:
+            value = m_acc[id];
+            pSource = &m_acc[id];
+            break;
+
+        case Target::ANY:
+            // Reads everything that's available; the last one read wins. See ComputeNode::Read().
+            m_state[id] = State::Read;
+            for (Neighbor port : { Neighbor::LEFT, Neighbor::RIGHT, Neighbor::UP, Neighbor::DOWN })
+            {
+                int slot = m_inSlot[id][static_cast<int>(port)];
+                if (slot >= 0 && m_pending[slot])
+                {
+                    value = Take(slot);
+                    pSource = &m_value[slot];
+                    m_state[id] = State::Run;
+                }
+            }
+            if (m_state[id] != State::Run)
+                return;
+            break;
+
+        default:
+            m_state[id] = State::Read;
+            if (instr.inSlot < 0 || !m_pending[instr.inSlot])
+                return;
+            value = Take(instr.inSlot);
+            pSource = &m_value[instr.inSlot];
+            m_state[id] = State::Run;
+            break;
+        }
+
+        if (m_recording)
+            RecordExecute(id, instr, pSource);
+
+        Execute(id, instr, value);
+    }
+
+    // The Compute half of ComputeRead, once the source value has been read.
+    void Execute(int id, const FlatInstruction& instr, int value)
+    {
+        switch (instr.op)
+        {
+        case Opcode::NOP:
+            Advance(id);
+            break;
+
+        case Opcode::MOV:
+            if (instr.dst == Target::ACC)
+            {
+                m_acc[id] = value;
+            }
+            else if (instr.dst != Target::NIL && instr.dst != Target::LAST)
+            {
+                m_temp[id] = value;
+                m_write[id] = true;
+                break;
+            }
+            Advance(id);
+            break;
+
+        case Opcode::ADD:
+            m_acc[id] += value;
+            Advance(id);
+            break;
+
+        case Opcode::SUB:
+            m_acc[id] -= value;
+            Advance(id);
+            break;
+
+        case Opcode::SAV:
+            m_bak[id] = m_acc[id];
+            Advance(id);
+            break;
+
+        case Opcode::SWP:
+            std::swap(m_acc[id], m_bak[id]);
+            Advance(id);
+            break;
+
+        case Opcode::JMP:
+        case Opcode::JEZ:
+        case Opcode::JNZ:
+        case Opcode::JGZ:
+        case Opcode::JLZ:
+            if (IsJumpTaken(instr.op, m_acc[id]))
+                m_pc[id] = instr.jumpTarget;
+            else
+                Advance(id);
+            break;
+
+        case Opcode::JRO:
+            m_pc[id] = static_cast<uint16_t>(RelativeJumpTarget(id, m_pc[id], value));
+            break;
+
+        case Opcode::HCF:
+            throw std::exception("halt and catch fire"); // lol
+
+        default:
+            throw std::exception("invalid opcode");
+        }
+    }
+
+    static bool IsJumpTaken(Opcode op, int acc)
+    {
+        return (op == Opcode::JMP)
+            || ((op == Opcode::JEZ) && (acc == 0))
+            || ((op == Opcode::JNZ) && (acc != 0))
+            || ((op == Opcode::JGZ) && (acc > 0))
+            || ((op == Opcode::JLZ) && (acc < 0));
+    }
+
+    int RelativeJumpTarget(int id, int pc, int offset) const
+    {
+        // Anything out of range, including negative, goes to the last instruction.
+        long long target = static_cast<long long>(pc) + offset;
+        if (target < 0 || target >= m_codeSize[id])
+            target = m_codeSize[id] - 1;
+        return static_cast<int>(target);
+    }
+
+    // Write and Step for a compute node.
+    void ComputeWrite(int id)
+    {
+        if (m_write[id])
+        {
+            m_write[id] = false;
+            m_state[id] = State::Write;
+
+            const FlatInstruction& instr = m_code[m_codeStart[id] + m_pc[id]];
+            if (instr.dst == Target::ANY)
+            {
+                for (Neighbor port : { Neighbor::UP, Neighbor::DOWN, Neighbor::LEFT, Neighbor::RIGHT })
+                    PostTemp(id, m_outSlot[id][static_cast<int>(port)]);
+            }
+            else
+            {
+                PostTemp(id, instr.outSlot);
+            }
+        }
+        else if (m_state[id] == State::WriteComplete)
+        {
+            m_state[id] = State::Run;
+            Advance(id);
+        }
+    }
+
+    void PostTemp(int id, int slot)
+    {
+        Post(slot, m_temp[id]);
+        if (m_recording && slot >= 0)
+            RecordOp(ScheduleOpKind::Copy, id, &m_value[slot], &m_temp[id], 0);
+    }
+
+    void StackRead(int id)
+    {
+        for (int8_t slot : m_inSlot[id])
+        {
+            if (slot >= 0 && m_pending[slot])
+            {
+                m_stacks[id].push_back(Take(slot));
+                CancelWrites(id);
+                m_writeReady[id] = true;
+
+                // Don't bother attempting any other reads.
+                break;
+            }
+        }
+    }
+
+    void StackWrite(int id)
+    {
+        if (!m_writeReady[id] || m_stacks[id].empty())
+            return;
+        m_writeReady[id] = false;
+
+        for (int8_t slot : m_outSlot[id])
+            Post(slot, m_stacks[id].back());
+    }
+
+    void InputWrite(int id)
+    {
+        switch (m_state[id])
+        {
+        case State::Run:
+            if (m_position[id] < m_inputData[id]->size())
+            {
+                m_state[id] = State::Write;
+                Post(m_outSlot[id][0], (*m_inputData[id])[m_position[id]]);
+
+                if (m_recording)
+                {
+                    RecordGuard(ScheduleGuardKind::Input, Opcode::Indeterminate, id, 0, 0, nullptr);
+                    if (m_outSlot[id][0] >= 0)
+                        RecordOp(ScheduleOpKind::Input, id, &m_value[m_outSlot[id][0]], nullptr, 0);
+                }
+            }
+            else if (m_recording)
+            {
+                // Running out is control that the control state doesn't show.
+                m_recordFailed = true;
+            }
+            break;
+
+        case State::WriteComplete:
+            m_state[id] = State::Run;
+            ++m_position[id];
+            if (m_recording)
+                RecordOp(ScheduleOpKind::NextInput, id, nullptr, nullptr, 0);
+            break;
+
+        default:
+            break;
+        }
+    }
+};
\ No newline at end of file
@@ -17,12 +17,12 @@ public:
         m_data.resize(width * height);
     }
 
-    size_t Width()
+    size_t Width() const
     {
         return m_width;
     }
 
-    size_t Height()
+    size_t Height() const
     {
         return m_height;
     }
@@ -43,6 +43,11 @@ public:
         return m_data[index];
     }
 
+    const T& operator[](size_t index) const
+    {
+        return m_data[index];
+    }
+
 #pragma region row-major iterators
     typename std::vector<T>::iterator begin()
     {
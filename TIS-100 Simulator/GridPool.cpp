@@ -0,0 +1,35 @@
+#include "pch.h"
+#include "Node.h"
+#include "Arena.h"
+#include "IOChannel.h"
+#include "InputNode.h"
+#include "OutputBase.h"
+#include "OutputNode.h"
+#include "Engine.h"
+#include "ComputeNode.h"
+#include "StackMemoryNode.h"
+#include "Grid.h"
+#include "VisualizationNode.h"
+#include "Puzzle.h"
+#include "Constants.h"
+#include "PuzzleLayout.h"
+#include "Lanes.h"
+#include "FlatGrid.h"
+#include "MemoGrid.h"
+#include "ParallelGrid.h"
+#include "TimeWarpGrid.h"
+#include "ComputeGrid.h"
+#include "GridPool.h"
+
+ComputeGrid& GridPool::Get(const Puzzle& puzzle, bool* pReused)
+{
+    std::unique_ptr<ComputeGrid>& spGrid = m_grids[ComputeGrid::LayoutKey(puzzle)];
+    *pReused = (spGrid != nullptr);
+
+    if (*pReused)
+        spGrid->Reprogram(puzzle);
+    else
+        spGrid.reset(new ComputeGrid(puzzle));
+
+    return *spGrid;
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+// Grids kept for running one solution after another, one for each puzzle layout that has been run
+// (see ComputeGrid::LayoutKey). A solution for a layout that has been seen before runs on the grid
+// already built for it, reprogrammed in place, instead of on a new one.
+class GridPool
+{
+private:
+    std::map<std::vector<int>, std::unique_ptr<ComputeGrid>> m_grids;
+
+public:
+    // A grid for the puzzle, as though it had just been built for it: on Engine::Interpreter, and
+    // not yet initialized. It stays in the pool, and is only the puzzle's until the next call for a
+    // puzzle with the same layout. pReused is set to whether the grid was already in the pool.
+    ComputeGrid& Get(const Puzzle& puzzle, bool* pReused);
+};
\ No newline at end of file
@@ -1,57 +1,42 @@
 #include "pch.h"
 #include "Node.h"
+#include "Arena.h"
 #include "IOChannel.h"
-#include <assert.h>
 
-IOChannel::IOChannel(INode * a, INode * b)
-    : m_a(Endpoint{ a, false, 0 })
-    , m_b(Endpoint{ b, false, 0 })
+IOChannel::IOChannel()
+    : IOChannel(nullptr, nullptr, nullptr)
 {
 }
 
-void IOChannel::GetEndpoints(INode* node, Endpoint** ppThatEndpoint, Endpoint** ppOtherEndpoint)
+IOChannel::IOChannel(INode * a, INode * b, ChannelClock* pClock)
+    : m_endpoints{ Endpoint{ a, false, false, false, 0, 0 }, Endpoint{ b, false, false, false, 0, 0 } }
+    , m_pClock(pClock)
 {
-    *ppThatEndpoint = &m_a;
-    *ppOtherEndpoint = &m_b;
-    if (node == m_b.node)
-        std::swap(*ppThatEndpoint, *ppOtherEndpoint);
-    else
-        assert(node == m_a.node);
 }
 
-void IOChannel::Write(INode * senderNode, int value)
+IOChannelTable::IOChannelTable(Arena& arena, size_t capacity)
+    : m_channels(arena.NewArray<IOChannel>(capacity))
+    , m_count(0)
+    , m_capacity(capacity)
+    , m_clock{ 0, arena.NewArray<INode*>(2 * capacity), 0 }
 {
-    Endpoint* receiver;
-    Endpoint* sender;
-    GetEndpoints(senderNode, &sender, &receiver);
-
-    sender->writePending = true;
-    sender->sentValue = value;
 }
 
-bool IOChannel::Read(INode * receiverNode, int* pValue)
+IOChannel* IOChannelTable::Add(INode* a, INode* b)
 {
-    Endpoint* receiver;
-    Endpoint* sender;
-    GetEndpoints(receiverNode, &receiver, &sender);
+    if (m_count == m_capacity)
+        throw std::exception("too many channels");
 
-    if (sender->writePending)
-    {
-        *pValue = sender->sentValue;
-        sender->writePending = false;
-        sender->node->WriteComplete();
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    IOChannel* pChannel = &m_channels[m_count++];
+    *pChannel = IOChannel(a, b, &m_clock);
+    return pChannel;
 }
 
-void IOChannel::CancelWrite(INode* senderNode)
+void IOChannelTable::Reset()
 {
-    Endpoint* receiver;
-    Endpoint* sender;
-    GetEndpoints(senderNode, &sender, &receiver);
-    sender->writePending = false;
+    for (size_t i = 0; i < m_count; ++i)
+        m_channels[i] = IOChannel(m_channels[i].Node(0), m_channels[i].Node(1), &m_clock);
+
+    m_clock.cycle = 0;
+    m_clock.lateCount = 0;
 }
\ No newline at end of file
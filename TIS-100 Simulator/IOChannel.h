@@ -1,5 +1,21 @@
 #pragma once
 
+// Counts cycles, so that IOChannel can keep a value sent in one cycle from being read until the
+// next. Every engine that uses the channels advances it once per cycle.
+//
+// Engine::Fused steps each node in one go instead of in phases, so a node's write can be taken
+// after the node has already been stepped in that cycle. Those nodes are collected here, so that
+// their write phase can be run again once the cycle's reads are done.
+struct ChannelClock
+{
+    uint64_t cycle;
+    INode** lateNodes;
+    size_t lateCount;
+};
+
+// A channel between two nodes. Each side has its own slot for the value it is offering to the other.
+// Sides are numbered 0 and 1 when the nodes are joined, so nothing has to work out which node is
+// which when the channel is used.
 class IOChannel
 {
 private:
@@ -7,18 +23,179 @@ private:
     {
         INode* node;
         bool writePending;
+
+        // For Engine::Parallel: see DeferCompletion.
+        bool completionDeferred;
+        bool writeTaken;
+
         int sentValue;
+        uint64_t sentCycle;
     };
 
-    Endpoint m_a, m_b;
+    Endpoint m_endpoints[2];
+    ChannelClock* m_pClock;
+
+public:
+    IOChannel();
+    IOChannel(INode* a, INode* b, ChannelClock* pClock);
+
+    void Write(int senderSide, int value);
+    bool Read(int receiverSide, int* pValue);
+    bool HasValue(int receiverSide) const;
+    void CancelWrite(int senderSide);
+
+    INode* Node(int side) const { return m_endpoints[side].node; }
+
+    // For Engine::Parallel, where the two nodes are stepped by different threads (see
+    // ParallelGrid). While completion is deferred, a read that takes the value senderSide sent
+    // doesn't tell the sender; CompleteDeferredWrite does that later, on the sender's own thread.
+    void DeferCompletion(int senderSide, bool defer);
+    void CompleteDeferredWrite(int senderSide);
+
+    // For Engine::TimeWarp, where each region of the grid runs cycles on its own clock, and has its
+    // own copy of each channel to another region, with a stand-in for the node at the other end
+    // (see TimeWarpGrid).
+    void SetNode(int side, INode* node) { m_endpoints[side].node = node; }
+    void SetClock(ChannelClock* pClock) { m_pClock = pClock; }
+    void CopySide(int side, const IOChannel& other);
+
+    // Whether senderSide wrote a value in cycle that is still waiting to be read, and if so, what.
+    bool WroteInCycle(int senderSide, uint64_t cycle, int* pValue) const;
+};
+
+// One node's end of an IOChannel. A default-constructed port isn't connected to anything.
+class IOPort
+{
+private:
+    IOChannel* m_pChannel;
+    int m_side;
+
+public:
+    IOPort() : m_pChannel(nullptr), m_side(0) {}
+    IOPort(IOChannel* pChannel, int side) : m_pChannel(pChannel), m_side(side) {}
+
+    bool IsConnected() const { return m_pChannel != nullptr; }
+
+    void Write(int value) { m_pChannel->Write(m_side, value); }
+    bool Read(int* pValue) { return m_pChannel->Read(m_side, pValue); }
+    bool HasValue() const { return m_pChannel->HasValue(m_side); }
+    void CancelWrite() { m_pChannel->CancelWrite(m_side); }
+};
+
+class Arena;
+
+// Every channel in a grid, allocated in one array up front. The nodes point into it, so it has to
+// outlive them, and can't grow.
+class IOChannelTable
+{
+private:
+    IOChannel* m_channels;
+    size_t m_count;
+    size_t m_capacity;
+    ChannelClock m_clock;
 
 public:
-    IOChannel(INode* a, INode* b);
+    // The channels, and the list of late nodes, are placed in the arena.
+    IOChannelTable(Arena& arena, size_t capacity);
+
+    // The next free channel, set up between a and b.
+    IOChannel* Add(INode* a, INode* b);
+
+    // Put every channel, and the clock, back the way they were when the channels were added.
+    void Reset();
 
-    void Write(INode* senderNode, int value);
-    bool Read(INode* receiverNode, int* pValue);
-    void CancelWrite(INode* senderNode);
+    IOChannel* Channels() const { return m_channels; }
+    size_t Count() const { return m_count; }
 
-protected:
-    void GetEndpoints(INode* node, Endpoint** ppThatEndpoint, Endpoint** ppOtherEndpoint);
-};
\ No newline at end of file
+    // For Engine::TimeWarp, which gives the channels other clocks while it runs, and hands them back
+    // set to the cycle it got to.
+    ChannelClock* Clock() { return &m_clock; }
+
+    uint64_t Cycle() const { return m_clock.cycle; }
+    void NextCycle() { ++m_clock.cycle; }
+
+    // The nodes whose write was taken after they were stepped in this cycle, for Engine::Fused.
+    INode* const* LateNodes() const { return m_clock.lateNodes; }
+    size_t LateNodeCount() const { return m_clock.lateCount; }
+    void ClearLateNodes() { m_clock.lateCount = 0; }
+};
+
+inline void IOChannel::Write(int senderSide, int value)
+{
+    Endpoint& sender = m_endpoints[senderSide];
+    sender.writePending = true;
+    sender.sentValue = value;
+    sender.sentCycle = m_pClock->cycle;
+    m_endpoints[senderSide ^ 1].node->Wake();
+}
+
+inline bool IOChannel::Read(int receiverSide, int* pValue)
+{
+    Endpoint& sender = m_endpoints[receiverSide ^ 1];
+    if (sender.writePending && (sender.sentCycle != m_pClock->cycle))
+    {
+        *pValue = sender.sentValue;
+        sender.writePending = false;
+        if (sender.completionDeferred)
+        {
+            sender.writeTaken = true;
+            return true;
+        }
+
+        sender.node->WriteComplete();
+        sender.node->Wake();
+
+        // A node's write can only be taken once per cycle, so there's at most one of these for
+        // each end of each channel.
+        if (sender.node->SteppedCycle == m_pClock->cycle)
+            m_pClock->lateNodes[m_pClock->lateCount++] = sender.node;
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+// Whether Read would succeed, without doing it.
+inline bool IOChannel::HasValue(int receiverSide) const
+{
+    const Endpoint& sender = m_endpoints[receiverSide ^ 1];
+    return sender.writePending && (sender.sentCycle != m_pClock->cycle);
+}
+
+inline void IOChannel::CancelWrite(int senderSide)
+{
+    m_endpoints[senderSide].writePending = false;
+}
+
+inline void IOChannel::DeferCompletion(int senderSide, bool defer)
+{
+    m_endpoints[senderSide].completionDeferred = defer;
+    m_endpoints[senderSide].writeTaken = false;
+}
+
+inline void IOChannel::CompleteDeferredWrite(int senderSide)
+{
+    Endpoint& sender = m_endpoints[senderSide];
+    if (sender.writeTaken)
+    {
+        sender.writeTaken = false;
+        sender.node->WriteComplete();
+        sender.node->Wake();
+    }
+}
+
+inline void IOChannel::CopySide(int side, const IOChannel& other)
+{
+    INode* node = m_endpoints[side].node;
+    m_endpoints[side] = other.m_endpoints[side];
+    m_endpoints[side].node = node;
+}
+
+inline bool IOChannel::WroteInCycle(int senderSide, uint64_t cycle, int* pValue) const
+{
+    const Endpoint& sender = m_endpoints[senderSide];
+    *pValue = sender.sentValue;
+    return sender.writePending && (sender.sentCycle == cycle);
+}
\ No newline at end of file
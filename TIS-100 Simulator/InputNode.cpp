@@ -1,7 +1,7 @@
 #include "pch.h"
 #include "Node.h"
-#include "InputNode.h"
 #include "IOChannel.h"
+#include "InputNode.h"
 
 InputNode::InputNode(const std::vector<int>& data)
     : m_data(data)
@@ -14,14 +14,19 @@ void InputNode::SetData(std::vector<int>&& data)
     m_data = data;
 }
 
-void InputNode::SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO)
+const std::vector<int>& InputNode::Data() const
 {
-    if ((m_spIO != nullptr) && (m_neighborDirection != direction))
+    return m_data;
+}
+
+void InputNode::SetNeighbor(Neighbor direction, const IOPort& port)
+{
+    if (m_port.IsConnected() && (m_neighborDirection != direction))
     {
         throw std::exception("InputNode can only have one neighbor.");
     }
 
-    m_spIO = spIO;
+    m_port = port;
     m_neighborDirection = direction;
 }
 
@@ -29,7 +34,7 @@ void InputNode::Initialize()
 {
     m_position = 0;
     m_state = State::Ready;
-    m_spIO->CancelWrite(this);
+    m_port.CancelWrite();
 }
 
 void InputNode::Read()
@@ -55,7 +60,7 @@ void InputNode::Write()
         if (m_position < m_data.size())
         {
             m_state = State::Write;
-            m_spIO->Write(this, m_data[m_position]);
+            m_port.Write(m_data[m_position]);
         }
         break;
     case State::Write:
@@ -88,4 +93,24 @@ void InputNode::Step()
         ++m_position;
         break;
     }
+}
+
+bool InputNode::IsIdle() const
+{
+    // Waiting for the value to be read, or out of values.
+    return (m_state == State::Write)
+        || (m_state == State::Ready && m_position >= m_data.size());
+}
+
+void InputNode::SaveState(std::vector<int>& state) const
+{
+    state.push_back(static_cast<int>(m_position));
+    state.push_back(static_cast<int>(m_state));
+}
+
+const int* InputNode::RestoreState(const int* state)
+{
+    m_position = static_cast<size_t>(state[0]);
+    m_state = static_cast<State>(state[1]);
+    return state + 2;
 }
\ No newline at end of file
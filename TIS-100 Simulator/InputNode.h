@@ -1,6 +1,6 @@
 #pragma once
 
-class InputNode : public INode
+class InputNode final : public INode
 {
 private:
     enum class State
@@ -14,15 +14,16 @@ private:
     std::vector<int> m_data;
     size_t m_position;
     State m_state;
-    std::shared_ptr<IOChannel> m_spIO;
+    IOPort m_port;
     Neighbor m_neighborDirection;
 
 public:
     InputNode(const std::vector<int>& data);
 
     void SetData(std::vector<int>&& data);
+    const std::vector<int>& Data() const;
 
-    virtual void SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO);
+    virtual void SetNeighbor(Neighbor direction, const IOPort& port);
     virtual void Initialize();
     virtual void Read();
     virtual void ReadComplete(int value);
@@ -30,4 +31,7 @@ public:
     virtual void Write();
     virtual void WriteComplete();
     virtual void Step();
+    virtual bool IsIdle() const;
+    virtual void SaveState(std::vector<int>& state) const;
+    virtual const int* RestoreState(const int* state);
 };
\ No newline at end of file
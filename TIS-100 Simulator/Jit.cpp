@@ -0,0 +1,452 @@
+#include "pch.h"
+#include "Node.h"
+#include "IOChannel.h"
+#include "Engine.h"
+#include "ComputeNode.h"
+#include "Jit.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_SUPPORTED
+#endif
+
+ExecutableBuffer::ExecutableBuffer()
+    : m_data(nullptr)
+{
+}
+
+ExecutableBuffer::~ExecutableBuffer()
+{
+    if (m_data == nullptr)
+        return;
+
+#ifdef _WIN32
+    VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+    munmap(m_data, m_code.size());
+#endif
+}
+
+size_t ExecutableBuffer::Size() const
+{
+    return m_code.size();
+}
+
+const uint8_t* ExecutableBuffer::Data() const
+{
+    return m_data;
+}
+
+void ExecutableBuffer::Emit(std::initializer_list<uint8_t> bytes)
+{
+    m_code.insert(m_code.end(), bytes);
+}
+
+void ExecutableBuffer::Emit32(int32_t value)
+{
+    uint32_t bits = static_cast<uint32_t>(value);
+    Emit({
+        static_cast<uint8_t>(bits),
+        static_cast<uint8_t>(bits >> 8),
+        static_cast<uint8_t>(bits >> 16),
+        static_cast<uint8_t>(bits >> 24) });
+}
+
+void ExecutableBuffer::Emit64(uint64_t value)
+{
+    Emit32(static_cast<int32_t>(value));
+    Emit32(static_cast<int32_t>(value >> 32));
+}
+
+void ExecutableBuffer::Patch32(size_t offset, int32_t value)
+{
+    uint32_t bits = static_cast<uint32_t>(value);
+    for (int i = 0; i < 4; ++i)
+        m_code[offset + i] = static_cast<uint8_t>(bits >> (8 * i));
+}
+
+bool ExecutableBuffer::Finalize()
+{
+    size_t size = m_code.size();
+#ifdef _WIN32
+    uint8_t* data = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (data == nullptr)
+        return false;
+
+    memcpy(data, m_code.data(), size);
+    DWORD oldProtect;
+    if (!VirtualProtect(data, size, PAGE_EXECUTE_READ, &oldProtect))
+    {
+        VirtualFree(data, 0, MEM_RELEASE);
+        return false;
+    }
+    FlushInstructionCache(GetCurrentProcess(), data, size);
+#else
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return false;
+
+    uint8_t* data = static_cast<uint8_t*>(p);
+    memcpy(data, m_code.data(), size);
+    if (mprotect(data, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(data, size);
+        return false;
+    }
+#endif
+
+    m_data = data;
+    return true;
+}
+
+#pragma region x86-64 code generation
+
+// A node's program is compiled to one piece of code, with an entry point for each instruction that
+// doesn't use a port (or halt). From there, it runs instructions for as long as it can without
+// going back to the dispatcher: ACC is kept in R8D and BAK in R9D, and jumps between those
+// instructions are native jumps. When it gets to an instruction that does use a port, it stores the
+// registers and PC back in the node and returns.
+//
+// It counts the instructions it ran in R10D, one per cycle, and leaves the node busy for the cycles
+// after the first, the same way a superinstruction does (see Superinstructions.h). Nothing outside
+// the node can tell the difference, since none of those instructions touch a port. A loop that never
+// gets to a port is cut off after MaxBlockCycles, and carries on from there once the node is done
+// being busy.
+//
+// The code only uses RAX, RCX and R8 to R10, which are volatile in both the Microsoft and System V
+// calling conventions, and ignores its ComputeNode* argument: everything it touches has its address
+// baked in.
+
+// The most instructions the code runs per call.
+static constexpr int32_t MaxBlockCycles = 1024;
+
+enum class Condition : uint8_t
+{
+    AboveOrEqual = 0x3,
+    Equal = 0x4,
+    NotEqual = 0x5,
+    Less = 0xC,
+    Greater = 0xF,
+};
+
+// Places in the code that jumps go to, which may not have been emitted yet when the jump is.
+class Labels
+{
+private:
+    struct Fixup
+    {
+        size_t offset; // of the rel32 to fill in
+        size_t label;
+    };
+
+    std::vector<size_t> m_offsets;
+    std::vector<Fixup> m_fixups;
+
+public:
+    explicit Labels(size_t count) : m_offsets(count) {}
+
+    void Bind(size_t label, const ExecutableBuffer& code)
+    {
+        m_offsets[label] = code.Size();
+    }
+
+    // jmp label
+    void EmitJump(ExecutableBuffer& code, size_t label)
+    {
+        code.Emit({ 0xE9 });
+        EmitTarget(code, label);
+    }
+
+    // jcc label
+    void EmitJumpIf(ExecutableBuffer& code, Condition cc, size_t label)
+    {
+        code.Emit({ 0x0F, static_cast<uint8_t>(0x80 | static_cast<uint8_t>(cc)) });
+        EmitTarget(code, label);
+    }
+
+    void Resolve(ExecutableBuffer& code) const
+    {
+        for (const Fixup& fixup : m_fixups)
+            code.Patch32(fixup.offset, static_cast<int32_t>(m_offsets[fixup.label] - (fixup.offset + 4)));
+    }
+
+private:
+    void EmitTarget(ExecutableBuffer& code, size_t label)
+    {
+        m_fixups.push_back(Fixup{ code.Size(), label });
+        code.Emit32(0);
+    }
+};
+
+// The labels in a program's code: each instruction, the exit to each PC, and the epilogue.
+struct ProgramLabels
+{
+    size_t instructionCount;
+
+    size_t Instruction(size_t pc) const { return pc; }
+    size_t Exit(size_t pc) const { return instructionCount + pc; }
+    size_t Epilogue() const { return 2 * instructionCount; }
+    size_t Count() const { return 2 * instructionCount + 1; }
+};
+
+// mov rax, imm64
+static void EmitLoadRax(ExecutableBuffer& code, const void* address)
+{
+    code.Emit({ 0x48, 0xB8 });
+    code.Emit64(reinterpret_cast<uint64_t>(address));
+}
+
+#pragma endregion
+
+bool JitCompiler::IsSupported()
+{
+#ifdef JIT_SUPPORTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Generate the code for one instruction, which doesn't use a port, ending with a jump to wherever it
+// goes next: the code for that instruction if it's compiled too, or the exit to it otherwise.
+static void CompileInstruction(
+    ExecutableBuffer& code,
+    Labels& labels,
+    const ProgramLabels& programLabels,
+    const std::vector<bool>& compiled,
+    const DecodedInstruction& instr,
+    size_t pc
+    )
+{
+    size_t instructionCount = compiled.size();
+    auto labelFor = [&](size_t target)
+    {
+        return compiled[target] ? programLabels.Instruction(target) : programLabels.Exit(target);
+    };
+
+    // Run the instruction after this one, which is left to fall through to if it comes next.
+    auto goTo = [&](size_t target)
+    {
+        if (!compiled[target] || (target != pc + 1))
+            labels.EmitJump(code, labelFor(target));
+    };
+
+    code.Emit({ 0x41, 0x81, 0xFA }); // cmp r10d, imm32
+    code.Emit32(MaxBlockCycles);
+    labels.EmitJumpIf(code, Condition::AboveOrEqual, programLabels.Exit(pc));
+    code.Emit({ 0x41, 0xFF, 0xC2 }); // inc r10d
+
+    size_t next = (pc + 1 < instructionCount) ? (pc + 1) : 0;
+
+    switch (instr.op)
+    {
+    case Opcode::NOP:
+        break;
+
+    case Opcode::SAV:
+        code.Emit({ 0x45, 0x89, 0xC1 }); // mov r9d, r8d
+        break;
+
+    case Opcode::SWP:
+        code.Emit({ 0x45, 0x87, 0xC8 }); // xchg r8d, r9d
+        break;
+
+    case Opcode::ADD:
+    case Opcode::SUB:
+        switch (instr.src)
+        {
+        case Target::None:
+            code.Emit({ 0x41, 0x81, static_cast<uint8_t>((instr.op == Opcode::ADD) ? 0xC0 : 0xE8) }); // add/sub r8d, imm32
+            code.Emit32(instr.immediate);
+            break;
+        case Target::NIL:
+            break;
+        case Target::ACC:
+            if (instr.op == Opcode::ADD)
+                code.Emit({ 0x45, 0x01, 0xC0 }); // add r8d, r8d
+            else
+                code.Emit({ 0x45, 0x31, 0xC0 }); // xor r8d, r8d
+            break;
+        default:
+            throw std::exception("port source in a compiled instruction");
+        }
+        break;
+
+    case Opcode::MOV:
+        if (instr.dst == Target::ACC)
+        {
+            switch (instr.src)
+            {
+            case Target::None:
+                code.Emit({ 0x41, 0xB8 }); // mov r8d, imm32
+                code.Emit32(instr.immediate);
+                break;
+            case Target::NIL:
+                code.Emit({ 0x45, 0x31, 0xC0 }); // xor r8d, r8d
+                break;
+            case Target::ACC:
+                break;
+            default:
+                throw std::exception("port source in a compiled instruction");
+            }
+        }
+        break;
+
+    case Opcode::JMP:
+        next = instr.jumpTarget;
+        break;
+
+    case Opcode::JEZ:
+    case Opcode::JNZ:
+    case Opcode::JGZ:
+    case Opcode::JLZ:
+    {
+        Condition cc = (instr.op == Opcode::JEZ) ? Condition::Equal
+            : (instr.op == Opcode::JNZ) ? Condition::NotEqual
+            : (instr.op == Opcode::JGZ) ? Condition::Greater
+            : Condition::Less;
+
+        code.Emit({ 0x45, 0x85, 0xC0 }); // test r8d, r8d
+        labels.EmitJumpIf(code, cc, labelFor(instr.jumpTarget));
+        break;
+    }
+
+    case Opcode::JRO:
+        if (instr.src == Target::ACC)
+        {
+            // Same wrap-around as ComputeNode::JumpRelative: anything out of range, including
+            // negative, goes to the last instruction. Where it goes isn't known until now, so it
+            // always goes back to the dispatcher.
+            code.Emit({ 0x49, 0x63, 0xC8 }); // movsxd rcx, r8d
+            code.Emit({ 0x48, 0x81, 0xC1 }); // add rcx, imm32
+            code.Emit32(static_cast<int32_t>(pc));
+            code.Emit({ 0xB8 }); // mov eax, imm32
+            code.Emit32(static_cast<int32_t>(instructionCount - 1));
+            code.Emit({ 0x48, 0x81, 0xF9 }); // cmp rcx, imm32
+            code.Emit32(static_cast<int32_t>(instructionCount));
+            code.Emit({ 0x48, 0x0F, 0x40 | static_cast<uint8_t>(Condition::AboveOrEqual), 0xC8 }); // cmovae rcx, rax
+            labels.EmitJump(code, programLabels.Epilogue());
+            return;
+        }
+        else
+        {
+            int offset = (instr.src == Target::None) ? instr.immediate : 0;
+            next = pc + offset;
+            if (next >= instructionCount)
+                next = instructionCount - 1;
+        }
+        break;
+
+    default:
+        throw std::exception("invalid opcode for a compiled instruction");
+    }
+
+    goTo(next);
+}
+
+void JitCompiler::Compile(ComputeNode* node)
+{
+    const ComputeNode::Program& program = *node->m_spProgram;
+    node->m_jitHandlers = program.fusedHandlers;
+    node->m_jitCode.reset();
+
+#ifdef JIT_SUPPORTED
+    static_assert(sizeof(ComputeNode::State) == sizeof(int32_t), "the generated code sets the state as a dword");
+
+    // Counting loops keep their handlers, which skip the whole loop at once, as do the instructions
+    // that use ports, and the transducers that start at some of those.
+    size_t instructionCount = program.code.size();
+    std::vector<bool> compiled(instructionCount);
+    bool anyCompiled = false;
+    for (size_t pc = 0; pc < instructionCount; ++pc)
+    {
+        compiled[pc] = program.threaded[pc].local && (program.countingLoops[pc].cycles == 0);
+        anyCompiled = anyCompiled || compiled[pc];
+    }
+    if (!anyCompiled)
+        return;
+
+    std::unique_ptr<ExecutableBuffer> spCode(new ExecutableBuffer());
+    ExecutableBuffer& code = *spCode;
+    ProgramLabels programLabels = { instructionCount };
+    Labels labels(programLabels.Count());
+
+    for (size_t pc = 0; pc < instructionCount; ++pc)
+    {
+        if (compiled[pc])
+        {
+            labels.Bind(programLabels.Instruction(pc), code);
+            CompileInstruction(code, labels, programLabels, compiled, program.code[pc], pc);
+        }
+    }
+
+    // pc = ecx
+    for (size_t pc = 0; pc < instructionCount; ++pc)
+    {
+        labels.Bind(programLabels.Exit(pc), code);
+        code.Emit({ 0xB9 }); // mov ecx, imm32
+        code.Emit32(static_cast<int32_t>(pc));
+        labels.EmitJump(code, programLabels.Epilogue());
+    }
+
+    // Store the registers and PC, and stay busy for the cycles after the first.
+    labels.Bind(programLabels.Epilogue(), code);
+    EmitLoadRax(code, &node->m_acc);
+    code.Emit({ 0x44, 0x89, 0x00 }); // mov [rax], r8d
+    EmitLoadRax(code, &node->m_bak);
+    code.Emit({ 0x44, 0x89, 0x08 }); // mov [rax], r9d
+    EmitLoadRax(code, &node->m_pc);
+    code.Emit({ 0x48, 0x89, 0x08 }); // mov [rax], rcx
+    code.Emit({ 0x41, 0x83, 0xFA, 0x01 }); // cmp r10d, 1
+    code.Emit({ 0x77, 0x01 }); // ja +1
+    code.Emit({ 0xC3 }); // ret
+    code.Emit({ 0x41, 0xFF, 0xCA }); // dec r10d
+    EmitLoadRax(code, &node->m_busyCycles);
+    code.Emit({ 0x44, 0x89, 0x10 }); // mov [rax], r10d
+    EmitLoadRax(code, &node->m_state);
+    code.Emit({ 0xC7, 0x00 }); // mov dword [rax], imm32
+    code.Emit32(static_cast<int32_t>(ComputeNode::State::Busy));
+    code.Emit({ 0xC3 }); // ret
+
+    // Entry points: load the registers and go to the instruction.
+    std::vector<size_t> entries(instructionCount);
+    for (size_t pc = 0; pc < instructionCount; ++pc)
+    {
+        if (!compiled[pc])
+            continue;
+
+        entries[pc] = code.Size();
+        EmitLoadRax(code, &node->m_acc);
+        code.Emit({ 0x44, 0x8B, 0x00 }); // mov r8d, [rax]
+        EmitLoadRax(code, &node->m_bak);
+        code.Emit({ 0x44, 0x8B, 0x08 }); // mov r9d, [rax]
+        code.Emit({ 0x45, 0x31, 0xD2 }); // xor r10d, r10d
+        labels.EmitJump(code, programLabels.Instruction(pc));
+    }
+
+    labels.Resolve(code);
+
+    // If the code can't be made executable, the node just runs its threaded handlers.
+    if (!code.Finalize())
+        return;
+
+    for (size_t pc = 0; pc < instructionCount; ++pc)
+    {
+        if (compiled[pc])
+        {
+            node->m_jitHandlers[pc].read = reinterpret_cast<ComputeNode::Handler>(
+                const_cast<uint8_t*>(code.Data() + entries[pc]));
+            node->m_jitHandlers[pc].length = 1;
+        }
+    }
+
+    node->m_jitCode = std::move(spCode);
+#endif
+}
\ No newline at end of file
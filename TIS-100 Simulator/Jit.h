@@ -0,0 +1,52 @@
+#pragma once
+
+// Memory for generated machine code.
+// Code is emitted into ordinary memory, and Finalize() copies it into memory of its own that is
+// exactly big enough for it, and executable (but not writable).
+class ExecutableBuffer
+{
+private:
+    std::vector<uint8_t> m_code;
+    uint8_t* m_data;
+
+public:
+    ExecutableBuffer();
+    ~ExecutableBuffer();
+
+    ExecutableBuffer(const ExecutableBuffer&) = delete;
+    ExecutableBuffer& operator=(const ExecutableBuffer&) = delete;
+
+    size_t Size() const;
+
+    // The executable code, once Finalize() has succeeded.
+    const uint8_t* Data() const;
+
+    void Emit(std::initializer_list<uint8_t> bytes);
+    void Emit32(int32_t value);
+    void Emit64(uint64_t value);
+
+    // Overwrite 4 bytes that have already been emitted.
+    void Patch32(size_t offset, int32_t value);
+
+    // Returns false if the memory couldn't be allocated or made executable.
+    bool Finalize();
+};
+
+// Compiles ComputeNode programs to native x86-64 code, for Engine::Jit.
+//
+// Each instruction that doesn't touch a port gets native code that stands in for its threaded read
+// handler, and runs on from there through the instructions after it, with ACC and BAK in registers,
+// until it gets to one that does. The node's register addresses, operands and branch targets are
+// baked into the code as constants. The other instructions keep their handlers from the program's
+// fusedHandlers, which do the IOChannel calls, as do counting loops.
+class JitCompiler
+{
+public:
+    // Whether native code can be generated for the platform this was built for.
+    static bool IsSupported();
+
+    // Generate native handlers for the node's assembled program.
+    // If the platform isn't supported, or the code can't be made executable, the node just gets a
+    // copy of the program's fusedHandlers.
+    static void Compile(ComputeNode* node);
+};
\ No newline at end of file
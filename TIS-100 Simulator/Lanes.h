@@ -0,0 +1,186 @@
+#pragma once
+
+// Vectors of ints with one element per lane, for running the same grid on several test sets at once
+// (see BatchGrid). Everything that can differ between lanes is kept in a LaneVector or a LaneMask.
+//
+// These use AVX-512 or AVX2 where the compiler is targeting them, and plain loops otherwise.
+
+#if defined(__AVX512F__)
+static constexpr int BatchLanes = 16;
+#else
+static constexpr int BatchLanes = 8;
+#endif
+
+// A set of lanes, one bit per lane.
+typedef uint32_t LaneMask;
+
+static constexpr LaneMask AllLanes = (1U << BatchLanes) - 1;
+
+// Index of the lowest set bit; bits must not be zero.
+inline size_t LowestBitIndex(uint32_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+struct alignas(BatchLanes * sizeof(int)) LaneVector
+{
+    int lane[BatchLanes];
+};
+
+#if defined(__AVX512F__)
+
+inline __m512i LoadLanes(const LaneVector& a)
+{
+    return _mm512_load_si512(a.lane);
+}
+
+inline LaneVector StoreLanes(__m512i v)
+{
+    LaneVector result;
+    _mm512_store_si512(result.lane, v);
+    return result;
+}
+
+inline LaneVector Broadcast(int value)
+{
+    return StoreLanes(_mm512_set1_epi32(value));
+}
+
+inline LaneVector Add(const LaneVector& a, const LaneVector& b)
+{
+    return StoreLanes(_mm512_add_epi32(LoadLanes(a), LoadLanes(b)));
+}
+
+inline LaneVector Sub(const LaneVector& a, const LaneVector& b)
+{
+    return StoreLanes(_mm512_sub_epi32(LoadLanes(a), LoadLanes(b)));
+}
+
+// a in the lanes in mask, b in the rest.
+inline LaneVector Select(LaneMask mask, const LaneVector& a, const LaneVector& b)
+{
+    return StoreLanes(_mm512_mask_blend_epi32(static_cast<__mmask16>(mask), LoadLanes(b), LoadLanes(a)));
+}
+
+inline LaneMask Equal(const LaneVector& a, const LaneVector& b)
+{
+    return _mm512_cmpeq_epi32_mask(LoadLanes(a), LoadLanes(b));
+}
+
+inline LaneMask Greater(const LaneVector& a, const LaneVector& b)
+{
+    return _mm512_cmpgt_epi32_mask(LoadLanes(a), LoadLanes(b));
+}
+
+#elif defined(__AVX2__)
+
+inline __m256i LoadLanes(const LaneVector& a)
+{
+    return _mm256_load_si256(reinterpret_cast<const __m256i*>(a.lane));
+}
+
+inline LaneVector StoreLanes(__m256i v)
+{
+    LaneVector result;
+    _mm256_store_si256(reinterpret_cast<__m256i*>(result.lane), v);
+    return result;
+}
+
+inline LaneMask MaskFromVector(__m256i v)
+{
+    return static_cast<LaneMask>(_mm256_movemask_ps(_mm256_castsi256_ps(v)));
+}
+
+inline LaneVector Broadcast(int value)
+{
+    return StoreLanes(_mm256_set1_epi32(value));
+}
+
+inline LaneVector Add(const LaneVector& a, const LaneVector& b)
+{
+    return StoreLanes(_mm256_add_epi32(LoadLanes(a), LoadLanes(b)));
+}
+
+inline LaneVector Sub(const LaneVector& a, const LaneVector& b)
+{
+    return StoreLanes(_mm256_sub_epi32(LoadLanes(a), LoadLanes(b)));
+}
+
+// a in the lanes in mask, b in the rest.
+inline LaneVector Select(LaneMask mask, const LaneVector& a, const LaneVector& b)
+{
+    const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i selected = _mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(mask)), laneBits), laneBits);
+    return StoreLanes(_mm256_blendv_epi8(LoadLanes(b), LoadLanes(a), selected));
+}
+
+inline LaneMask Equal(const LaneVector& a, const LaneVector& b)
+{
+    return MaskFromVector(_mm256_cmpeq_epi32(LoadLanes(a), LoadLanes(b)));
+}
+
+inline LaneMask Greater(const LaneVector& a, const LaneVector& b)
+{
+    return MaskFromVector(_mm256_cmpgt_epi32(LoadLanes(a), LoadLanes(b)));
+}
+
+#else
+
+inline LaneVector Broadcast(int value)
+{
+    LaneVector result;
+    for (int i = 0; i < BatchLanes; ++i)
+        result.lane[i] = value;
+    return result;
+}
+
+// Arithmetic wraps around, like the vector instructions do.
+inline LaneVector Add(const LaneVector& a, const LaneVector& b)
+{
+    LaneVector result;
+    for (int i = 0; i < BatchLanes; ++i)
+        result.lane[i] = static_cast<int>(static_cast<uint32_t>(a.lane[i]) + static_cast<uint32_t>(b.lane[i]));
+    return result;
+}
+
+inline LaneVector Sub(const LaneVector& a, const LaneVector& b)
+{
+    LaneVector result;
+    for (int i = 0; i < BatchLanes; ++i)
+        result.lane[i] = static_cast<int>(static_cast<uint32_t>(a.lane[i]) - static_cast<uint32_t>(b.lane[i]));
+    return result;
+}
+
+// a in the lanes in mask, b in the rest.
+inline LaneVector Select(LaneMask mask, const LaneVector& a, const LaneVector& b)
+{
+    LaneVector result;
+    for (int i = 0; i < BatchLanes; ++i)
+        result.lane[i] = ((mask >> i) & 1) ? a.lane[i] : b.lane[i];
+    return result;
+}
+
+inline LaneMask Equal(const LaneVector& a, const LaneVector& b)
+{
+    LaneMask result = 0;
+    for (int i = 0; i < BatchLanes; ++i)
+        result |= static_cast<LaneMask>(a.lane[i] == b.lane[i]) << i;
+    return result;
+}
+
+inline LaneMask Greater(const LaneVector& a, const LaneVector& b)
+{
+    LaneMask result = 0;
+    for (int i = 0; i < BatchLanes; ++i)
+        result |= static_cast<LaneMask>(a.lane[i] > b.lane[i]) << i;
+    return result;
+}
+
+#endif
\ No newline at end of file
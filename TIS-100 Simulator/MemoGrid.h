@@ -0,0 +1,465 @@
+#pragma once
+
+// Remembers what a FlatGrid did, for Engine::Memo, so that it can skip straight to the end of it
+// the next time it's in the same state.
+//
+// What a grid does from a given state depends on nothing else but the values its inputs have yet to
+// send. Each block of LeafCycles cycles stepped is remembered as an entry: the state before and
+// after, the input values the block took, and the values it sent to the outputs. Entries for runs
+// of cycles that follow on from each other are combined, like Hashlife does, into entries for runs
+// twice as long, so a grid that comes back round to a state with the same inputs ahead of it can
+// skip 2^n cycles at a time. The entries are kept across runs, and the least recently used are
+// dropped to stay under a limit on the memory they take.
+//
+// Saving and looking up the state costs far more than a cycle, so it's only done at the start of a
+// block, counting from when the grid was initialized.
+//
+// Grids with stack nodes aren't memoized, since the state would have to include the stacks.
+template <int GridHeight, int GridWidth>
+class MemoGrid
+{
+private:
+    typedef FlatGrid<GridHeight, GridWidth> Flat;
+    typedef typename Flat::ControlState ControlState;
+    typedef typename Flat::State NodeState;
+
+    static constexpr int GridCount = Flat::GridCount;
+    static constexpr int MaxIOCount = Flat::MaxIOCount;
+    static constexpr int MaxSlotCount = Flat::MaxSlotCount;
+
+    // Entries cover at least 2^LeafLevel cycles, and at most 2^MaxLevel, so cycle counts stay in
+    // an int.
+    static constexpr int LeafLevel = 4;
+    static constexpr int LeafCycles = 1 << LeafLevel;
+    static constexpr int MaxLevel = 24;
+
+    // The most entries kept for the same state and level, which differ in the inputs they take.
+    // Each lookup has to check all of them, and grids whose inputs are different every time would
+    // otherwise pile up one for every run.
+    static constexpr int MaxAlternatives = 4;
+
+    // Everything the rest of a run depends on, apart from the inputs.
+    struct GridState
+    {
+        ControlState control;
+        int acc[GridCount];
+        int bak[GridCount];
+        int temp[GridCount];
+
+        // Values in the slots that are pending; the others are zero, since they're never read.
+        int value[MaxSlotCount];
+    };
+
+    // An input value that an entry took, at its index from where the input was at the start of the
+    // entry. If end is set, the entry saw the input run out there instead.
+    struct InputRead
+    {
+        int input;
+        int index;
+        bool end;
+        int value;
+    };
+
+    // A value that an entry sent to an output, in a cycle counted from the start of the entry.
+    struct OutputEvent
+    {
+        int cycle;
+        int output;
+        int value;
+    };
+
+    struct Entry
+    {
+        // The entry covers 2^level cycles.
+        int level;
+
+        uint64_t key;
+
+        // When the entry was last found or added, counting lookups.
+        uint64_t lastUsed;
+
+        GridState before;
+        GridState after;
+
+        // How far each input moved on, by node ID less GridCount.
+        size_t advance[MaxIOCount];
+
+        std::vector<InputRead> reads;
+
+        // In cycle order.
+        std::vector<OutputEvent> events;
+
+        // Roughly what the entry costs, counting the list and table nodes that hold it.
+        size_t Bytes() const
+        {
+            return sizeof(Entry) + 4 * sizeof(void*) + 2 * sizeof(uint64_t)
+                + reads.capacity() * sizeof(InputRead) + events.capacity() * sizeof(OutputEvent);
+        }
+    };
+
+    typedef std::list<std::shared_ptr<Entry>> EntryList;
+    typedef std::unordered_multimap<uint64_t, typename EntryList::iterator> EntryTable;
+
+    Flat& m_flat;
+
+    // Most recently used first.
+    EntryList m_entries;
+    EntryTable m_table;
+
+    size_t m_bytes;
+    size_t m_capacity;
+    uint64_t m_useCount;
+
+    // No entry is at a higher level than this, although some of the ones that were may have been
+    // dropped since.
+    int m_topLevel;
+
+    // Entries for the cycles run since the grid was initialized, each following on from the one
+    // before, at levels that go strictly down like the digits of a binary counter. Adding an entry
+    // at the same level as the last one carries into a combined entry a level up.
+    std::vector<std::shared_ptr<Entry>> m_chain;
+
+    bool m_enabled;
+
+    // Cycles run since the grid was initialized.
+    int m_cycle;
+
+    // The entry for the block being stepped through, and where the inputs were at its start.
+    std::shared_ptr<Entry> m_spLeaf;
+    size_t m_leafPositions[MaxIOCount];
+
+    // Filled in by FlatGrid::Step.
+    std::vector<std::pair<int, int>> m_outputLog;
+
+    // Scratch space for FastForward, to save copying a GridState onto the stack.
+    GridState m_current;
+
+public:
+    static constexpr size_t DefaultCapacity = 64 << 20;
+
+    // Formal Parameters:
+    //  flat: the grid's FlatGrid, which must outlive this.
+    MemoGrid(Flat& flat)
+        : m_flat(flat)
+        , m_bytes(0)
+        , m_capacity(DefaultCapacity)
+        , m_useCount(0)
+        , m_topLevel(-1)
+        , m_enabled(!flat.m_hasStacks)
+        , m_cycle(0)
+    {
+    }
+
+    // Set the most memory, in bytes, that the entries can take.
+    void SetCapacity(size_t capacity)
+    {
+        m_capacity = capacity;
+        Evict();
+    }
+
+    size_t Capacity() const
+    {
+        return m_capacity;
+    }
+
+    // Forget every entry, for when the grid has been given other programs (see
+    // FlatGrid::LoadPrograms).
+    void Clear()
+    {
+        m_entries.clear();
+        m_table.clear();
+        m_bytes = 0;
+        m_topLevel = -1;
+        Initialize();
+    }
+
+    // Call after FlatGrid::Initialize. The entries are kept, since they still hold for any run.
+    void Initialize()
+    {
+        m_chain.clear();
+        m_cycle = 0;
+        m_spLeaf.reset();
+    }
+
+    // Same as FlatGrid::Step, remembering what the cycle did.
+    void Step()
+    {
+        if (!m_enabled)
+        {
+            m_flat.Step();
+            return;
+        }
+
+        int blockCycle = m_cycle % LeafCycles;
+        if (blockCycle == 0)
+        {
+            m_spLeaf = std::make_shared<Entry>();
+            m_spLeaf->level = LeafLevel;
+            Save(&m_spLeaf->before);
+            m_spLeaf->key = Key(m_spLeaf->before, LeafLevel);
+            std::copy(m_flat.m_position + GridCount, m_flat.m_position + GridCount + MaxIOCount, m_leafPositions);
+        }
+        Entry& leaf = *m_spLeaf;
+
+        // An input that isn't blocked sends its next value in this cycle's write phase, or finds
+        // it has run out; see FlatGrid::InputWrite. Once it has run out, it stays that way.
+        for (int i = 0; i < MaxIOCount; ++i)
+        {
+            int id = GridCount + i;
+            if ((m_flat.m_inputData[id] == nullptr) || (m_flat.m_state[id] != NodeState::Run))
+                continue;
+
+            const std::vector<int>& data = *m_flat.m_inputData[id];
+            size_t position = m_flat.m_position[id];
+            int index = static_cast<int>(position - m_leafPositions[i]);
+            if (position < data.size())
+            {
+                leaf.reads.push_back(InputRead{ i, index, false, data[position] });
+            }
+            else if (std::none_of(leaf.reads.begin(), leaf.reads.end(),
+                [i](const InputRead& read) { return read.end && (read.input == i); }))
+            {
+                leaf.reads.push_back(InputRead{ i, index, true, 0 });
+            }
+        }
+
+        m_flat.m_pOutputLog = &m_outputLog;
+        m_flat.Step();
+        m_flat.m_pOutputLog = nullptr;
+
+        for (const std::pair<int, int>& output : m_outputLog)
+            leaf.events.push_back(OutputEvent{ blockCycle, output.first - GridCount, output.second });
+        m_outputLog.clear();
+
+        ++m_cycle;
+        if (m_cycle % LeafCycles == 0)
+        {
+            Save(&leaf.after);
+            for (int i = 0; i < MaxIOCount; ++i)
+                leaf.advance[i] = m_flat.m_position[GridCount + i] - m_leafPositions[i];
+
+            std::shared_ptr<Entry> spLeaf = std::move(m_spLeaf);
+            Insert(spLeaf);
+            Extend(spLeaf);
+        }
+    }
+
+    // Skip over cycles that the grid has been through before from the same state, with the same
+    // inputs ahead of it, sending the same values to the outputs.
+    //
+    // Formal Parameters:
+    //  maxCycles: the most cycles to run, or negative for no limit.
+    //  isFinished: called after each cycle that sends anything to an output; returns true to stop
+    //              there.
+    //
+    // Returns the number of cycles run. Unless isFinished stopped it, they have exactly the same
+    // effect as calling Step that many times. If it did, the outputs are as they were at the end of
+    // the last cycle, but the rest of the grid may be further on, so it mustn't be stepped again.
+    template <typename IsFinished>
+    int FastForward(int maxCycles, IsFinished isFinished)
+    {
+        if (!m_enabled || (m_cycle % LeafCycles != 0))
+            return 0;
+
+        int cycles = 0;
+        for (;;)
+        {
+            Save(&m_current);
+            const Entry* pEntry = Find(m_current, (maxCycles < 0) ? -1 : (maxCycles - cycles));
+            if (pEntry == nullptr)
+                return cycles;
+
+            Restore(pEntry->after);
+            for (int i = 0; i < MaxIOCount; ++i)
+                m_flat.m_position[GridCount + i] += pEntry->advance[i];
+
+            for (size_t i = 0, n = pEntry->events.size(); i < n; ++i)
+            {
+                const OutputEvent& event = pEntry->events[i];
+                m_flat.m_outputs[GridCount + event.output]->ReadData(event.value);
+
+                if (((i + 1 == n) || (pEntry->events[i + 1].cycle != event.cycle)) && isFinished())
+                {
+                    m_chain.clear();
+                    return cycles + event.cycle + 1;
+                }
+            }
+
+            cycles += 1 << pEntry->level;
+            m_cycle += 1 << pEntry->level;
+            Extend(m_entries.front());
+        }
+    }
+
+private:
+    void Save(GridState* pState) const
+    {
+        m_flat.SaveControl(&pState->control);
+        std::copy(m_flat.m_acc, m_flat.m_acc + GridCount, pState->acc);
+        std::copy(m_flat.m_bak, m_flat.m_bak + GridCount, pState->bak);
+        std::copy(m_flat.m_temp, m_flat.m_temp + GridCount, pState->temp);
+        for (int slot = 0; slot < MaxSlotCount; ++slot)
+            pState->value[slot] = m_flat.m_pending[slot] ? m_flat.m_value[slot] : 0;
+    }
+
+    void Restore(const GridState& state)
+    {
+        m_flat.RestoreControl(state.control);
+        std::copy(std::begin(state.acc), std::end(state.acc), m_flat.m_acc);
+        std::copy(std::begin(state.bak), std::end(state.bak), m_flat.m_bak);
+        std::copy(std::begin(state.temp), std::end(state.temp), m_flat.m_temp);
+        std::copy(std::begin(state.value), std::end(state.value), m_flat.m_value);
+    }
+
+    static bool SameState(const GridState& a, const GridState& b)
+    {
+        return Flat::SameControl(a.control, b.control)
+            && std::equal(std::begin(a.acc), std::end(a.acc), b.acc)
+            && std::equal(std::begin(a.bak), std::end(a.bak), b.bak)
+            && std::equal(std::begin(a.temp), std::end(a.temp), b.temp)
+            && std::equal(std::begin(a.value), std::end(a.value), b.value);
+    }
+
+    // Entries for the same state at different levels go in different buckets.
+    static uint64_t Key(const GridState& state, int level)
+    {
+        uint64_t hash = Flat::HashControl(state.control);
+        Flat::HashWords(&hash, state.acc, sizeof(state.acc));
+        Flat::HashWords(&hash, state.bak, sizeof(state.bak));
+        Flat::HashWords(&hash, state.temp, sizeof(state.temp));
+        Flat::HashWords(&hash, state.value, sizeof(state.value));
+        return hash + static_cast<uint64_t>(level) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    bool ReadsMatch(const Entry& entry) const
+    {
+        for (const InputRead& read : entry.reads)
+        {
+            int id = GridCount + read.input;
+            const std::vector<int>& data = *m_flat.m_inputData[id];
+            size_t position = m_flat.m_position[id] + read.index;
+
+            if (read.end ? (position < data.size()) : ((position >= data.size()) || (data[position] != read.value)))
+                return false;
+        }
+        return true;
+    }
+
+    // Find the longest entry that applies to the grid as it is, and move it to the front of the
+    // list.
+    //
+    // Formal Parameters:
+    //  state: the grid's state.
+    //  maxCycles: the most cycles the entry can cover, or negative for no limit.
+    const Entry* Find(const GridState& state, int maxCycles)
+    {
+        uint64_t key0 = Key(state, 0);
+        for (int level = m_topLevel; level >= LeafLevel; --level)
+        {
+            if ((maxCycles >= 0) && ((1 << level) > maxCycles))
+                continue;
+
+            uint64_t key = key0 + static_cast<uint64_t>(level) * 0x9E3779B97F4A7C15ULL;
+            auto range = m_table.equal_range(key);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const Entry& entry = **it->second;
+                if ((entry.level == level) && SameState(entry.before, state) && ReadsMatch(entry))
+                {
+                    m_entries.splice(m_entries.begin(), m_entries, it->second);
+                    (*it->second)->lastUsed = ++m_useCount;
+                    return &entry;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void Insert(const std::shared_ptr<Entry>& spEntry)
+    {
+        auto range = m_table.equal_range(spEntry->key);
+        if (std::distance(range.first, range.second) >= MaxAlternatives)
+        {
+            auto oldest = std::min_element(range.first, range.second,
+                [](const auto& a, const auto& b) { return (*a.second)->lastUsed < (*b.second)->lastUsed; });
+            Remove(oldest);
+        }
+
+        spEntry->lastUsed = ++m_useCount;
+        m_entries.push_front(spEntry);
+        m_table.emplace(spEntry->key, m_entries.begin());
+        m_bytes += spEntry->Bytes();
+        m_topLevel = std::max(m_topLevel, spEntry->level);
+        Evict();
+    }
+
+    void Remove(typename EntryTable::iterator it)
+    {
+        m_bytes -= (*it->second)->Bytes();
+        m_entries.erase(it->second);
+        m_table.erase(it);
+    }
+
+    void Evict()
+    {
+        while ((m_bytes > m_capacity) && !m_entries.empty())
+        {
+            auto last = std::prev(m_entries.end());
+            auto range = m_table.equal_range((*last)->key);
+            Remove(std::find_if(range.first, range.second, [last](const auto& item) { return item.second == last; }));
+        }
+    }
+
+    // Add an entry for the cycles that were just run to the chain, carrying into longer entries.
+    void Extend(std::shared_ptr<Entry> spEntry)
+    {
+        while (!m_chain.empty() && (m_chain.back()->level == spEntry->level) && (spEntry->level < MaxLevel))
+        {
+            spEntry = Combine(*m_chain.back(), *spEntry);
+            m_chain.pop_back();
+            Insert(spEntry);
+        }
+
+        // A longer entry can't be carried into anything that came before it.
+        if (!m_chain.empty() && (m_chain.back()->level < spEntry->level))
+            m_chain.clear();
+
+        m_chain.push_back(spEntry);
+    }
+
+    // An entry for the cycles of first followed by those of second.
+    static std::shared_ptr<Entry> Combine(const Entry& first, const Entry& second)
+    {
+        std::shared_ptr<Entry> spEntry = std::make_shared<Entry>();
+        Entry& entry = *spEntry;
+        entry.level = first.level + 1;
+        entry.before = first.before;
+        entry.after = second.after;
+        entry.key = Key(entry.before, entry.level);
+
+        for (int i = 0; i < MaxIOCount; ++i)
+            entry.advance[i] = first.advance[i] + second.advance[i];
+
+        // An input that has run out is seen to every cycle from then on; only the first is kept.
+        entry.reads = first.reads;
+        for (const InputRead& read : second.reads)
+        {
+            InputRead shifted = read;
+            shifted.index += static_cast<int>(first.advance[read.input]);
+
+            if (shifted.end && std::any_of(first.reads.begin(), first.reads.end(),
+                [&shifted](const InputRead& earlier) { return earlier.end && (earlier.input == shifted.input); }))
+            {
+                continue;
+            }
+            entry.reads.push_back(shifted);
+        }
+
+        int offset = 1 << first.level;
+        entry.events = first.events;
+        for (const OutputEvent& event : second.events)
+            entry.events.push_back(OutputEvent{ event.cycle + offset, event.output, event.value });
+
+        return spEntry;
+    }
+};
\ No newline at end of file
@@ -2,9 +2,9 @@
 #include "Node.h"
 #include "IOChannel.h"
 
-void INode::Join(INode* nodeA, Neighbor directionOfBRelativeToA, INode* nodeB)
+void INode::Join(IOChannelTable& channels, INode* nodeA, Neighbor directionOfBRelativeToA, INode* nodeB)
 {
-    auto channel = std::make_shared<IOChannel>(nodeA, nodeB);
-    nodeA->SetNeighbor(directionOfBRelativeToA, channel);
-    nodeB->SetNeighbor(OppositeNeighbor(directionOfBRelativeToA), channel);
-}
+    IOChannel* pChannel = channels.Add(nodeA, nodeB);
+    nodeA->SetNeighbor(directionOfBRelativeToA, IOPort(pChannel, 0));
+    nodeB->SetNeighbor(OppositeNeighbor(directionOfBRelativeToA), IOPort(pChannel, 1));
+}
\ No newline at end of file
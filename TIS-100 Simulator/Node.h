@@ -22,14 +22,20 @@ inline Neighbor OppositeNeighbor(Neighbor n)
     }
 }
 
-class IOChannel;
+class IOPort;
+class IOChannelTable;
 
 class INode
 {
 public:
     int NodeId;
 
-    virtual void SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO) = 0;
+    // For Engine::Fused: the cycle in which the node was last stepped (see ChannelClock).
+    uint64_t SteppedCycle;
+
+    virtual ~INode() {}
+
+    virtual void SetNeighbor(Neighbor direction, const IOPort& port) = 0;
     virtual void Initialize() = 0;
     virtual void Read() = 0;
     virtual void Compute() = 0;
@@ -38,8 +44,37 @@ public:
 
     virtual void WriteComplete() = 0;
 
-    static void Join(INode* nodeA, Neighbor directionOfBRelativeToA, INode* nodeB);
+    // Whether Read, Compute, Write and Step would all do nothing until a neighbor either sends this
+    // node a value or accepts the value it is sending.
+    virtual bool IsIdle() const = 0;
+
+    // For Engine::TimeWarp, which rolls nodes back to earlier cycles. SaveState appends everything
+    // about the node that changes as it runs; RestoreState puts it back from there, and returns
+    // where the next node's state starts.
+    virtual void SaveState(std::vector<int>& state) const = 0;
+    virtual const int* RestoreState(const int* state) = 0;
+
+    // Where to record that the node may have work to do again (for Engine::Scheduled).
+    void SetWakeFlag(uint32_t* pWord, uint32_t bit)
+    {
+        m_pWakeWord = pWord;
+        m_wakeBit = bit;
+    }
+
+    // Called by IOChannel when a value is sent to this node, and when its own write completes.
+    void Wake()
+    {
+        if (m_pWakeWord != nullptr)
+            *m_pWakeWord |= m_wakeBit;
+    }
+
+    // Connect two nodes with a new channel from the table.
+    static void Join(IOChannelTable& channels, INode* nodeA, Neighbor directionOfBRelativeToA, INode* nodeB);
 
 protected:
-    INode() : NodeId(-1) {}
+    INode() : NodeId(-1), SteppedCycle(0), m_pWakeWord(nullptr), m_wakeBit(0) {}
+
+private:
+    uint32_t* m_pWakeWord;
+    uint32_t m_wakeBit;
 };
\ No newline at end of file
@@ -1,19 +1,21 @@
 #include "pch.h"
 #include "Node.h"
-#include "OutputBase.h"
 #include "IOChannel.h"
+#include "OutputBase.h"
 
 OutputBase::OutputBase()
+    : m_pReadLog(nullptr)
+    , m_outputIndex(0)
 {}
 
-void OutputBase::SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO)
+void OutputBase::SetNeighbor(Neighbor direction, const IOPort& port)
 {
-    if ((m_spIO != nullptr) && (m_neighborDirection != direction))
+    if (m_port.IsConnected() && (m_neighborDirection != direction))
     {
         throw std::exception("OutputNode can only have one neighbor");
     }
 
-    m_spIO = spIO;
+    m_port = port;
     m_neighborDirection = direction;
 }
 
@@ -22,12 +24,14 @@ void OutputBase::Initialize()
 
 void OutputBase::Read()
 {
-    if (m_spIO != nullptr)
+    if (m_port.IsConnected())
     {
         int value;
-        if (m_spIO->Read(this, &value))
+        if (m_port.Read(&value))
         {
             ReadData(value);
+            if (m_pReadLog != nullptr)
+                m_pReadLog->push_back(OutputRead{ 0, m_outputIndex, value });
         }
     }
 }
@@ -50,4 +54,16 @@ void OutputBase::WriteComplete()
 void OutputBase::Step()
 {
     // Nothing
+}
+
+bool OutputBase::IsIdle() const
+{
+    // Only ever does anything when sent a value.
+    return true;
+}
+
+void OutputBase::SetReadLog(std::vector<OutputRead>* pLog, int index)
+{
+    m_pReadLog = pLog;
+    m_outputIndex = index;
 }
\ No newline at end of file
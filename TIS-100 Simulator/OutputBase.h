@@ -1,20 +1,35 @@
 #pragma once
 
+// A value read by an output, for Engine::TimeWarp (see OutputBase::SetReadLog).
+struct OutputRead
+{
+    uint64_t cycle;
+    int output;
+    int value;
+};
+
 class OutputBase : public INode
 {
 private:
-    std::shared_ptr<IOChannel> m_spIO;
+    IOPort m_port;
     Neighbor m_neighborDirection;
+    std::vector<OutputRead>* m_pReadLog;
+    int m_outputIndex;
 
 public:
     OutputBase();
 
-    virtual void SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO);
+    virtual void SetNeighbor(Neighbor direction, const IOPort& port);
     virtual void Read();
     virtual void Compute();
     virtual void Write();
     virtual void WriteComplete();
     virtual void Step();
+    virtual bool IsIdle() const;
+
+    // For Engine::TimeWarp, which has to know when each output read each value: add each value read
+    // to the log, tagged with index. The cycle is left for whoever owns the log to fill in.
+    void SetReadLog(std::vector<OutputRead>* pLog, int index);
 
     // Subclasses should override these.
     virtual void Initialize();
@@ -1,8 +1,8 @@
 #include "pch.h"
 #include "Node.h"
+#include "IOChannel.h"
 #include "OutputBase.h"
 #include "OutputNode.h"
-#include "IOChannel.h"
 
 OutputNode::OutputNode()
 {}
@@ -17,3 +17,15 @@ void OutputNode::ReadData(int value)
 {
     Data.push_back(value);
 }
+
+void OutputNode::SaveState(std::vector<int>& state) const
+{
+    state.push_back(static_cast<int>(Data.size()));
+    state.insert(state.end(), Data.begin(), Data.end());
+}
+
+const int* OutputNode::RestoreState(const int* state)
+{
+    Data.assign(state + 1, state + 1 + state[0]);
+    return state + 1 + state[0];
+}
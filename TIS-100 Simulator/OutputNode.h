@@ -1,6 +1,6 @@
 #pragma once
 
-class OutputNode : public OutputBase
+class OutputNode final : public OutputBase
 {
 public:
     std::vector<int> Data;
@@ -9,4 +9,6 @@ public:
 
     virtual void Initialize() override;
     virtual void ReadData(int value) override;
+    virtual void SaveState(std::vector<int>& state) const override;
+    virtual const int* RestoreState(const int* state) override;
 };
\ No newline at end of file
@@ -0,0 +1,310 @@
+#include "pch.h"
+#include "Node.h"
+#include "IOChannel.h"
+#include "Engine.h"
+#include "ComputeNode.h"
+#include "StackMemoryNode.h"
+#include "ParallelGrid.h"
+
+ParallelGrid::Barrier::Barrier(int count)
+    : m_count(count)
+    , m_arrived(0)
+    , m_generation(0)
+{
+}
+
+void ParallelGrid::Barrier::Wait()
+{
+    unsigned int generation = m_generation.load(std::memory_order_acquire);
+    if (m_arrived.fetch_add(1, std::memory_order_acq_rel) == m_count - 1)
+    {
+        m_arrived.store(0, std::memory_order_relaxed);
+        m_generation.store(generation + 1, std::memory_order_release);
+        return;
+    }
+
+    for (int spins = 0; m_generation.load(std::memory_order_acquire) == generation; ++spins)
+    {
+        if (spins >= SpinsBeforeYielding)
+            std::this_thread::yield();
+    }
+}
+
+// The most tiles there can be, with no more than threadCount of them, and the shortest boundaries
+// between them.
+int ParallelGrid::TileRows(int width, int height, int threadCount)
+{
+    int bestRows = 1;
+    int bestCount = 0;
+    int bestBoundary = 0;
+    for (int rows = 1; rows <= std::min(threadCount, height); ++rows)
+    {
+        int columns = std::min(threadCount / rows, width);
+        int count = rows * columns;
+        int boundary = (rows - 1) * width + (columns - 1) * height;
+        if ((count > bestCount) || ((count == bestCount) && (boundary < bestBoundary)))
+        {
+            bestRows = rows;
+            bestCount = count;
+            bestBoundary = boundary;
+        }
+    }
+    return bestRows;
+}
+
+// Whether a node can offer a value on more than one port at once, so which of its neighbors gets it
+// depends on the order they read in.
+bool ParallelGrid::OffersOnSeveralPorts(const INode* node)
+{
+    if (dynamic_cast<const StackMemoryNode*>(node) != nullptr)
+        return true;
+
+    const ComputeNode* computeNode = dynamic_cast<const ComputeNode*>(node);
+    if (computeNode == nullptr)
+        return false;
+
+    for (const DecodedInstruction& instr : computeNode->Code())
+    {
+        if (instr.dst == Target::ANY)
+            return true;
+    }
+    return false;
+}
+
+size_t ParallelGrid::FindGroup(std::vector<size_t>& parents, size_t node)
+{
+    while (parents[node] != node)
+    {
+        parents[node] = parents[parents[node]];
+        node = parents[node];
+    }
+    return node;
+}
+
+void ParallelGrid::ReadPhase(const Entry& entry)
+{
+    if (entry.computeNode != nullptr)
+    {
+        entry.computeNode->ThreadedRead();
+    }
+    else
+    {
+        entry.node->Read();
+        entry.node->Compute();
+    }
+}
+
+void ParallelGrid::WritePhase(const Entry& entry)
+{
+    if (entry.computeNode != nullptr)
+    {
+        entry.computeNode->ThreadedWrite();
+    }
+    else
+    {
+        entry.node->Write();
+        entry.node->Step();
+    }
+}
+
+// Keep the first exception thrown on a thread for Step to rethrow, so the threads all stay in step
+// with each other.
+template <typename Function>
+static void RunCatching(std::exception_ptr& error, Function function)
+{
+    try
+    {
+        function();
+    }
+    catch (...)
+    {
+        if (!error)
+            error = std::current_exception();
+    }
+}
+
+// One cycle of a tile, in step with the other tiles. Tile 0 is the main thread's, which also does
+// the read phases of the serial nodes.
+void ParallelGrid::StepTile(size_t index)
+{
+    Tile& tile = m_tiles[index];
+
+    RunCatching(tile.error, [&tile]()
+    {
+        for (const Entry& entry : tile.readNodes)
+            ReadPhase(entry);
+    });
+    m_barrier.Wait();
+
+    if (!m_serialNodes.empty())
+    {
+        if (index == 0)
+        {
+            RunCatching(m_serialError, [this]()
+            {
+                for (const Entry& entry : m_serialNodes)
+                    ReadPhase(entry);
+            });
+        }
+        m_barrier.Wait();
+    }
+
+    RunCatching(tile.error, [&tile]()
+    {
+        for (const Slot& slot : tile.slots)
+            slot.channel->CompleteDeferredWrite(slot.senderSide);
+
+        for (const Entry& entry : tile.writeNodes)
+            WritePhase(entry);
+    });
+    m_barrier.Wait();
+}
+
+void ParallelGrid::Work(size_t index)
+{
+    for (;;)
+    {
+        m_barrier.Wait();
+        if (m_stopping)
+            return;
+
+        StepTile(index);
+    }
+}
+
+ParallelGrid::ParallelGrid(
+    int width,
+    int height,
+    int threadCount,
+    const std::vector<INode*>& grid,
+    const std::vector<INode*>& nodes,
+    IOChannelTable& channels
+    )
+    : m_tileRows(TileRows(width, height, threadCount))
+    , m_tileColumns(std::min(threadCount / m_tileRows, width))
+    , m_tiles(m_tileRows * m_tileColumns)
+    , m_barrier(m_tileRows * m_tileColumns)
+    , m_stopping(false)
+{
+    // Grid nodes are in the tile that covers them, and inputs and outputs are in the tile of the
+    // node they're joined to.
+    std::unordered_map<const INode*, int> tileOf;
+    for (int index = 0; index < width * height; ++index)
+    {
+        int row = index / width;
+        int column = index % width;
+        tileOf[grid[index]] = (row * m_tileRows / height) * m_tileColumns + column * m_tileColumns / width;
+    }
+
+    IOChannel* channelArray = channels.Channels();
+    for (size_t i = 0; i < channels.Count(); ++i)
+    {
+        for (int side = 0; side < 2; ++side)
+        {
+            if (tileOf.find(channelArray[i].Node(side)) == tileOf.end())
+                tileOf[channelArray[i].Node(side)] = tileOf.at(channelArray[i].Node(side ^ 1));
+        }
+    }
+
+    // Group each node that offers on several ports with its neighbors.
+    std::unordered_map<const INode*, size_t> order;
+    for (size_t i = 0; i < nodes.size(); ++i)
+        order[nodes[i]] = i;
+
+    std::vector<size_t> parents(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+        parents[i] = i;
+
+    for (size_t i = 0; i < channels.Count(); ++i)
+    {
+        auto a = order.find(channelArray[i].Node(0));
+        auto b = order.find(channelArray[i].Node(1));
+        if ((a == order.end()) || (b == order.end()))
+            continue;
+
+        if (OffersOnSeveralPorts(a->first) || OffersOnSeveralPorts(b->first))
+            parents[FindGroup(parents, a->second)] = FindGroup(parents, b->second);
+    }
+
+    constexpr int NoTile = -2;
+    constexpr int SeveralTiles = -1;
+    std::vector<int> groupTiles(nodes.size(), NoTile);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        int& groupTile = groupTiles[FindGroup(parents, i)];
+        int tile = tileOf.at(nodes[i]);
+        if (groupTile == NoTile)
+            groupTile = tile;
+        else if (groupTile != tile)
+            groupTile = SeveralTiles;
+    }
+
+    std::vector<bool> serial(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        serial[i] = (groupTiles[FindGroup(parents, i)] == SeveralTiles);
+
+        Entry entry = { nodes[i], dynamic_cast<ComputeNode*>(nodes[i]) };
+        Tile& tile = m_tiles[tileOf.at(nodes[i])];
+        tile.writeNodes.push_back(entry);
+        if (serial[i])
+            m_serialNodes.push_back(entry);
+        else
+            tile.readNodes.push_back(entry);
+    }
+
+    // Channels between serial nodes are only read from on the main thread, so they don't need to be
+    // deferred.
+    for (size_t i = 0; i < channels.Count(); ++i)
+    {
+        IOChannel& channel = channelArray[i];
+        auto a = order.find(channel.Node(0));
+        auto b = order.find(channel.Node(1));
+        if ((a == order.end()) || (b == order.end()))
+            continue;
+
+        if ((tileOf.at(a->first) == tileOf.at(b->first)) || (serial[a->second] && serial[b->second]))
+            continue;
+
+        for (int side = 0; side < 2; ++side)
+        {
+            channel.DeferCompletion(side, true);
+            m_tiles[tileOf.at(channel.Node(side))].slots.push_back(Slot{ &channel, side });
+        }
+    }
+
+    for (size_t index = 1; index < m_tiles.size(); ++index)
+        m_threads.emplace_back(&ParallelGrid::Work, this, index);
+}
+
+ParallelGrid::~ParallelGrid()
+{
+    m_stopping = true;
+    m_barrier.Wait();
+    for (std::thread& thread : m_threads)
+        thread.join();
+
+    for (const Tile& tile : m_tiles)
+    {
+        for (const Slot& slot : tile.slots)
+            slot.channel->DeferCompletion(slot.senderSide, false);
+    }
+}
+
+void ParallelGrid::Step()
+{
+    m_barrier.Wait();
+    StepTile(0);
+
+    std::exception_ptr error = m_serialError;
+    m_serialError = nullptr;
+    for (Tile& tile : m_tiles)
+    {
+        if (!error)
+            error = tile.error;
+        tile.error = nullptr;
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+// Steps a grid on several threads at once, for Engine::Parallel. The grid is split into
+// rectangular tiles, one per thread, and each cycle every thread does the read phase of its own
+// tile's nodes, waits for the others, and then does their write phase.
+//
+// The results are exactly those of stepping the nodes one after another, in the order
+// ComputeGrid::ForEachNode steps them. In the write phase, nodes only touch their own side of their
+// channels, so the order doesn't matter. In the read phase, it only matters around a node that
+// offers its value on more than one port at once (a compute node writing to ANY, or a stack node):
+// the first of its neighbors to read gets the value. Each such node is grouped with its neighbors,
+// and where a group spans more than one tile, its nodes do their read phases on one thread, in the
+// usual order, once the tiles have done the rest.
+//
+// Any other value sent across a tile boundary has only one node that can read it, and its sender
+// does nothing in the read phase while it waits. So the reader takes the value straight away, but
+// the sender isn't told until the write phase, by its own thread (see IOChannel::DeferCompletion).
+// Each side of a channel between tiles is a slot with one thread setting it and one clearing it,
+// and the barrier between the phases orders the two, so neither has to lock anything.
+class ParallelGrid
+{
+private:
+    // The threads wait here between the phases of a cycle. Phases are short, so it spins instead
+    // of sleeping, but yields after a while in case there are more threads than cores.
+    class Barrier
+    {
+    private:
+        static constexpr int SpinsBeforeYielding = 1000;
+
+        int m_count;
+        std::atomic<int> m_arrived;
+        std::atomic<unsigned int> m_generation;
+
+    public:
+        explicit Barrier(int count);
+        void Wait();
+    };
+
+    struct Entry
+    {
+        INode* node;
+        ComputeNode* computeNode;
+    };
+
+    // The sending side of a channel to another tile (see IOChannel::DeferCompletion).
+    struct Slot
+    {
+        IOChannel* channel;
+        int senderSide;
+    };
+
+    struct Tile
+    {
+        std::vector<Entry> readNodes; // the tile's nodes, less the ones in m_serialNodes
+        std::vector<Entry> writeNodes; // all of the tile's nodes
+        std::vector<Slot> slots; // the sending sides of the tile's nodes' channels to other tiles
+        std::exception_ptr error;
+    };
+
+    int m_tileRows;
+    int m_tileColumns;
+    std::vector<Tile> m_tiles;
+
+    // Nodes in groups that span tiles, which the main thread does the read phases of.
+    std::vector<Entry> m_serialNodes;
+    std::exception_ptr m_serialError;
+
+    Barrier m_barrier;
+    bool m_stopping;
+    std::vector<std::thread> m_threads;
+
+    static void ReadPhase(const Entry& entry);
+    static void WritePhase(const Entry& entry);
+
+    void StepTile(size_t index);
+    void Work(size_t index);
+
+public:
+    // How the grid is split up, which TimeWarpGrid does the same way.
+    static int TileRows(int width, int height, int threadCount);
+    static bool OffersOnSeveralPorts(const INode* node);
+    static size_t FindGroup(std::vector<size_t>& parents, size_t node);
+
+    // Formal Parameters:
+    //  width, height: the size of the grid.
+    //  threadCount: the most threads to step it on, counting the one that calls Step.
+    //  grid: the grid's nodes, by index.
+    //  nodes: the nodes that can do anything, in the order they step in.
+    //  channels: the channels joining all of those nodes.
+    ParallelGrid(
+        int width,
+        int height,
+        int threadCount,
+        const std::vector<INode*>& grid,
+        const std::vector<INode*>& nodes,
+        IOChannelTable& channels
+        );
+
+    ParallelGrid(const ParallelGrid&) = delete;
+    ParallelGrid& operator=(const ParallelGrid&) = delete;
+
+    ~ParallelGrid();
+
+    size_t TileCount() const { return m_tiles.size(); }
+    size_t SerialNodeCount() const { return m_serialNodes.size(); }
+
+    void Step();
+};
\ No newline at end of file
@@ -1,13 +1,28 @@
 #pragma once
 
-template <int NodeCount>
-class PuzzleBase
+class Puzzle
 {
 public:
-    // Assembly code text for the ComputeNodes.
+    // Formal Parameters:
+    //  width, height: the size of the grid of nodes. The game's puzzles are all NodeGridWidth by
+    //                 NodeGridHeight; synthetic ones can be any size.
+    Puzzle(int width, int height)
+        : width(width)
+        , height(height)
+        , programs(width * height)
+        , visualizationWidth(0)
+        , visualizationHeight(0)
+    {
+    }
+
+    // The number of nodes across and down the grid. Nodes are indexed across each row in turn,
+    // starting from the top.
+    int width, height;
+
+    // Assembly code text for the ComputeNodes, by node index.
     // There needs to be a corresponding ComputeNode at the same index, otherwise the program will
     // not be applied.
-    std::string programs[NodeCount];
+    std::vector<std::string> programs;
 
     struct IO
     {
@@ -34,7 +49,18 @@ public:
     std::set<int> stackNodes;
 };
 
-PuzzleBase<12> GetPuzzle(
+Puzzle GetPuzzle(
     int puzzleNumber,
     std::string& puzzleName
+    );
+
+Puzzle GetSyntheticPuzzle(
+    int width,
+    int height,
+    std::string& puzzleName
+    );
+
+Puzzle GetCheckPuzzle(
+    int index,
+    std::string& puzzleName
     );
\ No newline at end of file
@@ -0,0 +1,211 @@
+#pragma once
+
+// The fixed shape of each built-in puzzle: which nodes are bad or stack memory, and where its
+// inputs, outputs and visualization attach. Everything else about a puzzle, like its data and the
+// programs in a save file, is only known at runtime.
+//
+// FlatGrid::StepLayout is generated from these at compile time, for Engine::Specialized. They have
+// to agree with GetPuzzle; a grid only uses a layout that exactly matches the puzzle it was built
+// from, so a puzzle without one just runs like Engine::Flat.
+
+static constexpr int MaxLayoutIOCount = 4;
+
+// Where an input or output attaches; see PuzzleBase::IO.
+struct LayoutIO
+{
+    int toNode;
+    Neighbor direction;
+};
+
+struct PuzzleLayout
+{
+    // Bitmasks of grid indices.
+    uint32_t badNodes;
+    uint32_t stackNodes;
+
+    // In the same order as the puzzle's, since that's the order nodes are numbered in.
+    int inputCount;
+    LayoutIO inputs[MaxLayoutIOCount];
+    int outputCount;
+    LayoutIO outputs[MaxLayoutIOCount];
+    int visualizationCount;
+    LayoutIO visualization[MaxLayoutIOCount];
+};
+
+template <const PuzzleLayout&... Layouts>
+struct PuzzleLayoutList
+{
+};
+
+constexpr uint32_t NodeBits(std::initializer_list<int> nodes)
+{
+    uint32_t bits = 0;
+    for (int node : nodes)
+        bits |= 1U << node;
+    return bits;
+}
+
+// [simulator debug] Visualization Node Test
+static constexpr PuzzleLayout s_layoutVisualizationTest = {
+    NodeBits({}), NodeBits({}),
+    0, {},
+    0, {},
+    1, { { 0, Neighbor::UP } },
+};
+
+// [simulator debug] Stack Memory Test
+static constexpr PuzzleLayout s_layoutStackTest = {
+    NodeBits({}), NodeBits({ 1 }),
+    1, { { 0, Neighbor::UP } },
+    1, { { 2, Neighbor::UP } },
+    0, {},
+};
+
+// [simulator debug] Connectivity Check
+static constexpr PuzzleLayout s_layoutConnectivityCheck = {
+    NodeBits({}), NodeBits({}),
+    1, { { 1, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Self-Test Diagnostic
+static constexpr PuzzleLayout s_layout150 = {
+    NodeBits({ 1, 5, 7, 9 }), NodeBits({}),
+    2, { { 0, Neighbor::UP }, { 3, Neighbor::UP } },
+    2, { { 8, Neighbor::DOWN }, { 11, Neighbor::DOWN } },
+    0, {},
+};
+
+// Signal Amplifier
+static constexpr PuzzleLayout s_layout10981 = {
+    NodeBits({ 3, 8 }), NodeBits({}),
+    1, { { 1, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Differential Converter
+static constexpr PuzzleLayout s_layout20176 = {
+    NodeBits({ 7 }), NodeBits({}),
+    2, { { 1, Neighbor::UP }, { 2, Neighbor::UP } },
+    2, { { 9, Neighbor::DOWN }, { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Signal Comparator
+static constexpr PuzzleLayout s_layout21340 = {
+    NodeBits({ 5, 6, 7 }), NodeBits({}),
+    1, { { 0, Neighbor::UP } },
+    3, { { 9, Neighbor::DOWN }, { 10, Neighbor::DOWN }, { 11, Neighbor::DOWN } },
+    0, {},
+};
+
+// Signal Multiplexer
+static constexpr PuzzleLayout s_layout22280 = {
+    NodeBits({ 8 }), NodeBits({}),
+    3, { { 1, Neighbor::UP }, { 2, Neighbor::UP }, { 3, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Sequence Generator
+static constexpr PuzzleLayout s_layout30647 = {
+    NodeBits({ 9 }), NodeBits({}),
+    2, { { 1, Neighbor::UP }, { 2, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Sequence Counter
+static constexpr PuzzleLayout s_layout31904 = {
+    NodeBits({ 3 }), NodeBits({}),
+    1, { { 1, Neighbor::UP } },
+    2, { { 9, Neighbor::DOWN }, { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Signal Edge Detector
+static constexpr PuzzleLayout s_layout32050 = {
+    NodeBits({ 8 }), NodeBits({}),
+    1, { { 1, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Interrupt Handler
+static constexpr PuzzleLayout s_layout33762 = {
+    NodeBits({ 8 }), NodeBits({}),
+    4, { { 0, Neighbor::UP }, { 1, Neighbor::UP }, { 2, Neighbor::UP }, { 3, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Signal Pattern Detector
+static constexpr PuzzleLayout s_layout40196 = {
+    NodeBits({ 3 }), NodeBits({}),
+    1, { { 1, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Sequence Peak Detector
+static constexpr PuzzleLayout s_layout41427 = {
+    NodeBits({ 7 }), NodeBits({}),
+    1, { { 1, Neighbor::UP } },
+    2, { { 9, Neighbor::DOWN }, { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Sequence Reverser
+static constexpr PuzzleLayout s_layout42656 = {
+    NodeBits({ 8 }), NodeBits({ 2, 9 }),
+    1, { { 1, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Signal Multiplier
+static constexpr PuzzleLayout s_layout43786 = {
+    NodeBits({ 8 }), NodeBits({ 4, 7 }),
+    2, { { 1, Neighbor::UP }, { 2, Neighbor::UP } },
+    1, { { 10, Neighbor::DOWN } },
+    0, {},
+};
+
+// Image Test Pattern 1
+static constexpr PuzzleLayout s_layout50370 = {
+    NodeBits({ 4 }), NodeBits({}),
+    0, {},
+    0, {},
+    1, { { 10, Neighbor::DOWN } },
+};
+
+// Image Test Pattern 2
+static constexpr PuzzleLayout s_layout51781 = {
+    NodeBits({ 0 }), NodeBits({}),
+    0, {},
+    0, {},
+    1, { { 10, Neighbor::DOWN } },
+};
+
+typedef PuzzleLayoutList<
+    s_layoutVisualizationTest,
+    s_layoutStackTest,
+    s_layoutConnectivityCheck,
+    s_layout150,
+    s_layout10981,
+    s_layout20176,
+    s_layout21340,
+    s_layout22280,
+    s_layout30647,
+    s_layout31904,
+    s_layout32050,
+    s_layout33762,
+    s_layout40196,
+    s_layout41427,
+    s_layout42656,
+    s_layout43786,
+    s_layout50370,
+    s_layout51781
+> BuiltInPuzzleLayouts;
\ No newline at end of file
@@ -63,7 +63,7 @@ Puzzle GetPuzzle(
     std::string& puzzleName
     )
 {
-    Puzzle puzzle;
+    Puzzle puzzle(NodeGridWidth, NodeGridHeight);
 
     puzzle.visualizationHeight = VisualizationHeight;
     puzzle.visualizationWidth = VisualizationWidth;
@@ -584,5 +584,185 @@ Puzzle GetPuzzle(
         throw std::exception("Unknown puzzle number.");
     }
 
+    return puzzle;
+}
+
+// Generate a puzzle for scaling studies, with a grid of any size and a program already in every
+// node: each column passes values from an input at the top to an output at the bottom, adding one
+// in every node on the way.
+//
+// Formal Parameters:
+//  width, height: the size of the grid, in nodes.
+//  puzzleName: is set to the name of the puzzle.
+//
+// Returns the puzzle, with new random inputs each time.
+Puzzle GetSyntheticPuzzle(
+    int width,
+    int height,
+    std::string& puzzleName
+    )
+{
+    if ((width < 1) || (height < 1))
+        throw std::exception("A synthetic grid needs at least one node.");
+
+    Puzzle puzzle(width, height);
+    puzzleName = "[synthetic] Pipeline " + std::to_string(width) + "x" + std::to_string(height);
+
+    for (std::string& program : puzzle.programs)
+        program = "MOV UP,ACC\nADD 1\nMOV ACC,DOWN";
+
+    for (int col = 0; col < width; ++col)
+    {
+        puzzle.inputs.push_back(Puzzle::IO{ col, Neighbor::UP, RandomGenerator(PuzzleInputSize, 10, 100) });
+        puzzle.outputs.push_back(Puzzle::IO{ (height - 1) * width + col, Neighbor::DOWN,
+            PuzzleInputSimpleGenerator(puzzle.inputs[col], [height](int value) { return value + height; }) });
+    }
+
+    return puzzle;
+}
+
+// The grids GetCheckPuzzle builds by hand, each with inputs along the top and outputs along the
+// bottom. With four threads, a 4x4 grid is split into four 2x2 tiles or regions, so the nodes in the
+// middle two rows and columns all sit on a border.
+static const struct
+{
+    const char* name;
+    const char* programs[16];
+} s_checkGrids[] = {
+    // Nodes writing to ANY on a border, so that which neighbor gets each value depends on the order
+    // they read in, and nodes reading from ANY on a border, with neighbors in other tiles writing to
+    // them.
+    { "ANY at borders", {
+        "MOV UP,ANY", "MOV UP,ANY", "MOV UP,ANY", "MOV UP,ANY",
+        "MOV ANY,ACC\nADD 1\nMOV ACC,ANY", "MOV ANY,ACC\nMOV ACC,DOWN", "MOV ANY,ACC\nMOV ACC,DOWN", "MOV ANY,ACC\nSUB 1\nMOV ACC,ANY",
+        "MOV ANY,ACC\nMOV ACC,RIGHT", "MOV ANY,ACC\nADD 10\nMOV ACC,ANY", "MOV ANY,ACC\nADD 20\nMOV ACC,ANY", "MOV ANY,ACC\nMOV ACC,LEFT",
+        "MOV ANY,DOWN", "MOV ANY,DOWN", "MOV ANY,DOWN", "MOV ANY,DOWN",
+    } },
+
+    // Nodes going back with LAST to whichever neighbor across a border they last used with ANY.
+    { "LAST at borders", {
+        "MOV UP,ACC\nMOV ACC,DOWN", "MOV UP,ANY\nMOV LAST,DOWN", "MOV UP,ANY\nMOV LAST,DOWN", "MOV UP,ACC\nMOV ACC,DOWN",
+        "MOV UP,ACC\nMOV ACC,ANY\nMOV ACC,DOWN", "MOV ANY,ACC\nMOV ACC,LAST\nMOV UP,DOWN", "MOV ANY,ACC\nMOV ACC,LAST\nMOV UP,DOWN", "MOV UP,ACC\nMOV ACC,ANY\nMOV ACC,DOWN",
+        "MOV UP,ACC\nMOV ACC,RIGHT\nMOV LEFT,DOWN", "MOV ANY,ACC\nADD LAST\nMOV ACC,ANY\nMOV ACC,DOWN", "MOV ANY,ACC\nSUB LAST\nMOV ACC,ANY\nMOV ACC,DOWN", "MOV UP,ACC\nMOV ACC,LEFT\nMOV RIGHT,DOWN",
+        "MOV UP,DOWN", "MOV ANY,ACC\nMOV ACC,DOWN", "MOV ANY,ACC\nMOV ACC,DOWN", "MOV UP,DOWN",
+    } },
+
+    // A node reading from ANY beside an output, so that its region runs ahead on the values from its
+    // own side, and rolls back whenever one from across the border turns up for a cycle it has already
+    // run. What it has passed back across the border by then has to be cancelled.
+    { "Rollbacks", {
+        "", "", "", "",
+        "", "", "ADD 10\nMOV ACC,DOWN", "",
+        "", "ADD 1\nNOP\nNOP\nMOV ACC,RIGHT", "MOV ANY,DOWN", "SUB 1\nNOP\nMOV ACC,LEFT",
+        "", "MOV RIGHT,DOWN", "MOV UP,ACC\nMOV ACC,DOWN\nMOV ACC,LEFT", "",
+    } },
+
+    // Values going both ways across a border, so that two regions take each other's values in the same
+    // cycle.
+    { "Values both ways", {
+        "", "ADD 1\nMOV ACC,RIGHT", "MOV LEFT,NIL", "",
+        "", "MOV RIGHT,DOWN", "SUB 1\nMOV ACC,LEFT", "",
+        "", "MOV UP,DOWN", "", "",
+        "", "MOV UP,DOWN", "", "",
+    } },
+};
+
+static constexpr int CheckGridCount = sizeof(s_checkGrids) / sizeof(s_checkGrids[0]);
+
+// How many times over GetCheckPuzzle gives each of s_checkGrids, since whether they go wrong under
+// Engine::TimeWarp can depend on how its threads happen to be scheduled.
+static constexpr int CheckGridRuns = 8;
+
+// A random instruction for GetCheckPuzzle, with ports (ANY and LAST most of all) far more often than
+// a real solution would have them.
+static std::string RandomCheckInstruction(int length)
+{
+    static const char* const sources[] = { "ANY", "ANY", "ANY", "ANY", "LAST", "UP", "DOWN", "LEFT", "RIGHT", "ACC" };
+    static const char* const destinations[] = { "ANY", "ANY", "ANY", "LAST", "DOWN", "DOWN", "UP", "LEFT", "RIGHT", "ACC", "NIL" };
+    static const char* const jumps[] = { "JMP", "JEZ", "JNZ", "JGZ", "JLZ" };
+
+    auto pick = [](int count) { return std::uniform_int_distribution<int>(0, count - 1)(g_RandomEngine); };
+    auto source = [&]()
+    {
+        return (pick(8) == 0) ? std::to_string(pick(21) - 10) : std::string(sources[pick(10)]);
+    };
+
+    switch (pick(12))
+    {
+    case 0:
+        return "ADD " + source();
+    case 1:
+        return "SUB " + source();
+    case 2:
+        return (pick(2) == 0) ? "SWP" : "SAV";
+    case 3:
+        return std::string(jumps[pick(5)]) + " L" + std::to_string(pick(length));
+    case 4:
+        return "JRO " + source();
+    default:
+        return "MOV " + source() + "," + destinations[pick(11)];
+    }
+}
+
+// Generate a puzzle for checking that an engine does exactly what the interpreter does (see
+// CheckEngine). The first few are grids built by hand around the borders between the tiles or
+// regions that Engine::Parallel and Engine::TimeWarp split a grid into, each several times over; the
+// rest are random grids of random programs. The outputs' expected data is left empty, for the caller
+// to fill in.
+//
+// Formal Parameters:
+//  index: which puzzle to generate; the same index always gives the same puzzle.
+//  puzzleName: is set to the name of the puzzle.
+//
+// Returns the puzzle.
+Puzzle GetCheckPuzzle(
+    int index,
+    std::string& puzzleName
+    )
+{
+    std::seed_seq seed = { index };
+    g_RandomEngine.seed(seed);
+    auto pick = [](int count) { return std::uniform_int_distribution<int>(0, count - 1)(g_RandomEngine); };
+
+    bool handBuilt = (index < CheckGridCount * CheckGridRuns);
+    int width = handBuilt ? 4 : 2 + pick(6);
+    int height = handBuilt ? 4 : 2 + pick(6);
+    Puzzle puzzle(width, height);
+
+    if (handBuilt)
+    {
+        puzzleName = std::string("[check] ") + s_checkGrids[index % CheckGridCount].name;
+        for (int node = 0; node < width * height; ++node)
+            puzzle.programs[node] = s_checkGrids[index % CheckGridCount].programs[node];
+    }
+    else
+    {
+        puzzleName = "[check] Random " + std::to_string(width) + "x" + std::to_string(height);
+        for (int node = 0; node < width * height; ++node)
+        {
+            // A few nodes are stack nodes, or left empty.
+            int kind = pick(10);
+            if (kind == 0)
+                puzzle.stackNodes.insert(node);
+            if (kind <= 1)
+                continue;
+
+            int length = 1 + pick(5);
+            for (int line = 0; line < length; ++line)
+                puzzle.programs[node] += "L" + std::to_string(line) + ": " + RandomCheckInstruction(length) + "\n";
+            puzzle.programs[node] += "MOV ACC,ANY\n";
+
+            // Whatever reaches the bottom row is sent on to the outputs.
+            if (node >= (height - 1) * width)
+                puzzle.programs[node] += "MOV ANY,DOWN\n";
+        }
+    }
+
+    for (int column = 0; column < width; ++column)
+    {
+        puzzle.inputs.push_back(Puzzle::IO{ column, Neighbor::UP, RandomGenerator(PuzzleInputSize, -100, 100) });
+        puzzle.outputs.push_back(Puzzle::IO{ (height - 1) * width + column, Neighbor::DOWN, {} });
+    }
+
     return puzzle;
 }
\ No newline at end of file
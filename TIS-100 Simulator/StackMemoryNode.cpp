@@ -1,7 +1,7 @@
 #include "pch.h"
 #include "Node.h"
-#include "StackMemoryNode.h"
 #include "IOChannel.h"
+#include "StackMemoryNode.h"
 #include <assert.h>
 
 StackMemoryNode::StackMemoryNode()
@@ -9,31 +9,40 @@ StackMemoryNode::StackMemoryNode()
     , m_neighbors()
 {}
 
-void StackMemoryNode::SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO)
+void StackMemoryNode::SetNeighbor(Neighbor direction, const IOPort& port)
 {
-    m_neighbors[static_cast<size_t>(direction)] = spIO;
+    m_neighbors[static_cast<size_t>(direction)] = port;
 }
 
 void StackMemoryNode::Initialize()
 {
     m_data.clear();
+    m_writeReady = true;
+
+    // Withdraw any value still on offer from the previous run, or a reader would pop the now-empty
+    // stack.
+    for (IOPort& port : m_neighbors)
+    {
+        if (port.IsConnected())
+            port.CancelWrite();
+    }
 }
 
 void StackMemoryNode::Read()
 {
     for (size_t i = 0; i < static_cast<size_t>(Neighbor::COUNT); ++i)
     {
-        std::shared_ptr<IOChannel>& spIO = m_neighbors[i];
-        if (spIO != nullptr)
+        IOPort& port = m_neighbors[i];
+        if (port.IsConnected())
         {
             int value;
-            if (spIO->Read(this, &value))
+            if (port.Read(&value))
             {
                 m_data.push_back(value);
-                for (const std::shared_ptr<IOChannel>& spIO : m_neighbors)
+                for (IOPort& other : m_neighbors)
                 {
-                    if (spIO != nullptr)
-                        spIO->CancelWrite(this);
+                    if (other.IsConnected())
+                        other.CancelWrite();
                 }
 
                 m_writeReady = true;
@@ -59,10 +68,10 @@ void StackMemoryNode::Write()
     int value = m_data.back();
     for (size_t i = 0; i < static_cast<size_t>(Neighbor::COUNT); ++i)
     {
-        std::shared_ptr<IOChannel>& spIO = m_neighbors[i];
-        if (spIO != nullptr)
+        IOPort& port = m_neighbors[i];
+        if (port.IsConnected())
         {
-            spIO->Write(this, value);
+            port.Write(value);
 
             if (m_writeReady)
             {
@@ -79,10 +88,10 @@ void StackMemoryNode::WriteComplete()
     m_data.pop_back();
     for (size_t i = 0; i < static_cast<size_t>(Neighbor::COUNT); ++i)
     {
-        std::shared_ptr<IOChannel>& spIO = m_neighbors[i];
-        if (spIO != nullptr)
+        IOPort& port = m_neighbors[i];
+        if (port.IsConnected())
         {
-            spIO->CancelWrite(this);
+            port.CancelWrite();
         }
     }
 
@@ -92,4 +101,31 @@ void StackMemoryNode::WriteComplete()
 void StackMemoryNode::Step()
 {
     // Nothing.
+}
+
+bool StackMemoryNode::IsIdle() const
+{
+    // Only one value is read per cycle, so any others sent at the same time are still waiting.
+    for (const IOPort& port : m_neighbors)
+    {
+        if (port.IsConnected() && port.HasValue())
+            return false;
+    }
+
+    // Nothing to offer, or the top value is already on offer.
+    return !m_writeReady || m_data.empty();
+}
+
+void StackMemoryNode::SaveState(std::vector<int>& state) const
+{
+    state.push_back(m_writeReady ? 1 : 0);
+    state.push_back(static_cast<int>(m_data.size()));
+    state.insert(state.end(), m_data.begin(), m_data.end());
+}
+
+const int* StackMemoryNode::RestoreState(const int* state)
+{
+    m_writeReady = (state[0] != 0);
+    m_data.assign(state + 2, state + 2 + state[1]);
+    return state + 2 + state[1];
 }
\ No newline at end of file
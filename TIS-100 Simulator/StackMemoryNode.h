@@ -1,15 +1,15 @@
 #pragma once
 
-class StackMemoryNode : public INode
+class StackMemoryNode final : public INode
 {
 private:
     bool m_writeReady;
-    std::shared_ptr<IOChannel> m_neighbors[static_cast<size_t>(Neighbor::COUNT)];
+    IOPort m_neighbors[static_cast<size_t>(Neighbor::COUNT)];
     std::vector<int> m_data;
 
 public:
     StackMemoryNode();
-    virtual void SetNeighbor(Neighbor direction, std::shared_ptr<IOChannel>& spIO);
+    virtual void SetNeighbor(Neighbor direction, const IOPort& port);
     virtual void Initialize();
 
     virtual void Read();
@@ -17,4 +17,7 @@ public:
     virtual void Write();
     virtual void WriteComplete();
     virtual void Step();
+    virtual bool IsIdle() const;
+    virtual void SaveState(std::vector<int>& state) const;
+    virtual const int* RestoreState(const int* state);
 };
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include "pch.h"
+#include "Node.h"
+#include "IOChannel.h"
+#include "Engine.h"
+#include "ComputeNode.h"
+#include "Superinstructions.h"
+#include "SuperinstructionMiner.h"
+
+static const char* const s_opcodeNames[] = {
+    "Indeterminate", "NOP", "MOV", "ADD", "SUB", "SAV", "SWP", "JMP", "JEZ", "JNZ", "JGZ", "JLZ", "JRO", "HCF",
+};
+
+static const char* const s_targetNames[] = {
+    "None", "NIL", "ACC", "UP", "DOWN", "LEFT", "RIGHT", "ANY", "LAST",
+};
+
+// An instruction of the given shape, as it would be written in a program.
+static std::string ShapeToAssembly(uint32_t shape)
+{
+    Opcode op = ShapeOpcode(shape);
+    std::string text = s_opcodeNames[static_cast<size_t>(op)];
+
+    Target src = ShapeSource(shape);
+    if ((op == Opcode::MOV) || (op == Opcode::ADD) || (op == Opcode::SUB) || (op == Opcode::JRO))
+        text += (src == Target::None) ? " <value>" : std::string(" ") + s_targetNames[static_cast<size_t>(src)];
+    else if (IsJumpShape(shape))
+        text += " <label>";
+
+    if (op == Opcode::MOV)
+        text += std::string(", ") + s_targetNames[static_cast<size_t>(ShapeDestination(shape))];
+
+    return text;
+}
+
+// The expression for a shape in C++.
+static std::string ShapeToSource(uint32_t shape)
+{
+    std::stringstream out;
+    out << "InstructionShape(Opcode::" << s_opcodeNames[static_cast<size_t>(ShapeOpcode(shape))]
+        << ", Target::" << s_targetNames[static_cast<size_t>(ShapeSource(shape))]
+        << ", Target::" << s_targetNames[static_cast<size_t>(ShapeDestination(shape))] << ")";
+    return out.str();
+}
+
+SuperinstructionMiner::SuperinstructionMiner()
+    : m_programCount(0)
+    , m_instructionCount(0)
+    , m_fusedInstructionCount(0)
+{
+}
+
+void SuperinstructionMiner::AddProgram(
+    const std::vector<DecodedInstruction>& code,
+    const std::vector<uint64_t>& startCounts,
+    uint64_t fusedCount
+    )
+{
+    ++m_programCount;
+    m_fusedInstructionCount += fusedCount;
+
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        m_instructionCount += startCounts[pc];
+        if (startCounts[pc] == 0)
+            continue;
+
+        // None of the instructions in a run can jump until the last, so starting the first one
+        // means running all of them.
+        std::vector<uint32_t> shapes;
+        for (size_t length = 1; length <= MaxSuperinstructionLength; ++length)
+        {
+            shapes.push_back(InstructionShape(code[(pc + length - 1) % code.size()]));
+            if (length < 2)
+                continue;
+
+            if (!IsFusableRun(code, pc, length))
+                break;
+
+            m_runCounts[shapes] += startCounts[pc];
+        }
+    }
+}
+
+void SuperinstructionMiner::Report(std::ostream& out) const
+{
+    double percentage = (m_instructionCount == 0)
+        ? 0.0
+        : (100.0 * m_fusedInstructionCount / m_instructionCount);
+
+    out << m_programCount << " programs ran " << m_instructionCount << " instructions, "
+        << m_fusedInstructionCount << " (" << percentage << "%) of them in superinstructions.\n";
+}
+
+void SuperinstructionMiner::WriteHeader(std::ostream& out, size_t count) const
+{
+    // Each run saves one handler call per instruction after the first.
+    std::vector<std::pair<uint64_t, const std::vector<uint32_t>*>> ranked;
+    for (const auto& pair : m_runCounts)
+        ranked.emplace_back(pair.second * (pair.first.size() - 1), &pair.first);
+
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    if (ranked.size() > count)
+        ranked.resize(count);
+
+    out << "#pragma once\n"
+        "\n"
+        "// Generated with -superinstructions from " << m_programCount << " programs, which ran "
+        << m_instructionCount << " instructions.\n"
+        "// Each superinstruction is listed with the number of handler calls it would have saved them.\n"
+        "// Save this as MinedSuperinstructions.h and build with USE_MINED_SUPERINSTRUCTIONS defined to\n"
+        "// fuse these instead of CommonSuperinstructions; -superinstructions then reports how many\n"
+        "// instructions they cover. Measure before adding any to CommonSuperinstructions.\n"
+        "\n"
+        "typedef SuperinstructionList<";
+
+    for (size_t i = 0; i < ranked.size(); ++i)
+    {
+        const std::vector<uint32_t>& shapes = *ranked[i].second;
+
+        out << ((i == 0) ? "\n" : ",\n") << "    //";
+        for (size_t j = 0; j < shapes.size(); ++j)
+            out << ((j == 0) ? " " : " / ") << ShapeToAssembly(shapes[j]);
+        out << ": " << ranked[i].first << "\n"
+            "    Superinstruction<";
+
+        for (size_t j = 0; j < shapes.size(); ++j)
+            out << ((j == 0) ? "\n        " : ",\n        ") << ShapeToSource(shapes[j]);
+        out << ">";
+    }
+
+    out << "\n> MinedSuperinstructions;";
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+// Works out which runs of instructions are worth making into superinstructions (see
+// Superinstructions.h), from how often solutions actually run them, and writes them out as
+// MinedSuperinstructions, which a build with USE_MINED_SUPERINSTRUCTIONS fuses instead of
+// CommonSuperinstructions.
+class SuperinstructionMiner
+{
+private:
+    // Every run of instructions that could be fused, by their shapes, with the number of times the
+    // programs ran through it.
+    std::map<std::vector<uint32_t>, uint64_t> m_runCounts;
+
+    int m_programCount;
+    uint64_t m_instructionCount;
+    uint64_t m_fusedInstructionCount;
+
+public:
+    SuperinstructionMiner();
+
+    // Add one program's counts.
+    //
+    // Formal Parameters:
+    //  code: the program.
+    //  startCounts: the number of times each of its instructions was started.
+    //  fusedCount: how many of those instructions were run by the superinstructions that
+    //              ComputeNode has now.
+    void AddProgram(const std::vector<DecodedInstruction>& code, const std::vector<uint64_t>& startCounts, uint64_t fusedCount);
+
+    // Report how many of the instructions run were covered by the current superinstructions.
+    void Report(std::ostream& out) const;
+
+    // Write out the count runs that would save the most handler calls, as a header in the same form
+    // as CommonSuperinstructions, for USE_MINED_SUPERINSTRUCTIONS.
+    void WriteHeader(std::ostream& out, size_t count) const;
+};
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+
+// Superinstructions are short runs of instructions that Engine::Threaded runs with one handler
+// instead of one handler per instruction (see ThreadedHandlers::RunSuperinstruction).
+//
+// Only instructions that don't use ports can be fused, and only the last one can jump. Nothing
+// outside the node can tell when such instructions run. The node runs all of them in the first
+// cycle, then stays busy for the cycles they would otherwise have taken, so every port access still
+// happens in the same cycle.
+//
+// The runs fused are the common idioms in CommonSuperinstructions below. -superinstructions (see
+// SuperinstructionMiner) profiles save files, reports how many of the instructions they ran were in
+// superinstructions, and writes out the runs they spend the most handler calls on. Building with
+// USE_MINED_SUPERINSTRUCTIONS defined fuses those instead (see ActiveSuperinstructions), so they can
+// be measured.
+
+static constexpr size_t MaxSuperinstructionLength = 4;
+
+// How many -superinstructions writes out.
+static constexpr size_t MaxMinedSuperinstructions = 16;
+
+// An instruction's opcode and operands, without its immediate value or jump target.
+constexpr uint32_t InstructionShape(Opcode op, Target src, Target dst)
+{
+    return static_cast<uint32_t>(op) | (static_cast<uint32_t>(src) << 8) | (static_cast<uint32_t>(dst) << 16);
+}
+
+inline uint32_t InstructionShape(const DecodedInstruction& instr)
+{
+    return InstructionShape(instr.op, instr.src, instr.dst);
+}
+
+constexpr Opcode ShapeOpcode(uint32_t shape)
+{
+    return static_cast<Opcode>(shape & 0xff);
+}
+
+constexpr Target ShapeSource(uint32_t shape)
+{
+    return static_cast<Target>((shape >> 8) & 0xff);
+}
+
+constexpr Target ShapeDestination(uint32_t shape)
+{
+    return static_cast<Target>((shape >> 16) & 0xff);
+}
+
+constexpr bool IsLocalOperand(Target target)
+{
+    return (target == Target::None) || (target == Target::NIL) || (target == Target::ACC);
+}
+
+constexpr bool IsJumpShape(uint32_t shape)
+{
+    return (ShapeOpcode(shape) >= Opcode::JMP) && (ShapeOpcode(shape) <= Opcode::JRO);
+}
+
+// Whether an instruction of this shape can be part of a superinstruction: last says whether it
+// would be the last instruction in the run.
+constexpr bool IsFusableShape(uint32_t shape, bool last)
+{
+    return (ShapeOpcode(shape) != Opcode::Indeterminate)
+        && (ShapeOpcode(shape) != Opcode::HCF)
+        && IsLocalOperand(ShapeSource(shape))
+        && IsLocalOperand(ShapeDestination(shape))
+        && (last || !IsJumpShape(shape));
+}
+
+constexpr bool IsFusableRun(std::initializer_list<uint32_t> shapes)
+{
+    size_t index = 0;
+    for (uint32_t shape : shapes)
+    {
+        if (!IsFusableShape(shape, ++index == shapes.size()))
+            return false;
+    }
+    return true;
+}
+
+// Whether the length instructions starting at code[pc] can be fused. Like the PC, they wrap around
+// at the end of the program.
+inline bool IsFusableRun(const std::vector<DecodedInstruction>& code, size_t pc, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (!IsFusableShape(InstructionShape(code[(pc + i) % code.size()]), i + 1 == length))
+            return false;
+    }
+    return true;
+}
+
+template <uint32_t... Shapes>
+struct Superinstruction
+{
+    static_assert((sizeof...(Shapes) >= 2) && (sizeof...(Shapes) <= MaxSuperinstructionLength),
+        "superinstructions have 2 to MaxSuperinstructionLength instructions");
+    static_assert(IsFusableRun({ Shapes... }), "superinstructions can't use ports, and only the last instruction can jump");
+};
+
+// In order of preference: where more than one could start at the same instruction, the first wins.
+template <typename... Superinstructions>
+struct SuperinstructionList
+{
+};
+
+// Counting down to the end of a loop. Loops that do nothing else are skipped altogether (see
+// CountingLoop), so this is for loops with a body that uses ports.
+//
+// Pairs of instructions save little, since the node still spends a cycle busy, and the others tried
+// here (SUB/JEZ, ADD/JMP and the like) made Engine::Threaded slower on some saves.
+typedef SuperinstructionList<
+    Superinstruction<
+        InstructionShape(Opcode::SUB, Target::None, Target::None),
+        InstructionShape(Opcode::JNZ, Target::None, Target::None)>
+> CommonSuperinstructions;
+
+// The superinstructions ComputeNode fuses: the ones -superinstructions wrote to
+// MinedSuperinstructions.h if USE_MINED_SUPERINSTRUCTIONS is defined, or CommonSuperinstructions.
+#ifdef USE_MINED_SUPERINSTRUCTIONS
+#include "MinedSuperinstructions.h"
+typedef MinedSuperinstructions ActiveSuperinstructions;
+#else
+typedef CommonSuperinstructions ActiveSuperinstructions;
+#endif
\ No newline at end of file
@@ -0,0 +1,932 @@
+#include "pch.h"
+#include "Node.h"
+#include "IOChannel.h"
+#include "OutputBase.h"
+#include "OutputNode.h"
+#include "Engine.h"
+#include "ComputeNode.h"
+#include "Grid.h"
+#include "VisualizationNode.h"
+#include "Lanes.h"
+#include "ParallelGrid.h"
+#include "TimeWarpGrid.h"
+
+void TimeWarpGrid::ReadPhase(const Entry& entry)
+{
+    if (entry.computeNode != nullptr)
+    {
+        entry.computeNode->ThreadedRead();
+    }
+    else
+    {
+        entry.node->Read();
+        entry.node->Compute();
+    }
+}
+
+void TimeWarpGrid::WritePhase(const Entry& entry)
+{
+    if (entry.computeNode != nullptr)
+    {
+        entry.computeNode->ThreadedWrite();
+    }
+    else
+    {
+        entry.node->Write();
+        entry.node->Step();
+    }
+}
+
+bool TimeWarpGrid::IsIdle(const Region& region)
+{
+    for (uint32_t word : region.activeNodes)
+    {
+        if (word != 0)
+            return false;
+    }
+    return true;
+}
+
+void TimeWarpGrid::MergeWokenNodes(Region& region)
+{
+    for (size_t word = 0; word < region.activeNodes.size(); ++word)
+    {
+        region.activeNodes[word] |= region.wokenNodes[word];
+        region.wokenNodes[word] = 0;
+    }
+}
+
+void TimeWarpGrid::WakeAllNodes(Region& region)
+{
+    size_t count = region.nodes.size();
+    for (size_t word = 0; word < region.activeNodes.size(); ++word)
+    {
+        size_t bitsInWord = std::min<size_t>(count - word * 32, 32);
+        region.activeNodes[word] = (bitsInWord == 32) ? ~0U : ((1U << bitsInWord) - 1);
+        region.wokenNodes[word] = 0;
+    }
+}
+
+void TimeWarpGrid::InsertPending(Region& region, const Message& message)
+{
+    auto position = std::upper_bound(region.pending.begin(), region.pending.end(), message,
+        [](const Message& a, const Message& b)
+        {
+            return (a.cycle < b.cycle) || ((a.cycle == b.cycle) && (a.kind < b.kind));
+        });
+    region.pending.insert(position, message);
+}
+
+bool TimeWarpGrid::IsCancelledBy(const Message& message, const Message& cancel)
+{
+    return (message.from == cancel.from) && (message.sequence >= cancel.sequence);
+}
+
+// Whether message, sent while running cycles again after a rollback, is the one sent the first time.
+bool TimeWarpGrid::IsResent(const Message& message, const Message& original)
+{
+    return (message.kind == original.kind) && (message.cycle == original.cycle) && (message.sentIn == original.sentIn)
+        && (message.port.link == original.port.link) && (message.port.side == original.port.side) && (message.value == original.value);
+}
+
+// Start the region over from the GVT, with the state its nodes and channels are in now.
+void TimeWarpGrid::Reset(Region& region)
+{
+    region.cycle = m_cycle;
+    region.clock.cycle = m_cycle;
+    region.pending.clear();
+    region.processed.clear();
+    region.replayed = 0;
+    std::move(region.snapshots.begin(), region.snapshots.end(), std::back_inserter(region.spareSnapshots));
+    region.snapshots.clear();
+    region.taken.clear();
+    region.outputReads.clear();
+    region.stampedReads = 0;
+    for (std::vector<Message>& sent : region.sent)
+        sent.clear();
+    std::fill(region.confirmed.begin(), region.confirmed.end(), 0);
+    region.error = nullptr;
+    region.errorCycle = 0;
+    region.fatal = nullptr;
+    region.mail.clear();
+    region.hasMail = false;
+
+    WakeAllNodes(region);
+    TakeSnapshot(region);
+}
+
+void TimeWarpGrid::Post(int to, const Message& message)
+{
+    Region& region = *m_regions[to];
+    {
+        std::lock_guard<std::mutex> lock(region.mailMutex);
+        region.mail.push_back(message);
+        region.hasMail = true;
+    }
+
+    // See Work for how this and parking fit together.
+    if (region.parked)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (region.parked && !m_betweenRounds)
+        {
+            region.parked = false;
+            ++m_busyCount;
+            m_wake.notify_all();
+        }
+    }
+}
+
+// Send a value or a Taken message. After a rollback, one that's the same as the next of those sent
+// the first time is already there; one that isn't cancels the rest.
+void TimeWarpGrid::Send(Region& from, int to, const Message& message)
+{
+    std::vector<Message>& sent = from.sent[to];
+    size_t& confirmed = from.confirmed[to];
+    if (confirmed < sent.size())
+    {
+        if (IsResent(message, sent[confirmed]))
+        {
+            ++confirmed;
+            return;
+        }
+
+        CancelUnconfirmed(from, to);
+    }
+
+    sent.push_back(message);
+    sent.back().sequence = from.nextSequence++;
+    confirmed = sent.size();
+    Post(to, sent.back());
+}
+
+void TimeWarpGrid::CancelUnconfirmed(Region& from, int to)
+{
+    std::vector<Message>& sent = from.sent[to];
+    size_t confirmed = from.confirmed[to];
+    if (confirmed == sent.size())
+        return;
+
+    Post(to, Message{ Message::Kind::Cancel, 0, 0, from.index, Port{ 0, 0 }, 0, sent[confirmed].sequence });
+    sent.resize(confirmed);
+}
+
+// Cancel what the region sent before a rollback from cycles up to cycle, which it has now run again
+// without sending it.
+void TimeWarpGrid::CancelUnsent(Region& region, uint64_t cycle)
+{
+    for (int to = 0; to < static_cast<int>(m_regions.size()); ++to)
+    {
+        const std::vector<Message>& sent = region.sent[to];
+        size_t confirmed = region.confirmed[to];
+        if ((confirmed < sent.size()) && (sent[confirmed].sentIn <= cycle))
+            CancelUnconfirmed(region, to);
+    }
+}
+
+void TimeWarpGrid::Apply(const Message& message)
+{
+    const Link& link = m_links[message.port.link];
+    int side = message.port.side;
+
+    if (message.kind == Message::Kind::Value)
+    {
+        // The region's clock is still on the cycle it was sent in.
+        link.copies[side ^ 1]->Write(side, message.value);
+    }
+    else
+    {
+        // Taking the value from the copy, on behalf of the node that took it, completes the write.
+        // If there's nothing there, the message comes from a run of the other region that is about
+        // to be cancelled.
+        int value;
+        link.copies[side]->Read(side ^ 1, &value);
+    }
+}
+
+void TimeWarpGrid::ApplyMessages(Region& region, uint64_t cycle, Message::Kind kind, bool coasting)
+{
+    if (coasting)
+    {
+        while ((region.replayed < region.processed.size())
+            && (region.processed[region.replayed].cycle == cycle)
+            && (region.processed[region.replayed].kind == kind))
+        {
+            Apply(region.processed[region.replayed++]);
+        }
+        return;
+    }
+
+    while (!region.pending.empty() && (region.pending.front().cycle == cycle) && (region.pending.front().kind == kind))
+    {
+        Apply(region.pending.front());
+        region.processed.push_back(region.pending.front());
+        region.pending.pop_front();
+    }
+}
+
+// Fill in the cycle of what the region's outputs read in this one. Coasting back over cycles from
+// before the GVT reads the same things again, and those have already been committed.
+void TimeWarpGrid::StampOutputReads(Region& region, uint64_t cycle)
+{
+    if (region.stampedReads == region.outputReads.size())
+        return;
+
+    if (cycle <= m_cycle)
+    {
+        region.outputReads.resize(region.stampedReads);
+        return;
+    }
+
+    for (size_t i = region.stampedReads; i < region.outputReads.size(); ++i)
+        region.outputReads[i].cycle = cycle;
+    region.stampedReads = region.outputReads.size();
+}
+
+// One cycle of the region, stepped like Engine::Scheduled steps the grid, with the messages for it
+// applied between the phases. While coasting, the messages are the ones applied the first time, and
+// nothing is sent.
+void TimeWarpGrid::RunCycle(Region& region, bool coasting)
+{
+    uint64_t cycle = region.cycle + 1;
+
+    // A value sent from another region in the last cycle goes into this region's copy of the link as
+    // though it had been written then, so that it can be read from this cycle on.
+    region.clock.cycle = region.cycle;
+    ApplyMessages(region, cycle, Message::Kind::Value, coasting);
+    MergeWokenNodes(region);
+
+    region.clock.cycle = cycle;
+    for (size_t word = 0; word < region.activeNodes.size(); ++word)
+    {
+        for (uint32_t bits = region.activeNodes[word]; bits != 0; bits &= bits - 1)
+            ReadPhase(region.nodes[word * 32 + LowestBitIndex(bits)]);
+    }
+    StampOutputReads(region, cycle);
+
+    // A value another region took in this cycle completes its sender's write before the write phase,
+    // as it would within a region, and so does one this region took.
+    ApplyMessages(region, cycle, Message::Kind::Taken, coasting);
+    for (const Port& port : region.taken)
+    {
+        if (!coasting)
+            Send(region, m_links[port.link].regions[port.side], Message{ Message::Kind::Taken, cycle, cycle, region.index, port, 0, 0 });
+    }
+    region.taken.clear();
+    MergeWokenNodes(region);
+
+    for (size_t word = 0; word < region.activeNodes.size(); ++word)
+    {
+        for (uint32_t bits = region.activeNodes[word]; bits != 0; bits &= bits - 1)
+        {
+            const Entry& entry = region.nodes[word * 32 + LowestBitIndex(bits)];
+            WritePhase(entry);
+
+            if (entry.node->IsIdle())
+                region.activeNodes[word] &= ~(bits & (0 - bits));
+        }
+    }
+    MergeWokenNodes(region);
+
+    if (!coasting)
+    {
+        for (const Port& port : region.ports)
+        {
+            const Link& link = m_links[port.link];
+            int value;
+            if (link.copies[port.side]->WroteInCycle(port.side, cycle, &value))
+                Send(region, link.regions[port.side ^ 1], Message{ Message::Kind::Value, cycle + 1, cycle, region.index, port, value, 0 });
+        }
+
+        CancelUnsent(region, cycle);
+    }
+
+    region.cycle = cycle;
+    if (cycle % SnapshotInterval == 0)
+        TakeSnapshot(region);
+}
+
+// Run the region up to limit. While all of its nodes are idle, nothing happens until the next
+// message is applied, so those cycles are skipped; if there's no message before limit, it waits
+// where it is, unless it's coasting. Otherwise, it stops early when mail arrives, or when one of its
+// nodes throws an exception.
+void TimeWarpGrid::Advance(Region& region, uint64_t limit, bool coasting)
+{
+    while (region.cycle < limit)
+    {
+        if (!coasting && region.hasMail.load(std::memory_order_relaxed))
+            return;
+
+        if (IsIdle(region))
+        {
+            uint64_t next = NoLimit;
+            if (coasting && (region.replayed < region.processed.size()))
+                next = region.processed[region.replayed].cycle;
+            else if (!coasting && !region.pending.empty())
+                next = region.pending.front().cycle;
+
+            if (next > limit)
+            {
+                if (coasting)
+                    region.cycle = limit;
+                else
+                    CancelUnsent(region, limit);
+                return;
+            }
+
+            region.cycle = next - 1;
+            if (!coasting)
+                CancelUnsent(region, region.cycle);
+        }
+
+        if (coasting)
+        {
+            RunCycle(region, true);
+            continue;
+        }
+
+        try
+        {
+            RunCycle(region, false);
+        }
+        catch (...)
+        {
+            // Put back what the cycle had done so far, so the region is ready to try it again.
+            region.error = std::current_exception();
+            region.errorCycle = region.cycle + 1;
+            Rollback(region, region.cycle);
+            return;
+        }
+    }
+}
+
+void TimeWarpGrid::TakeSnapshot(Region& region)
+{
+    if (region.spareSnapshots.empty())
+    {
+        region.snapshots.emplace_back();
+    }
+    else
+    {
+        region.snapshots.push_back(std::move(region.spareSnapshots.back()));
+        region.spareSnapshots.pop_back();
+    }
+
+    Snapshot& snapshot = region.snapshots.back();
+    snapshot.cycle = region.cycle;
+
+    snapshot.nodeState.clear();
+    for (const Entry& entry : region.nodes)
+        entry.node->SaveState(snapshot.nodeState);
+
+    snapshot.channels.clear();
+    for (const IOChannel* channel : region.channels)
+        snapshot.channels.push_back(*channel);
+}
+
+void TimeWarpGrid::Restore(Region& region, const Snapshot& snapshot)
+{
+    const int* state = snapshot.nodeState.data();
+    for (const Entry& entry : region.nodes)
+        state = entry.node->RestoreState(state);
+
+    for (size_t i = 0; i < region.channels.size(); ++i)
+        *region.channels[i] = snapshot.channels[i];
+
+    region.cycle = snapshot.cycle;
+
+    region.outputReads.resize(region.stampedReads);
+    while (!region.outputReads.empty() && (region.outputReads.back().cycle > snapshot.cycle))
+        region.outputReads.pop_back();
+    region.stampedReads = region.outputReads.size();
+
+    region.taken.clear();
+
+    // Nothing is known about which nodes were idle.
+    WakeAllNodes(region);
+}
+
+// Put the region back the way it was at the end of cycle, from the last snapshot before then. What
+// it sent after then is confirmed or cancelled as it runs those cycles again (see Send).
+void TimeWarpGrid::Rollback(Region& region, uint64_t cycle)
+{
+    ++region.rollbackCount;
+
+    auto later = std::upper_bound(region.snapshots.begin(), region.snapshots.end(), cycle,
+        [](uint64_t value, const Snapshot& snapshot) { return value < snapshot.cycle; });
+    if (later == region.snapshots.begin())
+        throw std::exception("no snapshot to roll back to");
+
+    std::move(later, region.snapshots.end(), std::back_inserter(region.spareSnapshots));
+    region.snapshots.erase(later, region.snapshots.end());
+
+    const Snapshot& snapshot = region.snapshots.back();
+    Restore(region, snapshot);
+
+    auto replayFrom = std::upper_bound(region.processed.begin(), region.processed.end(), snapshot.cycle,
+        [](uint64_t value, const Message& message) { return value < message.cycle; });
+    region.replayed = replayFrom - region.processed.begin();
+    Advance(region, cycle, true);
+
+    // The messages from after then are applied again when the region gets back to them.
+    for (size_t i = region.replayed; i < region.processed.size(); ++i)
+        InsertPending(region, region.processed[i]);
+    region.processed.resize(region.replayed);
+
+    for (int to = 0; to < static_cast<int>(m_regions.size()); ++to)
+    {
+        const std::vector<Message>& sent = region.sent[to];
+        auto after = std::upper_bound(sent.begin(), sent.end(), cycle,
+            [](uint64_t value, const Message& message) { return value < message.sentIn; });
+        region.confirmed[to] = std::min<size_t>(region.confirmed[to], after - sent.begin());
+    }
+}
+
+void TimeWarpGrid::ReceiveMail(Region& region)
+{
+    std::vector<Message> mail;
+    {
+        std::lock_guard<std::mutex> lock(region.mailMutex);
+        mail.swap(region.mail);
+        region.hasMail = false;
+    }
+
+    // Roll back once, to before the first cycle that any of it changes.
+    uint64_t cycle = region.cycle;
+    for (const Message& message : mail)
+    {
+        if (message.kind != Message::Kind::Cancel)
+        {
+            cycle = std::min(cycle, message.cycle - 1);
+            continue;
+        }
+
+        for (const Message& applied : region.processed)
+        {
+            if (IsCancelledBy(applied, message))
+                cycle = std::min(cycle, applied.cycle - 1);
+        }
+    }
+
+    if (cycle < region.cycle)
+        Rollback(region, cycle);
+
+    for (const Message& message : mail)
+    {
+        if (message.kind == Message::Kind::Cancel)
+        {
+            region.pending.erase(
+                std::remove_if(region.pending.begin(), region.pending.end(), [&message](const Message& pending) { return IsCancelledBy(pending, message); }),
+                region.pending.end());
+        }
+        else
+        {
+            InsertPending(region, message);
+        }
+    }
+
+    if (!mail.empty())
+        region.error = nullptr;
+}
+
+// A region's thread. It parks whenever it has run as far as it can and has no mail, and is unparked
+// by mail or by the next round. Parking sets parked and then looks for mail, and sending sets
+// hasMail and then looks at parked, so one or the other always sees the mail. The round is over once
+// every region is parked, since only a region that isn't can send anything.
+void TimeWarpGrid::Work(size_t index)
+{
+    Region& region = *m_regions[index];
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        region.parked = true;
+        if (region.hasMail)
+            region.parked = false;
+        else if (--m_busyCount == 0)
+            m_roundDone.notify_all();
+
+        m_wake.wait(lock, [this, &region]() { return !region.parked || m_stopping; });
+        if (m_stopping)
+            return;
+
+        lock.unlock();
+        try
+        {
+            if (region.fatal)
+            {
+                std::lock_guard<std::mutex> mailLock(region.mailMutex);
+                region.mail.clear();
+                region.hasMail = false;
+            }
+            else
+            {
+                if (region.hasMail)
+                    ReceiveMail(region);
+
+                if (!region.error)
+                    Advance(region, m_horizon, false);
+            }
+        }
+        catch (...)
+        {
+            region.fatal = std::current_exception();
+        }
+        lock.lock();
+    }
+}
+
+void TimeWarpGrid::RunRound(uint64_t horizon)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // The threads park as soon as they start.
+    m_roundDone.wait(lock, [this]() { return m_busyCount == 0; });
+
+    m_horizon = horizon;
+    m_betweenRounds = false;
+    for (const auto& spRegion : m_regions)
+        spRegion->parked = false;
+    m_busyCount = m_regions.size();
+    m_wake.notify_all();
+
+    m_roundDone.wait(lock, [this]() { return m_busyCount == 0; });
+    m_betweenRounds = true;
+}
+
+// Take what the outputs read up to the GVT from the regions, and check them a cycle at a time, as
+// the caller of ComputeGrid::Step would have. Returns whether they were finished, and if so, in
+// which cycle; what they read after that is dropped.
+bool TimeWarpGrid::Commit(uint64_t gvt, const FinishedCheck* pIsFinished, uint64_t* pFinishCycle)
+{
+    std::vector<OutputRead> reads;
+    for (const auto& spRegion : m_regions)
+    {
+        Region& region = *spRegion;
+        auto begin = region.outputReads.begin();
+        auto end = std::upper_bound(begin, begin + region.stampedReads, gvt,
+            [](uint64_t value, const OutputRead& read) { return value < read.cycle; });
+
+        reads.insert(reads.end(), begin, end);
+        region.stampedReads -= end - begin;
+        region.outputReads.erase(begin, end);
+    }
+
+    std::stable_sort(reads.begin(), reads.end(), [](const OutputRead& a, const OutputRead& b) { return a.cycle < b.cycle; });
+
+    size_t outputCount = m_finalOutputs.size();
+    for (size_t i = 0; i < reads.size();)
+    {
+        uint64_t cycle = reads[i].cycle;
+        for (; (i < reads.size()) && (reads[i].cycle == cycle); ++i)
+        {
+            size_t output = static_cast<size_t>(reads[i].output);
+            if (output < outputCount)
+                m_finalOutputs[output].ReadData(reads[i].value);
+            else
+                m_finalVizNodes[output - outputCount].ReadData(reads[i].value);
+        }
+
+        if ((pIsFinished != nullptr) && (*pIsFinished)(m_finalOutputs, m_finalVizNodes))
+        {
+            *pFinishCycle = cycle;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Bring every region to cycle, which is the new GVT, and throw away what came before it. A region
+// that's behind is idle until then, and what one that's ahead sent after then is cancelled.
+void TimeWarpGrid::Synchronize(uint64_t cycle)
+{
+    m_cycle = cycle;
+
+    for (const auto& spRegion : m_regions)
+    {
+        Region& region = *spRegion;
+        if (region.cycle > cycle)
+            Rollback(region, cycle);
+        else
+            region.cycle = cycle;
+
+        for (int to = 0; to < static_cast<int>(m_regions.size()); ++to)
+        {
+            CancelUnconfirmed(region, to);
+            region.sent[to].clear();
+            region.confirmed[to] = 0;
+        }
+
+        std::move(region.snapshots.begin(), region.snapshots.end(), std::back_inserter(region.spareSnapshots));
+        region.snapshots.clear();
+        TakeSnapshot(region);
+        region.processed.clear();
+    }
+}
+
+// Run rounds until the outputs are finished (if pIsFinished isn't null) or target is reached,
+// whichever comes first, and return whether they were finished. Either way, every region is left at
+// m_cycle.
+bool TimeWarpGrid::Run(uint64_t target, const FinishedCheck* pIsFinished)
+{
+    while (m_cycle < target)
+    {
+        RunRound(std::min(target, m_cycle + WindowCycles));
+
+        // Nothing before the end of the round can change now, but a node may have thrown an
+        // exception before then, and the first of those is as far as the grid gets.
+        uint64_t gvt = m_horizon;
+        std::exception_ptr error;
+        bool deadlocked = true;
+        for (const auto& spRegion : m_regions)
+        {
+            const Region& region = *spRegion;
+            if (region.fatal)
+                std::rethrow_exception(region.fatal);
+
+            if (region.error && (region.errorCycle - 1 < gvt))
+            {
+                gvt = region.errorCycle - 1;
+                error = region.error;
+            }
+
+            if (region.error || !IsIdle(region) || !region.pending.empty())
+                deadlocked = false;
+        }
+
+        uint64_t stopCycle = gvt;
+        bool finished = Commit(gvt, pIsFinished, &stopCycle);
+        Synchronize(stopCycle);
+
+        if (finished)
+            return true;
+
+        if (error)
+            std::rethrow_exception(error);
+
+        if (deadlocked)
+        {
+            // Nothing is ever going to happen again.
+            if (target != NoLimit)
+                Synchronize(target);
+            return false;
+        }
+    }
+
+    return false;
+}
+
+TimeWarpGrid::TimeWarpGrid(
+    int width,
+    int height,
+    int threadCount,
+    const std::vector<INode*>& grid,
+    const std::vector<INode*>& nodes,
+    IOChannelTable& channels,
+    std::vector<OutputNode>& outputNodes,
+    std::vector<VisualizationNode>& vizNodes
+    )
+    : m_table(channels)
+    , m_outputNodes(outputNodes)
+    , m_vizNodes(vizNodes)
+    , m_finalOutputs(outputNodes)
+    , m_finalVizNodes(vizNodes)
+    , m_cycle(channels.Cycle())
+    , m_horizon(channels.Cycle())
+    , m_busyCount(0)
+    , m_betweenRounds(true)
+    , m_stopping(false)
+{
+    int tileRows = ParallelGrid::TileRows(width, height, threadCount);
+    int tileColumns = std::min(threadCount / tileRows, width);
+
+    // Grid nodes start out in the tile that covers them, and inputs and outputs in the tile of the
+    // node they're joined to.
+    std::unordered_map<const INode*, int> tileOf;
+    for (int index = 0; index < width * height; ++index)
+    {
+        int row = index / width;
+        int column = index % width;
+        tileOf[grid[index]] = (row * tileRows / height) * tileColumns + column * tileColumns / width;
+    }
+
+    IOChannel* channelArray = channels.Channels();
+    std::unordered_map<const INode*, const INode*> joinedTo;
+    for (size_t i = 0; i < channels.Count(); ++i)
+    {
+        for (int side = 0; side < 2; ++side)
+        {
+            if (tileOf.find(channelArray[i].Node(side)) == tileOf.end())
+                joinedTo[channelArray[i].Node(side)] = channelArray[i].Node(side ^ 1);
+        }
+    }
+    for (const auto& pair : joinedTo)
+        tileOf[pair.first] = tileOf.at(pair.second);
+
+    // Group each node that offers on several ports with its neighbors, as ParallelGrid does, and put
+    // each group in the tile of its first node.
+    std::unordered_map<const INode*, size_t> order;
+    for (size_t i = 0; i < nodes.size(); ++i)
+        order[nodes[i]] = i;
+
+    std::vector<size_t> parents(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+        parents[i] = i;
+
+    for (size_t i = 0; i < channels.Count(); ++i)
+    {
+        auto a = order.find(channelArray[i].Node(0));
+        auto b = order.find(channelArray[i].Node(1));
+        if ((a == order.end()) || (b == order.end()))
+            continue;
+
+        if (ParallelGrid::OffersOnSeveralPorts(a->first) || ParallelGrid::OffersOnSeveralPorts(b->first))
+            parents[ParallelGrid::FindGroup(parents, a->second)] = ParallelGrid::FindGroup(parents, b->second);
+    }
+
+    std::vector<int> groupTiles(nodes.size(), -1);
+    std::vector<int> tiles(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        int& groupTile = groupTiles[ParallelGrid::FindGroup(parents, i)];
+        if (groupTile < 0)
+            groupTile = tileOf.at(nodes[i]);
+        tiles[i] = groupTile;
+    }
+
+    // An input or output goes with the node it's joined to, wherever that ended up, so that every
+    // link is between two grid nodes.
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto io = joinedTo.find(nodes[i]);
+        if (io == joinedTo.end())
+            continue;
+
+        auto neighbor = order.find(io->second);
+        if (neighbor != order.end())
+            tiles[i] = tiles[neighbor->second];
+    }
+
+    // A region for each tile with any nodes left in it.
+    std::vector<int> tileRegions(tileRows * tileColumns, -1);
+    std::unordered_map<const INode*, int> regionOf;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        int& regionIndex = tileRegions[tiles[i]];
+        if (regionIndex < 0)
+        {
+            regionIndex = static_cast<int>(m_regions.size());
+            m_regions.emplace_back(new Region());
+            m_regions.back()->index = regionIndex;
+        }
+
+        m_regions[regionIndex]->nodes.push_back(Entry{ nodes[i], dynamic_cast<ComputeNode*>(nodes[i]) });
+        regionOf[nodes[i]] = regionIndex;
+    }
+
+    // A channel that only one region's nodes use is that region's, on its clock. One with a node
+    // that never does anything is the other node's.
+    for (size_t i = 0; i < channels.Count(); ++i)
+    {
+        IOChannel& channel = channelArray[i];
+        auto a = regionOf.find(channel.Node(0));
+        auto b = regionOf.find(channel.Node(1));
+        if ((a == regionOf.end()) && (b == regionOf.end()))
+            continue;
+
+        if ((a == regionOf.end()) || (b == regionOf.end()) || (a->second == b->second))
+        {
+            Region& region = *m_regions[(a != regionOf.end()) ? a->second : b->second];
+            channel.SetClock(&region.clock);
+            region.channels.push_back(&channel);
+            m_clockedChannels.push_back(&channel);
+            continue;
+        }
+
+        // Grid nodes are joined to the node to their right, or the one below.
+        Link link = { &channel, { channel.Node(0), channel.Node(1) }, {}, { a->second, b->second }, { nullptr, nullptr } };
+        link.directions[0] = (channel.Node(1)->NodeId == channel.Node(0)->NodeId + width) ? Neighbor::DOWN : Neighbor::RIGHT;
+        link.directions[1] = OppositeNeighbor(link.directions[0]);
+        m_links.push_back(link);
+    }
+
+    m_copies.reserve(2 * m_links.size());
+    m_remoteNodes.reserve(2 * m_links.size());
+    for (size_t i = 0; i < m_links.size(); ++i)
+    {
+        Link& link = m_links[i];
+        for (int side = 0; side < 2; ++side)
+        {
+            Region& region = *m_regions[link.regions[side]];
+
+            m_remoteNodes.emplace_back(&region.taken, Port{ i, side ^ 1 });
+            m_copies.push_back(*link.channel);
+            IOChannel& copy = m_copies.back();
+            copy.SetNode(side ^ 1, &m_remoteNodes.back());
+            copy.SetClock(&region.clock);
+
+            link.copies[side] = &copy;
+            link.nodes[side]->SetNeighbor(link.directions[side], IOPort(&copy, side));
+            region.channels.push_back(&copy);
+            region.ports.push_back(Port{ i, side });
+        }
+    }
+
+    for (size_t i = 0; i < outputNodes.size(); ++i)
+        outputNodes[i].SetReadLog(&m_regions[regionOf.at(&outputNodes[i])]->outputReads, static_cast<int>(i));
+    for (size_t i = 0; i < vizNodes.size(); ++i)
+        vizNodes[i].SetReadLog(&m_regions[regionOf.at(&vizNodes[i])]->outputReads, static_cast<int>(outputNodes.size() + i));
+
+    for (const auto& spRegion : m_regions)
+    {
+        Region& region = *spRegion;
+
+        size_t wordCount = (region.nodes.size() + 31) / 32;
+        region.activeNodes.resize(wordCount);
+        region.wokenNodes.resize(wordCount);
+        for (size_t i = 0; i < region.nodes.size(); ++i)
+        {
+            // Never written late, since only Engine::Fused does that (see ChannelClock).
+            region.nodes[i].node->SteppedCycle = NoLimit;
+            region.nodes[i].node->SetWakeFlag(&region.wokenNodes[i / 32], 1U << (i % 32));
+        }
+
+        region.clock = ChannelClock{ m_cycle, nullptr, 0 };
+        region.nextSequence = 0;
+        region.sent.resize(m_regions.size());
+        region.confirmed.resize(m_regions.size());
+        region.rollbackCount = 0;
+        region.parked = false;
+        Reset(region);
+    }
+
+    m_busyCount = m_regions.size();
+    for (size_t index = 0; index < m_regions.size(); ++index)
+        m_threads.emplace_back(&TimeWarpGrid::Work, this, index);
+}
+
+TimeWarpGrid::~TimeWarpGrid()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads)
+        thread.join();
+
+    for (const Link& link : m_links)
+    {
+        for (int side = 0; side < 2; ++side)
+        {
+            link.channel->CopySide(side, *link.copies[side]);
+            link.nodes[side]->SetNeighbor(link.directions[side], IOPort(link.channel, side));
+        }
+    }
+
+    for (IOChannel* channel : m_clockedChannels)
+        channel->SetClock(m_table.Clock());
+    m_table.Clock()->cycle = m_cycle;
+
+    for (OutputNode& node : m_outputNodes)
+        node.SetReadLog(nullptr, 0);
+    for (VisualizationNode& node : m_vizNodes)
+        node.SetReadLog(nullptr, 0);
+}
+
+int64_t TimeWarpGrid::RollbackCount() const
+{
+    int64_t count = 0;
+    for (const auto& spRegion : m_regions)
+        count += spRegion->rollbackCount;
+    return count;
+}
+
+void TimeWarpGrid::Initialize()
+{
+    // The nodes have withdrawn what they were sending, but not on the far ends of the copies.
+    for (const Link& link : m_links)
+    {
+        for (int side = 0; side < 2; ++side)
+            link.copies[side]->CancelWrite(side ^ 1);
+    }
+
+    for (const auto& spRegion : m_regions)
+        Reset(*spRegion);
+
+    m_finalOutputs = m_outputNodes;
+    m_finalVizNodes = m_vizNodes;
+}
+
+void TimeWarpGrid::Step()
+{
+    Run(m_cycle + 1, nullptr);
+}
+
+int TimeWarpGrid::FastForward(int maxCycles, const FinishedCheck& isFinished)
+{
+    uint64_t start = m_cycle;
+    Run((maxCycles < 0) ? NoLimit : start + maxCycles, &isFinished);
+    return static_cast<int>(m_cycle - start);
+}
\ No newline at end of file
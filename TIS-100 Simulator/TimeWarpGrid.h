@@ -0,0 +1,252 @@
+#pragma once
+
+// Runs a grid on several threads without keeping them in step, for Engine::TimeWarp. The grid is
+// split into regions the way ParallelGrid splits it into tiles, except that a node offering its
+// value on several ports is kept in the same region as all of its neighbors, so each region can run
+// as far ahead as it likes on its own thread, assuming nothing is going to arrive from the others
+// (optimistic simulation, after Jefferson's Time Warp).
+//
+// A channel between two regions is a link: each region has its own copy of it, with a RemoteNode
+// standing in for the node at the far end. What one end does reaches the other region as a message
+// stamped with the cycle it takes effect in: a value sent, which can be read from the next cycle on,
+// or a value taken, which completes the sender's write in the same cycle, as it would if both nodes
+// were in one region. Nothing else can cross a link, since neither of its nodes ever cancels a write.
+//
+// A message stamped with a cycle the region has already run is a straggler. The region rolls back to
+// the last snapshot it took from before then, runs forward again to just before the straggler
+// without sending anything (coasting; what it sent the first time is still right), and carries on
+// from there. What it had sent from the cycles it rolled back over stands for as long as running them
+// again sends the same messages (lazy cancellation); from the first that it doesn't, the rest are
+// cancelled, which can roll the regions they were sent to back in turn. Cancelling them all straight
+// away would never settle when two regions take each other's values in the same cycle, since each
+// Taken message would roll the other region back to before its own.
+//
+// The regions run in rounds of up to WindowCycles cycles. A round is over once every region has run
+// to its end, or is idle with nothing to read, and no messages are left; after that, nothing can
+// roll back to before the end of it, which is the global virtual time (GVT). What the outputs read
+// up to then is final, and is checked a cycle at a time, so the grid stops in exactly the cycle that
+// stepping it one cycle at a time would have. Snapshots and messages from before the GVT are thrown
+// away (fossil collection), so the memory used depends on what happens in one round, not on how many
+// rounds there have been.
+class TimeWarpGrid
+{
+public:
+    // Whether the outputs are finished (see IsOutputFinished).
+    typedef std::function<bool(const std::vector<OutputNode>& outputNodes, std::vector<VisualizationNode>& vizNodes)> FinishedCheck;
+
+private:
+    static constexpr uint64_t WindowCycles = 1024;
+    static constexpr uint64_t SnapshotInterval = 32;
+    static constexpr uint64_t NoLimit = std::numeric_limits<uint64_t>::max();
+
+    struct Entry
+    {
+        INode* node;
+        ComputeNode* computeNode;
+    };
+
+    // One end of a link.
+    struct Port
+    {
+        size_t link;
+        int side;
+    };
+
+    struct Link
+    {
+        IOChannel* channel; // the grid's own channel, which neither region uses while the engine is set
+        INode* nodes[2];
+        Neighbor directions[2]; // where each node's neighbor on the link is
+        int regions[2];
+        IOChannel* copies[2]; // the copy in each node's region
+    };
+
+    struct Message
+    {
+        // In the order they're applied within a cycle.
+        enum class Kind
+        {
+            Value,
+            Taken,
+            Cancel,
+        };
+
+        Kind kind;
+        uint64_t cycle; // the cycle it takes effect in
+        uint64_t sentIn; // the cycle its region sent it in
+        int from; // the region that sent it
+        Port port; // for Value, the end that sent it; for Taken, the end whose value was taken
+        int value;
+        uint64_t sequence; // counts up as its region sends; for Cancel, the first one cancelled
+    };
+
+    struct Snapshot
+    {
+        uint64_t cycle;
+        std::vector<int> nodeState;
+        std::vector<IOChannel> channels;
+    };
+
+    // Stands in for the node at the far end of a link, in the near region's copy of it. Its write
+    // completes when the near node takes the value it sent, which the far region has to be told.
+    class RemoteNode final : public INode
+    {
+    private:
+        std::vector<Port>* m_pTaken;
+        Port m_port;
+
+    public:
+        RemoteNode(std::vector<Port>* pTaken, Port port) : m_pTaken(pTaken), m_port(port)
+        {
+            SteppedCycle = NoLimit;
+        }
+
+        virtual void SetNeighbor(Neighbor, const IOPort&) override {}
+        virtual void Initialize() override {}
+        virtual void Read() override {}
+        virtual void Compute() override {}
+        virtual void Write() override {}
+        virtual void Step() override {}
+        virtual void WriteComplete() override { m_pTaken->push_back(m_port); }
+        virtual bool IsIdle() const override { return true; }
+        virtual void SaveState(std::vector<int>&) const override {}
+        virtual const int* RestoreState(const int* state) override { return state; }
+    };
+
+    struct Region
+    {
+        int index;
+        std::vector<Entry> nodes; // in the order ComputeGrid::ForEachNode steps them
+        std::vector<IOChannel*> channels; // the channels only this region uses, and its copies of links
+        std::vector<Port> ports; // its ends of links
+        ChannelClock clock;
+
+        // As for Engine::Scheduled: the nodes that might have work to do, and the ones IOChannel has
+        // woken up since the last pass.
+        std::vector<uint32_t> activeNodes;
+        std::vector<uint32_t> wokenNodes;
+
+        uint64_t cycle; // the last cycle it has run
+        std::deque<Message> pending; // not applied yet, in the order they will be
+        std::vector<Message> processed; // applied, in the order they were
+        size_t replayed; // while coasting, the next of processed to apply again
+        std::vector<Snapshot> snapshots; // oldest first
+        std::vector<Snapshot> spareSnapshots; // thrown away, but kept for their memory
+        std::vector<Port> taken; // the links whose values the region took in the current cycle
+        std::vector<OutputRead> outputReads; // what its outputs have read since the GVT
+        size_t stampedReads; // how many of outputReads have their cycle filled in
+        uint64_t nextSequence; // for the next message it sends
+
+        // By region: what it has sent it since the GVT, oldest first, and how many of those are known
+        // to stand. After a rollback, the rest are expected to be sent again.
+        std::vector<std::vector<Message>> sent;
+        std::vector<size_t> confirmed;
+
+        int64_t rollbackCount;
+
+        // Thrown by one of its nodes in errorCycle, which it stops before. Anything that arrives from
+        // another region might change that cycle, so then it tries again.
+        std::exception_ptr error;
+        uint64_t errorCycle;
+
+        // Thrown by anything else.
+        std::exception_ptr fatal;
+
+        std::mutex mailMutex;
+        std::vector<Message> mail;
+        std::atomic<bool> hasMail;
+        std::atomic<bool> parked; // waiting for mail or the next round; see Work
+    };
+
+    std::vector<std::unique_ptr<Region>> m_regions;
+    std::vector<Link> m_links;
+    std::vector<IOChannel> m_copies;
+    std::vector<RemoteNode> m_remoteNodes;
+    std::vector<IOChannel*> m_clockedChannels; // the grid's channels that have a region's clock
+    IOChannelTable& m_table;
+    std::vector<OutputNode>& m_outputNodes;
+    std::vector<VisualizationNode>& m_vizNodes;
+
+    // The outputs as of the GVT.
+    std::vector<OutputNode> m_finalOutputs;
+    std::vector<VisualizationNode> m_finalVizNodes;
+
+    // The GVT: the cycle every region is at between rounds. Nothing before it can change.
+    uint64_t m_cycle;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake; // a region is unparked, or the threads are stopping
+    std::condition_variable m_roundDone; // every region is parked
+    uint64_t m_horizon; // the end of the round
+    size_t m_busyCount; // regions not parked
+    bool m_betweenRounds; // so messages sent then don't unpark anything
+    bool m_stopping;
+    std::vector<std::thread> m_threads;
+
+    static void ReadPhase(const Entry& entry);
+    static void WritePhase(const Entry& entry);
+    static bool IsIdle(const Region& region);
+    static void MergeWokenNodes(Region& region);
+    static void WakeAllNodes(Region& region);
+    static void InsertPending(Region& region, const Message& message);
+    static bool IsCancelledBy(const Message& message, const Message& cancel);
+    static bool IsResent(const Message& message, const Message& original);
+
+    void Reset(Region& region);
+    void Post(int to, const Message& message);
+    void Send(Region& from, int to, const Message& message);
+    void CancelUnconfirmed(Region& from, int to);
+    void CancelUnsent(Region& region, uint64_t cycle);
+    void Apply(const Message& message);
+    void ApplyMessages(Region& region, uint64_t cycle, Message::Kind kind, bool coasting);
+    void StampOutputReads(Region& region, uint64_t cycle);
+    void RunCycle(Region& region, bool coasting);
+    void Advance(Region& region, uint64_t limit, bool coasting);
+    void TakeSnapshot(Region& region);
+    void Restore(Region& region, const Snapshot& snapshot);
+    void Rollback(Region& region, uint64_t cycle);
+    void ReceiveMail(Region& region);
+    void Work(size_t index);
+
+    void RunRound(uint64_t horizon);
+    bool Commit(uint64_t gvt, const FinishedCheck* pIsFinished, uint64_t* pFinishCycle);
+    void Synchronize(uint64_t cycle);
+    bool Run(uint64_t target, const FinishedCheck* pIsFinished);
+
+public:
+    // Formal Parameters:
+    //  width, height: the size of the grid.
+    //  threadCount: the most regions to split it into, each with its own thread.
+    //  grid: the grid's nodes, by index.
+    //  nodes: the nodes that can do anything, in the order they step in.
+    //  channels: the channels joining all of those nodes.
+    //  outputNodes, vizNodes: the grid's outputs, which are also among nodes.
+    TimeWarpGrid(
+        int width,
+        int height,
+        int threadCount,
+        const std::vector<INode*>& grid,
+        const std::vector<INode*>& nodes,
+        IOChannelTable& channels,
+        std::vector<OutputNode>& outputNodes,
+        std::vector<VisualizationNode>& vizNodes
+        );
+
+    TimeWarpGrid(const TimeWarpGrid&) = delete;
+    TimeWarpGrid& operator=(const TimeWarpGrid&) = delete;
+
+    // Puts the grid's channels back the way the other engines expect them.
+    ~TimeWarpGrid();
+
+    size_t RegionCount() const { return m_regions.size(); }
+    int64_t RollbackCount() const;
+
+    // Call after the nodes have been initialized.
+    void Initialize();
+
+    void Step();
+
+    // Run until the outputs are finished or maxCycles have run (if it isn't negative), whichever
+    // comes first, and return the number of cycles run (see ComputeGrid::FastForward).
+    int FastForward(int maxCycles, const FinishedCheck& isFinished);
+};
\ No newline at end of file
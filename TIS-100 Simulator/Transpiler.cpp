@@ -0,0 +1,847 @@
+#include "pch.h"
+#include "Node.h"
+#include "IOChannel.h"
+#include "Engine.h"
+#include "ComputeNode.h"
+#include "Puzzle.h"
+#include "Constants.h"
+#include "Transpiler.h"
+
+// The generated program follows the same two-pass schedule as Engine::Threaded: every node does
+// its read phase (Read + Compute), then every node does its write phase (Write + Step), with the
+// nodes in the same order ComputeGrid::Initialize puts them in.
+
+enum class NodeKind
+{
+    None,
+    Compute,
+    Stack,
+    Input,
+    Output,
+    Visualization,
+};
+
+struct NodeRef
+{
+    NodeKind kind;
+    int index;
+};
+
+// One side of a channel, as seen by the node that owns the port.
+struct Port
+{
+    bool connected;
+
+    // Index of the pending/value slot this node writes to, and the one it reads from.
+    int outEndpoint;
+    int inEndpoint;
+
+    NodeRef peer;
+};
+
+static std::string NodeName(NodeRef node)
+{
+    switch (node.kind)
+    {
+    case NodeKind::Compute: return "c" + std::to_string(node.index);
+    case NodeKind::Stack: return "s" + std::to_string(node.index);
+    case NodeKind::Input: return "in" + std::to_string(node.index);
+    case NodeKind::Output: return "out" + std::to_string(node.index);
+    case NodeKind::Visualization: return "viz" + std::to_string(node.index);
+    default:
+        throw std::exception("invalid node kind");
+    }
+}
+
+// How the puzzle's nodes are wired together; mirrors the ComputeGrid constructor.
+class GridLayout
+{
+public:
+    int nodeCount;
+    std::vector<NodeKind> kinds;
+    std::vector<ComputeNode> computeNodes;
+    std::vector<Port> ports; // by PortIndex
+    std::vector<Port> inputPorts, outputPorts, vizPorts;
+    int channelCount;
+
+    GridLayout(const Puzzle& puzzle)
+        : nodeCount(puzzle.width * puzzle.height)
+        , kinds(nodeCount)
+        , computeNodes(nodeCount)
+        , ports(nodeCount * static_cast<size_t>(Neighbor::COUNT))
+        , channelCount(0)
+    {
+        for (int index = 0; index < nodeCount; ++index)
+        {
+            if (puzzle.stackNodes.find(index) != puzzle.stackNodes.end())
+            {
+                kinds[index] = NodeKind::Stack;
+            }
+            else
+            {
+                computeNodes[index].Assemble(puzzle.programs[index]);
+                kinds[index] = IsProgrammed(index) ? NodeKind::Compute : NodeKind::None;
+            }
+        }
+
+        for (int row = 0; row < puzzle.height; ++row)
+        {
+            for (int col = 0; col < puzzle.width; ++col)
+            {
+                int index = row * puzzle.width + col;
+                if (col > 0)
+                    Join(index - 1, Neighbor::RIGHT, index);
+                if (row > 0)
+                    Join(index - puzzle.width, Neighbor::DOWN, index);
+            }
+        }
+
+        AttachIO(puzzle.inputs, NodeKind::Input, &inputPorts);
+        AttachIO(puzzle.outputs, NodeKind::Output, &outputPorts);
+        AttachIO(puzzle.visualization, NodeKind::Visualization, &vizPorts);
+    }
+
+    static size_t PortIndex(int index, Neighbor direction)
+    {
+        return index * static_cast<size_t>(Neighbor::COUNT) + static_cast<size_t>(direction);
+    }
+
+    bool IsProgrammed(int index) const
+    {
+        return computeNodes[index].InstructionCount() > 0;
+    }
+
+    const Port& GetPort(int index, Target target) const
+    {
+        switch (target)
+        {
+        case Target::UP: return ports[PortIndex(index, Neighbor::UP)];
+        case Target::DOWN: return ports[PortIndex(index, Neighbor::DOWN)];
+        case Target::LEFT: return ports[PortIndex(index, Neighbor::LEFT)];
+        case Target::RIGHT: return ports[PortIndex(index, Neighbor::RIGHT)];
+        default:
+            throw std::exception("Target is not a neighbor direction");
+        }
+    }
+
+private:
+    // Unprogrammed compute nodes never read or write, so a channel to one is the same as no channel.
+    void Join(int a, Neighbor directionOfBRelativeToA, int b)
+    {
+        if (kinds[a] == NodeKind::None || kinds[b] == NodeKind::None)
+            return;
+
+        int channel = channelCount++;
+        ports[PortIndex(a, directionOfBRelativeToA)] = Port{ true, 2 * channel, 2 * channel + 1, NodeRef{ kinds[b], b } };
+        ports[PortIndex(b, OppositeNeighbor(directionOfBRelativeToA))] = Port{ true, 2 * channel + 1, 2 * channel, NodeRef{ kinds[a], a } };
+    }
+
+    void AttachIO(const std::vector<Puzzle::IO>& ios, NodeKind kind, std::vector<Port>* pPorts)
+    {
+        for (size_t i = 0; i < ios.size(); ++i)
+        {
+            const Puzzle::IO& io = ios[i];
+            NodeKind gridKind = kinds[io.toNode];
+            if (gridKind == NodeKind::None)
+            {
+                pPorts->push_back(Port{ false, -1, -1, NodeRef{ NodeKind::None, -1 } });
+                continue;
+            }
+
+            int channel = channelCount++;
+            ports[PortIndex(io.toNode, io.direction)] = Port{ true, 2 * channel, 2 * channel + 1, NodeRef{ kind, static_cast<int>(i) } };
+            pPorts->push_back(Port{ true, 2 * channel + 1, 2 * channel, NodeRef{ gridKind, io.toNode } });
+        }
+    }
+};
+
+static const Target s_anyReadOrder[] = { Target::LEFT, Target::RIGHT, Target::UP, Target::DOWN };
+static const Target s_portOrder[] = { Target::UP, Target::DOWN, Target::LEFT, Target::RIGHT };
+
+// Outputs never write, so there is never anything to read from them.
+static bool CanReadFrom(const Port& port)
+{
+    return port.connected && (port.peer.kind != NodeKind::Output) && (port.peer.kind != NodeKind::Visualization);
+}
+
+// Take the value waiting on a port, and tell the sender its write completed.
+static void EmitTakeValue(std::ostream& out, const std::string& indent, const Port& port, const std::string& dest)
+{
+    out << indent << dest << " = s_value[" << port.inEndpoint << "];\n"
+        << indent << "s_pending[" << port.inEndpoint << "] = false;\n"
+        << indent << "WriteComplete_" << NodeName(port.peer) << "();\n";
+}
+
+// Withdraw everything a node has on offer.
+static void EmitCancelWrites(std::ostream& out, const std::string& indent, const GridLayout& layout, int index)
+{
+    for (Target target : s_portOrder)
+    {
+        const Port& port = layout.GetPort(index, target);
+        if (port.connected)
+            out << indent << "s_pending[" << port.outEndpoint << "] = false;\n";
+    }
+}
+
+static void EmitPostWrite(std::ostream& out, const std::string& indent, const Port& port, const std::string& value)
+{
+    if (port.connected)
+    {
+        out << indent << "s_pending[" << port.outEndpoint << "] = true;\n"
+            << indent << "s_value[" << port.outEndpoint << "] = " << value << ";\n";
+    }
+}
+
+static bool IsPortTarget(Target target)
+{
+    return (target != Target::None) && (target != Target::NIL) && (target != Target::ACC) && (target != Target::LAST);
+}
+
+static size_t NextPc(size_t pc, size_t count)
+{
+    return (pc + 1 < count) ? (pc + 1) : 0;
+}
+
+// Where ComputeNode::JumpRelative lands.
+static size_t RelativeTarget(size_t pc, long long offset, size_t count)
+{
+    long long target = static_cast<long long>(pc) + offset;
+    return (target < 0 || target >= static_cast<long long>(count)) ? (count - 1) : static_cast<size_t>(target);
+}
+
+// Code for an instruction's read phase. Returns from the read phase function if the node blocks.
+static void EmitComputeRead(std::ostream& out, const GridLayout& layout, int index, size_t pc)
+{
+    const std::string node = NodeName(NodeRef{ NodeKind::Compute, index });
+    const std::vector<DecodedInstruction>& code = layout.computeNodes[index].Code();
+    const DecodedInstruction& instr = code[pc];
+    const std::string indent = "        ";
+    const size_t next = NextPc(pc, code.size());
+
+    // LAST is never set by ComputeNode, so it always behaves like NIL.
+    std::string operand;
+    switch (instr.src)
+    {
+    case Target::None:
+        operand = std::to_string(instr.immediate);
+        break;
+    case Target::NIL:
+    case Target::LAST:
+        operand = "0";
+        break;
+    case Target::ACC:
+        operand = node + "_acc";
+        break;
+    case Target::ANY:
+    {
+        operand = node + "_temp";
+        out << indent << node << "_state = Read;\n";
+        for (Target target : s_anyReadOrder)
+        {
+            const Port& port = layout.GetPort(index, target);
+            if (!CanReadFrom(port))
+                continue;
+            out << indent << "if (s_pending[" << port.inEndpoint << "])\n"
+                << indent << "{\n";
+            EmitTakeValue(out, indent + "    ", port, operand);
+            out << indent << "    " << node << "_state = Run;\n"
+                << indent << "}\n";
+        }
+        out << indent << "if (" << node << "_state != Run)\n"
+            << indent << "    return;\n";
+    }
+    break;
+    default:
+    {
+        operand = node + "_temp";
+        const Port& port = layout.GetPort(index, instr.src);
+        out << indent << node << "_state = Read;\n";
+        if (CanReadFrom(port))
+        {
+            out << indent << "if (!s_pending[" << port.inEndpoint << "])\n"
+                << indent << "    return;\n";
+            EmitTakeValue(out, indent, port, operand);
+            out << indent << node << "_state = Run;\n";
+        }
+        else
+        {
+            out << indent << "return;\n";
+            return;
+        }
+    }
+    break;
+    }
+
+    const std::string pcVar = node + "_pc";
+    switch (instr.op)
+    {
+    case Opcode::NOP:
+        break;
+    case Opcode::MOV:
+        if (instr.dst == Target::ACC)
+        {
+            out << indent << node << "_acc = " << operand << ";\n";
+        }
+        else if (IsPortTarget(instr.dst))
+        {
+            if (operand != node + "_temp")
+                out << indent << node << "_temp = " << operand << ";\n";
+            out << indent << node << "_write = true;\n";
+            return;
+        }
+        break;
+    case Opcode::ADD:
+        out << indent << node << "_acc += " << operand << ";\n";
+        break;
+    case Opcode::SUB:
+        out << indent << node << "_acc -= " << operand << ";\n";
+        break;
+    case Opcode::SAV:
+        out << indent << node << "_bak = " << node << "_acc;\n";
+        break;
+    case Opcode::SWP:
+        out << indent << "std::swap(" << node << "_acc, " << node << "_bak);\n";
+        break;
+    case Opcode::JMP:
+        out << indent << pcVar << " = " << instr.jumpTarget << ";\n";
+        return;
+    case Opcode::JEZ:
+    case Opcode::JNZ:
+    case Opcode::JGZ:
+    case Opcode::JLZ:
+    {
+        const char* condition = (instr.op == Opcode::JEZ) ? " == 0"
+            : (instr.op == Opcode::JNZ) ? " != 0"
+            : (instr.op == Opcode::JGZ) ? " > 0"
+            : " < 0";
+        out << indent << pcVar << " = (" << node << "_acc" << condition << ") ? " << instr.jumpTarget << " : " << next << ";\n";
+        return;
+    }
+    case Opcode::JRO:
+        if (instr.src == Target::None || instr.src == Target::NIL || instr.src == Target::LAST)
+        {
+            out << indent << pcVar << " = " << RelativeTarget(pc, (instr.src == Target::None) ? instr.immediate : 0, code.size()) << ";\n";
+        }
+        else
+        {
+            out << indent << "{\n"
+                << indent << "    long long target = " << pc << "LL + " << operand << ";\n"
+                << indent << "    " << pcVar << " = (target < 0 || target >= " << code.size() << ") ? " << (code.size() - 1) << " : static_cast<int>(target);\n"
+                << indent << "}\n";
+        }
+        return;
+    case Opcode::HCF:
+        out << indent << "throw std::runtime_error(\"halt and catch fire\");\n";
+        return;
+    default:
+        throw std::exception("invalid opcode");
+    }
+
+    out << indent << pcVar << " = " << next << ";\n";
+}
+
+static void EmitComputeNode(std::ostream& out, const GridLayout& layout, int index)
+{
+    const std::string node = NodeName(NodeRef{ NodeKind::Compute, index });
+    const std::vector<DecodedInstruction>& code = layout.computeNodes[index].Code();
+    out << "static int " << node << "_acc, " << node << "_bak, " << node << "_temp, " << node << "_pc, " << node << "_state;\n"
+        << "static bool " << node << "_write;\n\n";
+
+    out << "static void WriteComplete_" << node << "()\n"
+        << "{\n"
+        << "    " << node << "_state = WriteComplete;\n";
+    bool anyWrites = false;
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        if (code[pc].op == Opcode::MOV && code[pc].dst == Target::ANY)
+        {
+            if (!anyWrites)
+                out << "    switch (" << node << "_pc)\n    {\n";
+            anyWrites = true;
+            out << "    case " << pc << ":\n";
+        }
+    }
+    if (anyWrites)
+    {
+        out << "        // Cancel the other writes.\n";
+        EmitCancelWrites(out, "        ", layout, index);
+        out << "        break;\n    }\n";
+    }
+    out << "}\n\n";
+
+    out << "static void ReadPhase_" << node << "()\n"
+        << "{\n"
+        << "    if (" << node << "_state != Run && " << node << "_state != Read)\n"
+        << "        return;\n\n"
+        << "    switch (" << node << "_pc)\n"
+        << "    {\n";
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        out << "    case " << pc << ":\n";
+        EmitComputeRead(out, layout, index, pc);
+        out << "        break;\n";
+    }
+    out << "    }\n"
+        << "}\n\n";
+
+    out << "static void WritePhase_" << node << "()\n"
+        << "{\n"
+        << "    if (" << node << "_write)\n"
+        << "    {\n"
+        << "        " << node << "_write = false;\n"
+        << "        " << node << "_state = Write;\n"
+        << "        switch (" << node << "_pc)\n"
+        << "        {\n";
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        const DecodedInstruction& instr = code[pc];
+        if (instr.op != Opcode::MOV || !IsPortTarget(instr.dst))
+            continue;
+
+        out << "        case " << pc << ":\n";
+        if (instr.dst == Target::ANY)
+        {
+            for (Target target : s_portOrder)
+                EmitPostWrite(out, "            ", layout.GetPort(index, target), node + "_temp");
+        }
+        else
+        {
+            EmitPostWrite(out, "            ", layout.GetPort(index, instr.dst), node + "_temp");
+        }
+        out << "            break;\n";
+    }
+    out << "        }\n"
+        << "    }\n"
+        << "    else if (" << node << "_state == WriteComplete)\n"
+        << "    {\n"
+        << "        " << node << "_state = Run;\n"
+        << "        " << node << "_pc = (" << node << "_pc + 1 < " << code.size() << ") ? (" << node << "_pc + 1) : 0;\n"
+        << "    }\n"
+        << "}\n\n";
+}
+
+static void EmitStackNode(std::ostream& out, const GridLayout& layout, int index)
+{
+    const std::string node = NodeName(NodeRef{ NodeKind::Stack, index });
+    out << "static std::vector<int> " << node << "_data;\n"
+        << "static bool " << node << "_writeReady;\n\n";
+
+    out << "static void WriteComplete_" << node << "()\n"
+        << "{\n"
+        << "    " << node << "_data.pop_back();\n";
+    EmitCancelWrites(out, "    ", layout, index);
+    out << "    " << node << "_writeReady = true;\n"
+        << "}\n\n";
+
+    out << "static void ReadPhase_" << node << "()\n"
+        << "{\n";
+    bool first = true;
+    for (Target target : s_portOrder)
+    {
+        const Port& port = layout.GetPort(index, target);
+        if (!CanReadFrom(port))
+            continue;
+        out << "    " << (first ? "" : "else ") << "if (s_pending[" << port.inEndpoint << "])\n"
+            << "    {\n"
+            << "        int value;\n";
+        EmitTakeValue(out, "        ", port, "value");
+        out << "        " << node << "_data.push_back(value);\n";
+        EmitCancelWrites(out, "        ", layout, index);
+        out << "        " << node << "_writeReady = true;\n"
+            << "    }\n";
+        first = false;
+    }
+    out << "}\n\n";
+
+    out << "static void WritePhase_" << node << "()\n"
+        << "{\n"
+        << "    if (!" << node << "_writeReady || " << node << "_data.empty())\n"
+        << "        return;\n"
+        << "    " << node << "_writeReady = false;\n";
+    for (Target target : s_portOrder)
+        EmitPostWrite(out, "    ", layout.GetPort(index, target), node + "_data.back()");
+    out << "}\n\n";
+}
+
+static void EmitData(std::ostream& out, const std::string& name, const std::vector<int>& data)
+{
+    out << "static const int " << name << "[] = {";
+    if (data.empty())
+    {
+        out << " 0";
+    }
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        out << ((i % 20 == 0) ? "\n    " : " ") << data[i] << ",";
+    }
+    out << "\n};\n";
+}
+
+static std::string Escape(const std::string& text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped.push_back('\\');
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+void TranspileSolution(
+    const Puzzle& puzzle,
+    int puzzleNumber,
+    const std::string& puzzleName,
+    const std::vector<Puzzle>& testSets,
+    std::ostream& out
+    )
+{
+    GridLayout layout(puzzle);
+
+    size_t inputCount = puzzle.inputs.size();
+    size_t outputCount = puzzle.outputs.size();
+    size_t vizCount = puzzle.visualization.size();
+    int vizWidth = puzzle.visualizationWidth;
+    int vizHeight = puzzle.visualizationHeight;
+
+    int nodeCount = 0;
+    int instructionCount = 0;
+    for (int index = 0; index < layout.nodeCount; ++index)
+    {
+        if (layout.kinds[index] == NodeKind::Compute)
+        {
+            ++nodeCount;
+            instructionCount += layout.computeNodes[index].InstructionCount();
+        }
+    }
+
+    out << "// Generated by TIS-100 Simulator: puzzle " << puzzleNumber << " (" << puzzleName << ").\n"
+        << "//\n"
+        << "// usage: <program> [cycle limit] [bench iterations]\n"
+        << "\n"
+        << "#include <algorithm>\n"
+        << "#include <chrono>\n"
+        << "#include <cstdio>\n"
+        << "#include <cstdlib>\n"
+        << "#include <stdexcept>\n"
+        << "#include <vector>\n"
+        << "\n"
+        << "enum { Run, Read, Write, WriteComplete };\n"
+        << "enum { Ready = Run };\n"
+        << "enum { ReadX, ReadY, ReadValues };\n"
+        << "\n"
+        << "static const int InputCount = " << inputCount << ";\n"
+        << "static const int OutputCount = " << outputCount << ";\n"
+        << "static const int VizCount = " << vizCount << ";\n"
+        << "static const int VizWidth = " << vizWidth << ";\n"
+        << "static const int VizHeight = " << vizHeight << ";\n"
+        << "\n"
+        << "struct TestSet\n"
+        << "{\n"
+        << "    const int* inputs[InputCount + 1];\n"
+        << "    int inputSizes[InputCount + 1];\n"
+        << "    const int* outputs[OutputCount + 1];\n"
+        << "    int outputSizes[OutputCount + 1];\n"
+        << "    const int* viz[VizCount + 1];\n"
+        << "    int vizSizes[VizCount + 1];\n"
+        << "};\n"
+        << "\n";
+
+    for (size_t t = 0; t < testSets.size(); ++t)
+    {
+        const std::string prefix = "s_set" + std::to_string(t);
+        for (size_t i = 0; i < inputCount; ++i)
+            EmitData(out, prefix + "_in" + std::to_string(i), testSets[t].inputs[i].data);
+        for (size_t i = 0; i < outputCount; ++i)
+            EmitData(out, prefix + "_out" + std::to_string(i), testSets[t].outputs[i].data);
+        for (size_t i = 0; i < vizCount; ++i)
+            EmitData(out, prefix + "_viz" + std::to_string(i), testSets[t].visualization[i].data);
+    }
+
+    out << "\nstatic const TestSet s_testSets[] = {\n";
+    for (size_t t = 0; t < testSets.size(); ++t)
+    {
+        const std::string prefix = "s_set" + std::to_string(t);
+        auto list = [&out, &prefix](const char* kind, const std::vector<Puzzle::IO>& ios)
+        {
+            out << "{ ";
+            for (size_t i = 0; i < ios.size(); ++i)
+                out << prefix << "_" << kind << i << ", ";
+            out << "nullptr }, { ";
+            for (size_t i = 0; i < ios.size(); ++i)
+                out << ios[i].data.size() << ", ";
+            out << "0 }";
+        };
+        out << "    { ";
+        list("in", testSets[t].inputs);
+        out << ", ";
+        list("out", testSets[t].outputs);
+        out << ", ";
+        list("viz", testSets[t].visualization);
+        out << " },\n";
+    }
+    out << "};\n\n";
+
+    out << "static const TestSet* s_set;\n"
+        << "static bool s_pending[" << (2 * layout.channelCount + 1) << "];\n"
+        << "static int s_value[" << (2 * layout.channelCount + 1) << "];\n"
+        << "static bool s_failed;\n"
+        << "\n"
+        << "static struct { int state; int position; } s_inputs[InputCount + 1];\n"
+        << "static int s_outputCounts[OutputCount + 1];\n"
+        << "\n"
+        << "static struct\n"
+        << "{\n"
+        << "    int state;\n"
+        << "    size_t x, y;\n"
+        << "    int cells[VizWidth * VizHeight];\n"
+        << "    int mismatches;\n"
+        << "} s_viz[VizCount + 1];\n"
+        << "\n";
+
+    // Forward declarations, since nodes call each other's WriteComplete.
+    for (int index = 0; index < layout.nodeCount; ++index)
+    {
+        if (layout.kinds[index] == NodeKind::Compute || layout.kinds[index] == NodeKind::Stack)
+            out << "static void WriteComplete_" << NodeName(NodeRef{ layout.kinds[index], index }) << "();\n";
+    }
+    for (size_t i = 0; i < inputCount; ++i)
+    {
+        out << "static void WriteComplete_in" << i << "() { s_inputs[" << i << "].state = WriteComplete; }\n";
+    }
+    out << "\n";
+
+    out << "static void RecordOutput(int output, int value)\n"
+        << "{\n"
+        << "    int& count = s_outputCounts[output];\n"
+        << "    if (count >= s_set->outputSizes[output] || s_set->outputs[output][count] != value)\n"
+        << "        s_failed = true;\n"
+        << "    ++count;\n"
+        << "}\n\n";
+
+    // Same as VisualizationNode::ReadData, but keeping count of cells that differ from the expected
+    // image instead of comparing the whole image every cycle.
+    out << "static size_t Clamp(int value, size_t max)\n"
+        << "{\n"
+        << "    if (value < 0)\n"
+        << "        return 0;\n"
+        << "    return (static_cast<size_t>(value) > max) ? max : static_cast<size_t>(value);\n"
+        << "}\n\n"
+        << "static int ExpectedCell(int viz, size_t cell)\n"
+        << "{\n"
+        << "    return (static_cast<int>(cell) < s_set->vizSizes[viz]) ? s_set->viz[viz][cell] : 0;\n"
+        << "}\n\n"
+        << "static void RecordVisualization(int viz, int value)\n"
+        << "{\n"
+        << "    auto& v = s_viz[viz];\n"
+        << "    switch (v.state)\n"
+        << "    {\n"
+        << "    case ReadX:\n"
+        << "        v.x = Clamp(value, VizWidth);\n"
+        << "        v.state = ReadY;\n"
+        << "        break;\n"
+        << "    case ReadY:\n"
+        << "        v.y = Clamp(value, VizHeight);\n"
+        << "        v.state = ReadValues;\n"
+        << "        break;\n"
+        << "    case ReadValues:\n"
+        << "        if (value < 0)\n"
+        << "        {\n"
+        << "            v.state = ReadX;\n"
+        << "            v.x = v.y = static_cast<size_t>(-1);\n"
+        << "        }\n"
+        << "        else if (v.x < VizWidth && v.y < VizHeight)\n"
+        << "        {\n"
+        << "            size_t cell = v.y * VizWidth + v.x;\n"
+        << "            int expected = ExpectedCell(viz, cell);\n"
+        << "            v.mismatches += (value != expected) - (v.cells[cell] != expected);\n"
+        << "            v.cells[cell] = value;\n"
+        << "            ++v.x;\n"
+        << "        }\n"
+        << "        break;\n"
+        << "    }\n"
+        << "}\n\n";
+
+    for (int index = 0; index < layout.nodeCount; ++index)
+    {
+        if (layout.kinds[index] == NodeKind::Compute)
+            EmitComputeNode(out, layout, index);
+        else if (layout.kinds[index] == NodeKind::Stack)
+            EmitStackNode(out, layout, index);
+    }
+
+    // One cycle.
+    out << "static void Step()\n"
+        << "{\n";
+    for (size_t i = 0; i < outputCount; ++i)
+    {
+        const Port& port = layout.outputPorts[i];
+        if (!port.connected)
+            continue;
+        out << "    if (s_pending[" << port.inEndpoint << "])\n"
+            << "    {\n"
+            << "        int value;\n";
+        EmitTakeValue(out, "        ", port, "value");
+        out << "        RecordOutput(" << i << ", value);\n"
+            << "    }\n";
+    }
+    for (size_t i = 0; i < vizCount; ++i)
+    {
+        const Port& port = layout.vizPorts[i];
+        if (!port.connected)
+            continue;
+        out << "    if (s_pending[" << port.inEndpoint << "])\n"
+            << "    {\n"
+            << "        int value;\n";
+        EmitTakeValue(out, "        ", port, "value");
+        out << "        RecordVisualization(" << i << ", value);\n"
+            << "    }\n";
+    }
+    for (NodeKind kind : { NodeKind::Compute, NodeKind::Stack })
+    {
+        for (int index = 0; index < layout.nodeCount; ++index)
+        {
+            if (layout.kinds[index] == kind)
+                out << "    ReadPhase_" << NodeName(NodeRef{ kind, index }) << "();\n";
+        }
+    }
+    out << "\n";
+    for (size_t i = 0; i < inputCount; ++i)
+    {
+        const Port& port = layout.inputPorts[i];
+        out << "    if (s_inputs[" << i << "].state == WriteComplete)\n"
+            << "    {\n"
+            << "        s_inputs[" << i << "].state = Ready;\n"
+            << "        ++s_inputs[" << i << "].position;\n"
+            << "    }\n"
+            << "    else if (s_inputs[" << i << "].state == Ready && s_inputs[" << i << "].position < s_set->inputSizes[" << i << "])\n"
+            << "    {\n"
+            << "        s_inputs[" << i << "].state = Write;\n";
+        EmitPostWrite(out, "        ", port, "s_set->inputs[" + std::to_string(i) + "][s_inputs[" + std::to_string(i) + "].position]");
+        out << "    }\n";
+    }
+    for (NodeKind kind : { NodeKind::Compute, NodeKind::Stack })
+    {
+        for (int index = 0; index < layout.nodeCount; ++index)
+        {
+            if (layout.kinds[index] == kind)
+                out << "    WritePhase_" << NodeName(NodeRef{ kind, index }) << "();\n";
+        }
+    }
+    out << "}\n\n";
+
+    // Reset and run, with the same cycle counting as RunProgramAndTest.
+    out << "static void Initialize(const TestSet& set)\n"
+        << "{\n"
+        << "    s_set = &set;\n"
+        << "    std::fill(std::begin(s_pending), std::end(s_pending), false);\n"
+        << "    s_failed = false;\n"
+        << "    for (auto& input : s_inputs)\n"
+        << "        input = { Ready, 0 };\n"
+        << "    std::fill(std::begin(s_outputCounts), std::end(s_outputCounts), 0);\n"
+        << "    for (int i = 0; i < VizCount; ++i)\n"
+        << "    {\n"
+        << "        s_viz[i].state = ReadX;\n"
+        << "        std::fill(std::begin(s_viz[i].cells), std::end(s_viz[i].cells), 0);\n"
+        << "        s_viz[i].mismatches = 0;\n"
+        << "        for (size_t cell = 0; cell < VizWidth * VizHeight; ++cell)\n"
+        << "            s_viz[i].mismatches += (ExpectedCell(i, cell) != 0);\n"
+        << "    }\n";
+    for (int index = 0; index < layout.nodeCount; ++index)
+    {
+        if (layout.kinds[index] == NodeKind::Compute)
+        {
+            std::string node = NodeName(NodeRef{ NodeKind::Compute, index });
+            out << "    " << node << "_acc = " << node << "_bak = " << node << "_temp = " << node << "_pc = 0;\n"
+                << "    " << node << "_state = Run;\n"
+                << "    " << node << "_write = false;\n";
+        }
+        else if (layout.kinds[index] == NodeKind::Stack)
+        {
+            std::string node = NodeName(NodeRef{ NodeKind::Stack, index });
+            out << "    " << node << "_data.clear();\n"
+                << "    " << node << "_writeReady = true;\n";
+        }
+    }
+    out << "}\n\n"
+        << "static bool IsFinished(bool* pIsFailure)\n"
+        << "{\n"
+        << "    if (s_failed)\n"
+        << "    {\n"
+        << "        *pIsFailure = true;\n"
+        << "        return true;\n"
+        << "    }\n"
+        << "    for (int i = 0; i < OutputCount; ++i)\n"
+        << "    {\n"
+        << "        if (s_outputCounts[i] != s_set->outputSizes[i])\n"
+        << "            return false;\n"
+        << "    }\n"
+        << "    for (int i = 0; i < VizCount; ++i)\n"
+        << "    {\n"
+        << "        if (s_viz[i].mismatches != 0)\n"
+        << "            return false;\n"
+        << "    }\n"
+        << "    *pIsFailure = false;\n"
+        << "    return true;\n"
+        << "}\n\n"
+        << "static bool RunProgramAndTest(const TestSet& set, int cycleLimit, int* pCycleCount)\n"
+        << "{\n"
+        << "    Initialize(set);\n"
+        << "\n"
+        << "    bool isFailure = false;\n"
+        << "    while (!IsFinished(&isFailure))\n"
+        << "    {\n"
+        << "        ++(*pCycleCount);\n"
+        << "\n"
+        << "        if (*pCycleCount == cycleLimit)\n"
+        << "            return false;\n"
+        << "\n"
+        << "        Step();\n"
+        << "    }\n"
+        << "\n"
+        << "    return !isFailure;\n"
+        << "}\n\n";
+
+    out << "int main(int argc, char** argv)\n"
+        << "{\n"
+        << "    int cycleLimit = (argc > 1) ? atoi(argv[1]) : 0;\n"
+        << "    int iterations = (argc > 2) ? atoi(argv[2]) : 0;\n"
+        << "\n"
+        << "    printf(\"" << puzzleNumber << ": " << Escape(puzzleName) << " - " << nodeCount << " nodes, "
+        << instructionCount << " instructions.\\n\");\n"
+        << "\n"
+        << "    for (const TestSet& set : s_testSets)\n"
+        << "    {\n"
+        << "        int cycleCount = 0;\n"
+        << "        bool success = false;\n"
+        << "        try\n"
+        << "        {\n"
+        << "            success = RunProgramAndTest(set, cycleLimit, &cycleCount);\n"
+        << "        }\n"
+        << "        catch (const std::exception& ex)\n"
+        << "        {\n"
+        << "            printf(\"%s\\n\", ex.what());\n"
+        << "            return 1;\n"
+        << "        }\n"
+        << "        printf(\"\\t%s in %d cycles.\\n\", success ? \"success\" : \"failure\", cycleCount);\n"
+        << "\n"
+        << "        if (iterations > 0)\n"
+        << "        {\n"
+        << "            long long totalCycles = 0;\n"
+        << "            auto start = std::chrono::steady_clock::now();\n"
+        << "            for (int i = 0; i < iterations; ++i)\n"
+        << "            {\n"
+        << "                cycleCount = 0;\n"
+        << "                RunProgramAndTest(set, cycleLimit, &cycleCount);\n"
+        << "                totalCycles += cycleCount;\n"
+        << "            }\n"
+        << "            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;\n"
+        << "            printf(\"\\t\\t%d runs in %g s: %lld cycles/sec.\\n\", iterations, elapsed.count(),\n"
+        << "                static_cast<long long>(totalCycles / elapsed.count()));\n"
+        << "        }\n"
+        << "    }\n"
+        << "\n"
+        << "    return 0;\n"
+        << "}\n";
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+// Write out a standalone C++ program that runs one solution to a puzzle against fixed test sets.
+//
+// Everything that a ComputeGrid works out at runtime is hard-coded: each node's program becomes a
+// switch over its PC with constant operands and branch targets, and each channel in the grid
+// becomes a pair of fixed variables. The program reports success/failure and cycle counts in the
+// same format as DoTest.
+//
+// Formal Parameters:
+//  puzzle: the puzzle, with the solution's programs filled in.
+//  puzzleNumber, puzzleName: identify the puzzle in the generated output.
+//  testSets: inputs and expected outputs to embed in the program; the programs in these are ignored.
+//  out: receives the C++ source.
+//
+// Throws if any of the programs fail to assemble.
+void TranspileSolution(
+    const Puzzle& puzzle,
+    int puzzleNumber,
+    const std::string& puzzleName,
+    const std::vector<Puzzle>& testSets,
+    std::ostream& out
+    );
\ No newline at end of file
@@ -1,9 +1,9 @@
 #include "pch.h"
 #include "Node.h"
+#include "IOChannel.h"
 #include "OutputBase.h"
 #include "Grid.h"
 #include "VisualizationNode.h"
-#include "IOChannel.h"
 
 VisualizationNode::VisualizationNode(size_t width, size_t height)
     : m_state(State::ReadX)
@@ -65,3 +65,24 @@ void VisualizationNode::ReadData(int value)
         break;
     }
 }
+
+void VisualizationNode::SaveState(std::vector<int>& state) const
+{
+    state.push_back(static_cast<int>(m_state));
+    state.push_back(static_cast<int>(m_xPosition));
+    state.push_back(static_cast<int>(m_yPosition));
+    for (size_t i = 0, n = Grid.Width() * Grid.Height(); i < n; ++i)
+        state.push_back(Grid[i]);
+}
+
+const int* VisualizationNode::RestoreState(const int* state)
+{
+    // The positions are all ones when unset, which survive the round trip through int.
+    m_state = static_cast<State>(state[0]);
+    m_xPosition = static_cast<size_t>(state[1]);
+    m_yPosition = static_cast<size_t>(state[2]);
+    state += 3;
+    for (size_t i = 0, n = Grid.Width() * Grid.Height(); i < n; ++i)
+        Grid[i] = *state++;
+    return state;
+}
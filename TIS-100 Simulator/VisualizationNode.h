@@ -1,6 +1,6 @@
 #pragma once
 
-class VisualizationNode : public OutputBase
+class VisualizationNode final : public OutputBase
 {
 private:
     enum class State
@@ -20,4 +20,6 @@ public:
     VisualizationNode(size_t width, size_t height);
     virtual void Initialize() override;
     virtual void ReadData(int value) override;
+    virtual void SaveState(std::vector<int>& state) const override;
+    virtual const int* RestoreState(const int* state) override;
 };
\ No newline at end of file
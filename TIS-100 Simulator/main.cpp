@@ -1,24 +1,92 @@
 #include "pch.h"
+#include "AllocationCounter.h"
 #include "Node.h"
+#include "Arena.h"
+#include "IOChannel.h"
 #include "InputNode.h"
 #include "OutputBase.h"
 #include "OutputNode.h"
+#include "Engine.h"
 #include "ComputeNode.h"
+#include "Jit.h"
+#include "Superinstructions.h"
+#include "SuperinstructionMiner.h"
 #include "StackMemoryNode.h"
 #include "Grid.h"
 #include "VisualizationNode.h"
 #include "Puzzle.h"
+#include "Constants.h"
+#include "PuzzleLayout.h"
+#include "Lanes.h"
+#include "FlatGrid.h"
+#include "MemoGrid.h"
+#include "ParallelGrid.h"
+#include "TimeWarpGrid.h"
 #include "ComputeGrid.h"
+#include "GridPool.h"
+#include "BatchGrid.h"
 
-#include "Constants.h"
+#include "Transpiler.h"
 
 std::default_random_engine g_RandomEngine;
 
+// The engines -engine auto has picked, by solution (see SolutionKey), so that the same ones can be
+// used from one run to the next.
+typedef std::map<std::string, Engine> EngineChoices;
+
+// Command-line options that apply to every test.
+struct Options
+{
+    // How to execute the grid.
+    Engine engine;
+
+    // If set, engine is ignored, and each solution is run with whichever engine was fastest at
+    // running it for calibrationCycles cycles (see SelectEngine).
+    bool autoEngine;
+    int calibrationCycles;
+
+    // If set, with autoEngine, the engines in pChoices are used for the solutions they have one for,
+    // instead of timing them again, and the choices are written back here afterwards.
+    const wchar_t* choicesPath;
+    EngineChoices* pChoices;
+
+    // If non-zero, each test run is repeated this many times and the simulation speed is reported.
+    int benchIterations;
+
+    // If set, the solution is written out as a standalone C++ program here instead of being run.
+    const wchar_t* transpilePath;
+
+    // How many test sets to run, or to embed in a transpiled program.
+    int testSetCount;
+
+    // If set, solutions are profiled instead of being run, and the runs of instructions most worth
+    // making into superinstructions are written here.
+    const wchar_t* superinstructionPath;
+
+    // Collects the profiles, when superinstructionPath is set.
+    SuperinstructionMiner* pMiner;
+
+    // The most memory, in megabytes, that Engine::Memo can use to remember what the grid did.
+    size_t memoMegabytes;
+
+    // If non-zero, the synthetic puzzle is run on a grid this size, instead of a save file (see
+    // GetSyntheticPuzzle).
+    int syntheticWidth;
+    int syntheticHeight;
+
+    // The most threads that Engine::Parallel and Engine::TimeWarp can use, or 0 for one per core.
+    int threadCount;
+
+    // If more than 1, the most test sets to run at once, each on its own clone of the grid (see
+    // RunConcurrentTests).
+    int concurrentTestSets;
+};
+
 // Read a save file.
 //
 // Formal Parameters:
 //  path: path to the save file.
-//  programs: array of strings set to the corresponding assembly text for each node.
+//  programs: strings set to the corresponding assembly text for each node.
 //  badNodes: the indices of non-functional nodes in the puzzle.
 //  stackNodes: the indices of stack memory nodes in the puzzle.
 //
@@ -27,7 +95,7 @@ std::default_random_engine g_RandomEngine;
 // the working ComputeNode programs.)
 void ReadSaveFile(
     const wchar_t* path,
-    std::string programs[NodeGridCount],
+    std::vector<std::string>& programs,
     const std::set<int>& badNodes,
     const std::set<int>& stackNodes
     )
@@ -72,25 +140,48 @@ void ReadSaveFile(
 //  puzzle: the puzzle to test.
 //  grid: assembled and programmed node grid corresponding to the puzzle.
 //  cycleLimit: if non-zero, the maximum number of cycles to execute before assuming failure.
+//              Otherwise the program fails once the cycle count can't go any higher.
 //  pCycleCount: receives the number of cycles the program ran for, either to successful
 //               completion, or until the first mismatched output value.
+//  pStop: if not null, the program is stopped as soon as this is set, as though it had failed.
+//  pStopped: if not null, receives whether pStop stopped the program.
 //
 // Returns true if the program produced the desired output, or false if the output did not match.
 bool RunProgramAndTest(
     const Puzzle& puzzle,
-    ComputeGrid<NodeGridHeight, NodeGridWidth>& grid,
+    ComputeGrid& grid,
     int cycleLimit,
-    int* pCycleCount
+    int* pCycleCount,
+    const std::atomic<bool>* pStop = nullptr,
+    bool* pStopped = nullptr
     )
 {
     grid.Initialize();
+    if (pStopped != nullptr)
+        *pStopped = false;
+
+    int maxCycleCount = (cycleLimit > 0) ? cycleLimit : std::numeric_limits<int>::max();
 
     bool isFailure = false;
     while (!grid.IsFinished(puzzle, &isFailure))
     {
+        if ((pStop != nullptr) && pStop->load(std::memory_order_relaxed))
+        {
+            if (pStopped != nullptr)
+                *pStopped = true;
+            return false;
+        }
+
+        // Skip over cycles that can't change the output, or have been run before, counting them
+        // as the rest of this loop would. They may have finished the outputs.
+        int skipped = grid.FastForward(puzzle, maxCycleCount - *pCycleCount - 1, pStop);
+        *pCycleCount += skipped;
+        if ((skipped > 0) && grid.IsFinished(puzzle, &isFailure))
+            break;
+
         ++(*pCycleCount);
 
-        if (*pCycleCount == cycleLimit)
+        if (*pCycleCount == maxCycleCount)
             return false;
 
 #ifdef DEBUG_OUTPUT
@@ -103,15 +194,617 @@ bool RunProgramAndTest(
     return !isFailure;
 }
 
-int DoTest(int puzzleNumber, const wchar_t* saveFilePath, int cycleLimit)
+// Time each engine running a program for the same number of cycles, and return the fastest.
+//
+// The engines are timed in turn, three times over, and each is judged by its fastest time so that
+// one slow run doesn't count against it. Engines that come within a tenth of the fastest are too
+// close for the timings to tell apart reliably, so the first of them listed is picked. That keeps
+// the choice steady, but it still rests on timings, so a busy machine can change it; -choices pins
+// it down (see EngineChoices). Memo is left out, since it would just remember the calibration runs,
+// and so is Batch, which is only any different with more than one test set at once. Jit is left
+// out of builds it isn't supported in, where it would only time the threaded handlers again.
+//
+// Formal Parameters:
+//  puzzle: the test set to run.
+//  grid: the program's grid; its engine is left set to the one returned.
+//  cycleLimit: if non-zero, the most cycles to run the program for at once.
+//  calibrationCycles: how many cycles to time each engine for.
+//  pTimes: receives each engine timed, with its fastest time in seconds.
+Engine SelectEngine(
+    const Puzzle& puzzle,
+    ComputeGrid& grid,
+    int cycleLimit,
+    int calibrationCycles,
+    std::vector<std::pair<Engine, double>>* pTimes
+    )
+{
+    constexpr int Rounds = 3;
+
+    std::vector<Engine> engines;
+    for (const auto& pair : s_engineNames)
+    {
+        if ((pair.second == Engine::Jit) && !JitCompiler::IsSupported())
+            continue;
+        if ((pair.second != Engine::Memo) && (pair.second != Engine::Batch) && grid.CanRunEngine(pair.second))
+            engines.push_back(pair.second);
+    }
+
+    std::vector<double> bestTimes(engines.size(), std::numeric_limits<double>::infinity());
+    for (int round = 0; round < Rounds; ++round)
+    {
+        for (size_t i = 0; i < engines.size(); ++i)
+        {
+            grid.SetEngine(engines[i]);
+
+            auto start = std::chrono::steady_clock::now();
+            for (int cycles = 0; cycles < calibrationCycles;)
+            {
+                int limit = calibrationCycles - cycles;
+                if (cycleLimit > 0)
+                    limit = std::min(limit, cycleLimit);
+
+                int cycleCount = 0;
+                RunProgramAndTest(puzzle, grid, limit, &cycleCount);
+                cycles += std::max(cycleCount, 1);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            bestTimes[i] = std::min(bestTimes[i], elapsed.count());
+        }
+    }
+
+    pTimes->clear();
+    for (size_t i = 0; i < engines.size(); ++i)
+        pTimes->emplace_back(engines[i], bestTimes[i]);
+
+    double fastest = *std::min_element(bestTimes.begin(), bestTimes.end());
+    size_t best = 0;
+    while (bestTimes[best] > fastest * 1.1)
+        ++best;
+
+    grid.SetEngine(engines[best]);
+    return engines[best];
+}
+
+// Report how often the port reads in each node went on to instructions that were looked up instead
+// of run (see ComputeNode::Transducer). Only the threaded engines do that.
+void ReportTransducers(const ComputeGrid& grid)
+{
+    for (const ComputeNode* node : grid.ProgrammedNodes())
+    {
+        int64_t reads;
+        int64_t hits;
+        node->GetTransducerStats(&reads, &hits);
+        if (reads > 0)
+        {
+            std::cout << "\tnode " << node->NodeId << ": " << hits << " of " << reads
+                << " reads looked up.\n";
+        }
+    }
+}
+
+// Time repeated runs of a program, and report how many cycles per second were simulated, and how
+// many heap allocations each run made.
+void BenchProgram(
+    const Puzzle& puzzle,
+    ComputeGrid& grid,
+    int cycleLimit,
+    int iterations
+    )
+{
+    long long totalCycles = 0;
+    size_t allocationCount = AllocationCount();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        int cycleCount = 0;
+        RunProgramAndTest(puzzle, grid, cycleLimit, &cycleCount);
+        totalCycles += cycleCount;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    allocationCount = AllocationCount() - allocationCount;
+
+    std::cout << "\t\t" << iterations << " runs in " << elapsed.count() << " s: "
+        << static_cast<long long>(totalCycles / elapsed.count()) << " cycles/sec, "
+        << static_cast<double>(allocationCount) / iterations << " allocations/run.\n";
+}
+
+// How a test set run by RunTestSetsAtOnce went.
+struct TestSetResult
+{
+    enum class Outcome
+    {
+        Success,
+        Failure,
+        Cancelled, // stopped, or never started, because another test set failed first
+        Error,
+    };
+
+    Outcome outcome;
+    int cycleCount;
+    std::string error;
+};
+
+// Run each test set on its own grid, up to threadCount of them at once, and cancel the rest as soon
+// as one fails.
+std::vector<TestSetResult> RunTestSetsAtOnce(
+    const std::vector<Puzzle>& testSets,
+    const std::vector<ComputeGrid*>& grids,
+    int cycleLimit,
+    int threadCount
+    )
+{
+    std::vector<TestSetResult> results(testSets.size());
+    std::atomic<size_t> next(0);
+    std::atomic<bool> stop(false);
+
+    auto work = [&]()
+    {
+        for (size_t i = next++; i < testSets.size(); i = next++)
+        {
+            TestSetResult& result = results[i];
+            result = TestSetResult{ TestSetResult::Outcome::Cancelled, 0, std::string() };
+            if (stop)
+                continue;
+
+            try
+            {
+                bool stopped;
+                if (RunProgramAndTest(testSets[i], *grids[i], cycleLimit, &result.cycleCount, &stop, &stopped))
+                    result.outcome = TestSetResult::Outcome::Success;
+                else if (!stopped)
+                    result.outcome = TestSetResult::Outcome::Failure;
+            }
+            catch (std::exception ex)
+            {
+                result.outcome = TestSetResult::Outcome::Error;
+                result.error = ex.what();
+            }
+
+            if ((result.outcome == TestSetResult::Outcome::Failure) || (result.outcome == TestSetResult::Outcome::Error))
+                stop = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min<size_t>(threadCount, testSets.size()); ++i)
+        threads.emplace_back(work);
+    work();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    return results;
+}
+
+// Run a solution against its test sets at once, each on a clone of the grid (test set 0 runs on the
+// grid itself), and report the results in the same form as running them one at a time.
+int RunConcurrentTests(
+    ComputeGrid& grid,
+    const std::vector<Puzzle>& testSets,
+    int cycleLimit,
+    int threadCount,
+    int benchIterations
+    )
+{
+    std::vector<std::unique_ptr<ComputeGrid>> clones;
+    std::vector<ComputeGrid*> grids = { &grid };
+    size_t allocationCount = AllocationCount();
+    try
+    {
+        for (size_t i = 1; i < testSets.size(); ++i)
+        {
+            clones.emplace_back(new ComputeGrid(testSets[i], grid));
+            grids.push_back(clones.back().get());
+        }
+    }
+    catch (std::exception ex)
+    {
+        std::cout << ex.what() << std::endl;
+        return 1;
+    }
+
+    if (benchIterations > 0)
+    {
+        std::cout << "\tcloned grid " << clones.size() << " times with "
+            << (AllocationCount() - allocationCount) << " allocations.\n";
+    }
+
+    std::vector<TestSetResult> results = RunTestSetsAtOnce(testSets, grids, cycleLimit, threadCount);
+    for (const TestSetResult& result : results)
+    {
+        switch (result.outcome)
+        {
+        case TestSetResult::Outcome::Success:
+        case TestSetResult::Outcome::Failure:
+            std::cout << "\t" << ((result.outcome == TestSetResult::Outcome::Success) ? "success" : "failure") << " in "
+                << result.cycleCount << " cycles.\n";
+            break;
+
+        case TestSetResult::Outcome::Cancelled:
+            std::cout << "\tcancelled after " << result.cycleCount << " cycles.\n";
+            break;
+
+        case TestSetResult::Outcome::Error:
+            std::cout << result.error << std::endl;
+            return 1;
+        }
+    }
+
+    if (benchIterations > 0)
+    {
+        long long totalCycles = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < benchIterations; ++i)
+        {
+            for (const TestSetResult& result : RunTestSetsAtOnce(testSets, grids, cycleLimit, threadCount))
+                totalCycles += result.cycleCount;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "\t\t" << benchIterations << " runs of " << testSets.size() << " test sets in " << elapsed.count() << " s: "
+            << static_cast<long long>(totalCycles / elapsed.count()) << " cycles/sec.\n";
+    }
+
+    return 0;
+}
+
+// Run a solution against test sets under the interpreter, counting how many times each compute node
+// starts each of its instructions, and how many of those Engine::Threaded would run in a
+// superinstruction.
+void ProfileSolution(
+    ComputeGrid& grid,
+    const std::vector<Puzzle>& testSets,
+    int cycleLimit,
+    SuperinstructionMiner& miner
+    )
+{
+    const std::vector<ComputeNode*>& nodes = grid.ProgrammedNodes();
+    std::vector<std::vector<uint64_t>> startCounts(nodes.size());
+    std::vector<uint64_t> fusedCounts(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+        startCounts[i].resize(nodes[i]->Code().size());
+
+    grid.SetEngine(Engine::Interpreter);
+
+    for (size_t testRun = 0; testRun < testSets.size(); ++testRun)
+    {
+        const Puzzle& testSet = testSets[testRun];
+        if (testRun > 0)
+            grid.ResetInputs(Puzzle(testSet));
+
+        // How many more instructions each node has to start before it's out of the superinstruction
+        // it's in.
+        std::vector<size_t> fusedLeft(nodes.size());
+
+        grid.Initialize();
+        bool isFailure = false;
+        for (int cycle = 0; !grid.IsFinished(testSet, &isFailure) && ((cycleLimit == 0) || (cycle < cycleLimit)); ++cycle)
+        {
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                if (!nodes[i]->IsStartingInstruction())
+                    continue;
+
+                size_t pc = nodes[i]->ProgramCounter();
+                ++startCounts[i][pc];
+
+                if (fusedLeft[i] > 0)
+                {
+                    --fusedLeft[i];
+                    ++fusedCounts[i];
+                }
+                else if (nodes[i]->HandlerLength(pc) > 1)
+                {
+                    fusedLeft[i] = nodes[i]->HandlerLength(pc) - 1;
+                    ++fusedCounts[i];
+                }
+            }
+
+            grid.Step();
+        }
+    }
+
+    for (size_t i = 0; i < nodes.size(); ++i)
+        miner.AddProgram(nodes[i]->Code(), startCounts[i], fusedCounts[i]);
+}
+
+// Write out what the miner found, and report how well the current superinstructions did.
+int WriteSuperinstructions(const Options& options)
+{
+    std::ofstream file(options.superinstructionPath);
+    options.pMiner->WriteHeader(file, MaxMinedSuperinstructions);
+    if (!file)
+    {
+        std::cout << "failed to write the superinstructions\n";
+        return 1;
+    }
+
+    options.pMiner->Report(std::cout);
+    return 0;
+}
+
+// Generate the test sets for a puzzle. The first is the puzzle's own; the rest continue from the
+// default seed, so they're the same every time (for debugability).
+//
+// Formal Parameters:
+//  puzzle: the puzzle.
+//  getPuzzle: generates the puzzle again, with new inputs; see GetPuzzle.
+//  count: how many test sets to return.
+std::vector<Puzzle> GenerateTestSets(
+    const Puzzle& puzzle,
+    const std::function<Puzzle(std::string&)>& getPuzzle,
+    int count
+    )
+{
+    std::vector<Puzzle> testSets;
+    testSets.push_back(puzzle);
+
+    g_RandomEngine.seed();
+    for (int testRun = 1; testRun < count; ++testRun)
+    {
+        std::string name;
+        testSets.push_back(getPuzzle(name));
+    }
+
+    return testSets;
+}
+
+// Run a solution against test sets in batches of BatchLanes, and report the results in the same
+// form as running them one at a time.
+int RunBatchedTests(
+    const Puzzle& puzzle,
+    const ComputeGrid& grid,
+    const std::vector<Puzzle>& testSets,
+    int cycleLimit,
+    int benchIterations
+    )
+{
+    BatchGrid<NodeGridHeight, NodeGridWidth> batch(puzzle, grid.Flat());
+
+    for (size_t first = 0; first < testSets.size(); first += BatchLanes)
+    {
+        int count = static_cast<int>(std::min<size_t>(BatchLanes, testSets.size() - first));
+        BatchResult results[BatchLanes];
+        batch.Run(&testSets[first], count, cycleLimit, results);
+
+        for (int lane = 0; lane < count; ++lane)
+        {
+            if (results[lane].error != nullptr)
+            {
+                std::cout << results[lane].error << std::endl;
+                return 1;
+            }
+
+            std::cout << "\t" << (results[lane].success ? "success" : "failure") << " in "
+                << results[lane].cycleCount << " cycles.\n";
+        }
+
+        if (benchIterations > 0)
+        {
+            long long totalCycles = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < benchIterations; ++i)
+            {
+                batch.Run(&testSets[first], count, cycleLimit, results);
+                for (int lane = 0; lane < count; ++lane)
+                    totalCycles += results[lane].cycleCount;
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::cout << "\t\t" << benchIterations << " runs of " << count << " test sets in " << elapsed.count() << " s: "
+                << static_cast<long long>(totalCycles / elapsed.count()) << " cycles/sec.\n";
+        }
+    }
+
+    return 0;
+}
+
+// Write a solution out as a standalone program, with the test sets DoTest would run it against.
+int WriteTranspiledSolution(
+    const Puzzle& puzzle,
+    int puzzleNumber,
+    const std::string& puzzleName,
+    const wchar_t* path,
+    const std::vector<Puzzle>& testSets
+    )
+{
+    std::ofstream file(path);
+    TranspileSolution(puzzle, puzzleNumber, puzzleName, testSets, file);
+    if (!file)
+    {
+        std::cout << "failed to write the transpiled program\n";
+        return 1;
+    }
+
+    std::cout << "\twrote transpiled program.\n";
+    return 0;
+}
+
+// What EngineChoices knows a solution by: the puzzle number and the save file's name, or the size
+// of the synthetic puzzle.
+std::string SolutionKey(int puzzleNumber, const wchar_t* saveFilePath, const Options& options)
+{
+    if (puzzleNumber == 0)
+        return "synthetic " + std::to_string(options.syntheticWidth) + "x" + std::to_string(options.syntheticHeight);
+
+    return std::to_string(puzzleNumber) + " " + std::filesystem::path(saveFilePath).filename().string();
+}
+
+// Read the engines chosen on an earlier run, one per line as the engine's name and then the
+// solution's key. A file that isn't there yet has no choices in it.
+//
+// Returns false if the file has a line that can't be read.
+bool ReadEngineChoices(const wchar_t* path, EngineChoices& choices)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        auto pos = line.find(' ');
+        Engine engine;
+        if ((pos == line.npos) || !TryParseEngine(std::wstring(line.begin(), line.begin() + pos), &engine))
+            return false;
+
+        choices[line.substr(pos + 1)] = engine;
+    }
+    return true;
+}
+
+// Write out the engines chosen, in the form ReadEngineChoices reads.
+int WriteEngineChoices(const Options& options)
+{
+    std::ofstream file(options.choicesPath);
+    for (const auto& pair : *options.pChoices)
+        file << EngineName(pair.second) << " " << pair.first << "\n";
+
+    if (!file)
+    {
+        std::cout << "failed to write the engine choices\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Run generated grids (see GetCheckPuzzle) under options.engine and under the interpreter, and report
+// any that the engine runs differently. Each grid's expected outputs are whatever the interpreter
+// sends them in its first CheckCycles cycles, so the engine has to send exactly the same values, and
+// send the last of them in the same cycle. Most random grids soon deadlock, so grids that send fewer
+// than MinCheckValues values are passed over, and don't count towards puzzleCount.
+//
+// Engine::Parallel and Engine::TimeWarp are run on four threads unless -threads says otherwise, so
+// that the grids are split up even on a machine with fewer cores.
+//
+// Returns 0 if every grid ran the same, or 1 if any didn't.
+int CheckEngine(const Options& options, int puzzleCount)
+{
+    constexpr int CheckCycles = 2000;
+    constexpr size_t MinCheckValues = 10;
+
+    if (ComputeGrid::IsFlatEngine(options.engine))
+    {
+        std::cout << "check needs an engine that can run grids of any size\n";
+        return -1;
+    }
+
+    int threadCount = (options.threadCount > 0) ? options.threadCount : 4;
+    int checkedCount = 0;
+    int splitCount = 0;
+    int64_t totalRollbacks = 0;
+    int mismatchCount = 0;
+
+    for (int index = 0; checkedCount < puzzleCount; ++index)
+    {
+        std::string puzzleName;
+        Puzzle puzzle = GetCheckPuzzle(index, puzzleName);
+
+        try
+        {
+            ComputeGrid reference(puzzle);
+            reference.Initialize();
+            for (int cycle = 0; cycle < CheckCycles; ++cycle)
+                reference.Step();
+
+            size_t valueCount = 0;
+            for (size_t i = 0; i < puzzle.outputs.size(); ++i)
+            {
+                puzzle.outputs[i].data = reference.Outputs()[i].Data;
+                valueCount += puzzle.outputs[i].data.size();
+            }
+            if (valueCount < MinCheckValues)
+                continue;
+
+            int referenceCycles = 0;
+            RunProgramAndTest(puzzle, reference, CheckCycles + 1, &referenceCycles);
+
+            ComputeGrid grid(puzzle);
+            grid.SetThreadCount(threadCount);
+            grid.SetEngine(options.engine);
+
+            int cycles = 0;
+            bool success = RunProgramAndTest(puzzle, grid, CheckCycles + 1, &cycles);
+            ++checkedCount;
+
+            size_t tileCount;
+            size_t serialNodeCount;
+            size_t regionCount;
+            int64_t rollbackCount;
+            grid.GetTiling(&tileCount, &serialNodeCount);
+            grid.GetRegions(&regionCount, &rollbackCount);
+            if ((tileCount > 1) || (regionCount > 1))
+                ++splitCount;
+            totalRollbacks += rollbackCount;
+
+            if (!success || (cycles != referenceCycles))
+            {
+                ++mismatchCount;
+                std::cout << index << ": " << puzzleName << " - " << (success ? "finished" : "went wrong")
+                    << " in " << cycles << " cycles, where the interpreter finished in " << referenceCycles << ".\n";
+            }
+        }
+        catch (std::exception ex)
+        {
+            ++checkedCount;
+            ++mismatchCount;
+            std::cout << index << ": " << puzzleName << " - " << ex.what() << std::endl;
+        }
+    }
+
+    std::cout << "checked " << checkedCount << " grids, " << splitCount << " of them split up";
+    if (options.engine == Engine::TimeWarp)
+        std::cout << " (rolled back " << totalRollbacks << " times)";
+    std::cout << ": " << mismatchCount << " ran differently.\n";
+    return (mismatchCount == 0) ? 0 : 1;
+}
+
+// Run a solution against its test sets, and report the results.
+//
+// Formal Parameters:
+//  puzzleNumber: the puzzle's number, or 0 for the synthetic puzzle, if options has its size.
+//  saveFilePath: the solution, for a puzzle from the game.
+//  cycleLimit: if non-zero, the maximum number of cycles to run each test set for.
+//  options: the command-line options.
+//  pPool: if not null, the grid is taken from here instead of being built.
+int DoTest(int puzzleNumber, const wchar_t* saveFilePath, int cycleLimit, const Options& options, GridPool* pPool)
 {
+    auto getPuzzle = [puzzleNumber, &options](std::string& name)
+    {
+        if ((puzzleNumber == 0) && (options.syntheticWidth > 0))
+            return GetSyntheticPuzzle(options.syntheticWidth, options.syntheticHeight, name);
+        return GetPuzzle(puzzleNumber, name);
+    };
+
     std::string puzzleName;
-    Puzzle puzzle = GetPuzzle(puzzleNumber, puzzleName);
+    Puzzle puzzle = getPuzzle(puzzleName);
 
     if (puzzleNumber > 0)
         ReadSaveFile(saveFilePath, puzzle.programs, puzzle.badNodes, puzzle.stackNodes);
 
-    ComputeGrid<NodeGridHeight, NodeGridWidth> grid(puzzle);
+    std::unique_ptr<ComputeGrid> spGrid;
+    ComputeGrid* pGrid = nullptr;
+    bool reused = false;
+    size_t allocationCount = AllocationCount();
+    try
+    {
+        if (pPool != nullptr)
+        {
+            pGrid = &pPool->Get(puzzle, &reused);
+        }
+        else
+        {
+            spGrid.reset(new ComputeGrid(puzzle));
+            pGrid = spGrid.get();
+        }
+        pGrid->SetThreadCount(options.threadCount);
+        pGrid->SetEngine(options.engine);
+    }
+    catch (std::exception ex)
+    {
+        // The program failed to assemble, or the engine can't run it.
+        std::cout << puzzleNumber << ": " << puzzleName << " - " << ex.what() << std::endl;
+        return 1;
+    }
+    ComputeGrid& grid = *pGrid;
+    grid.SetMemoCapacity(options.memoMegabytes << 20);
 
     int instructionCount = 0;
     int nodeCount = 0;
@@ -120,17 +813,105 @@ int DoTest(int puzzleNumber, const wchar_t* saveFilePath, int cycleLimit)
         << " - " << nodeCount << " nodes, "
         << instructionCount << " instructions.\n";
 
-    // Use the default seed to produce the same sequence every time (for debugability).
-    g_RandomEngine.seed();
+    if (options.benchIterations > 0)
+    {
+        std::cout << "\t" << (reused ? "reprogrammed pooled grid" : "built grid") << " with "
+            << (AllocationCount() - allocationCount) << " allocations.\n";
+
+        size_t tileCount;
+        size_t serialNodeCount;
+        grid.GetTiling(&tileCount, &serialNodeCount);
+        if (tileCount > 0)
+        {
+            std::cout << "\tsplit into " << tileCount << " tiles, with " << serialNodeCount
+                << " nodes reading in order on the main thread.\n";
+        }
+
+        size_t regionCount;
+        int64_t rollbackCount;
+        grid.GetRegions(&regionCount, &rollbackCount);
+        if (regionCount > 0)
+            std::cout << "\tsplit into " << regionCount << " regions.\n";
+    }
+
+    std::vector<Puzzle> testSets = GenerateTestSets(puzzle, getPuzzle, options.testSetCount);
+
+    if (options.transpilePath != nullptr)
+        return WriteTranspiledSolution(puzzle, puzzleNumber, puzzleName, options.transpilePath, testSets);
+
+    if (options.autoEngine && (options.pMiner == nullptr))
+    {
+        try
+        {
+            std::string key = SolutionKey(puzzleNumber, saveFilePath, options);
+            if ((options.pChoices != nullptr) && (options.pChoices->count(key) > 0))
+            {
+                Engine engine = options.pChoices->at(key);
+                grid.SetEngine(engine);
+                std::cout << "\tusing engine " << EngineName(engine) << ", as chosen before.\n";
+            }
+            else
+            {
+                std::vector<std::pair<Engine, double>> times;
+                Engine engine = SelectEngine(testSets[0], grid, cycleLimit, options.calibrationCycles, &times);
+                if (options.pChoices != nullptr)
+                    (*options.pChoices)[key] = engine;
+
+                std::cout << "\tselected engine " << EngineName(engine) << " (";
+                for (size_t i = 0; i < times.size(); ++i)
+                    std::cout << ((i == 0) ? "" : ", ") << EngineName(times[i].first) << " " << (times[i].second * 1000) << " ms";
+                std::cout << ").\n";
+            }
+        }
+        catch (std::exception ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.pMiner != nullptr)
+    {
+        try
+        {
+            ProfileSolution(grid, testSets, cycleLimit, *options.pMiner);
+        }
+        catch (std::exception ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!options.autoEngine && (options.engine == Engine::Batch))
+    {
+        try
+        {
+            return RunBatchedTests(puzzle, grid, testSets, cycleLimit, options.benchIterations);
+        }
+        catch (std::exception ex)
+        {
+            std::cout << ex.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.concurrentTestSets > 1)
+        return RunConcurrentTests(grid, testSets, cycleLimit, options.concurrentTestSets, options.benchIterations);
 
-    for (int testRun = 0; testRun < 3; ++testRun)
+    for (size_t testRun = 0; testRun < testSets.size(); ++testRun)
     {
+        const Puzzle& testSet = testSets[testRun];
+        if (testRun > 0)
+            grid.ResetInputs(Puzzle(testSet));
+
         int cycleCount = 0;
         bool success = false;
 
         try
         {
-            success = RunProgramAndTest(puzzle, grid, cycleLimit, &cycleCount);
+            success = RunProgramAndTest(testSet, grid, cycleLimit, &cycleCount);
         }
         catch (std::exception ex)
         {
@@ -142,27 +923,162 @@ int DoTest(int puzzleNumber, const wchar_t* saveFilePath, int cycleLimit)
         std::cout << "\t" << (success ? "success" : "failure") << " in "
             << cycleCount << " cycles.\n";
 
-        if (testRun < 2)
+        if (options.benchIterations > 0)
         {
-            // Generate a new set of inputs and outputs.
-            Puzzle p2 = GetPuzzle(puzzleNumber, puzzleName);
-            std::swap(puzzle.inputs, p2.inputs);
-            std::swap(puzzle.outputs, p2.outputs);
-            std::swap(puzzle.visualization, p2.visualization);
-
-            grid.ResetInputs(std::move(puzzle));
+            try
+            {
+                BenchProgram(testSet, grid, cycleLimit, options.benchIterations);
+            }
+            catch (std::exception ex)
+            {
+                std::cout << ex.what() << std::endl;
+                return 1;
+            }
         }
     }
 
+    if (options.benchIterations > 0)
+    {
+        ReportTransducers(grid);
+
+        size_t regionCount;
+        int64_t rollbackCount;
+        grid.GetRegions(&regionCount, &rollbackCount);
+        if (regionCount > 0)
+            std::cout << "\tregions rolled back " << rollbackCount << " times.\n";
+    }
+
     return 0;
 }
 
 int wmain(int argc, wchar_t** argv)
 {
-    if ((argc == 3) && (std::wstring(argv[1]) == L"all"))
+    Options options = { Engine::Interpreter, false, 20000, nullptr, nullptr, 0, nullptr, 3, nullptr, nullptr, MemoGrid<NodeGridHeight, NodeGridWidth>::DefaultCapacity >> 20, 0, 0, 0, 1 };
+    SuperinstructionMiner miner;
+    EngineChoices choices;
+
+    // Options come first. Anything else starts the positional arguments (which may be negative
+    // puzzle numbers, so they can't be told apart by the leading dash).
+    int arg = 1;
+    for (; arg + 1 < argc; arg += 2)
+    {
+        std::wstring option(argv[arg]);
+        if (option == L"-engine")
+        {
+            options.autoEngine = (std::wstring(argv[arg + 1]) == L"auto");
+            if (!options.autoEngine && !TryParseEngine(argv[arg + 1], &options.engine))
+            {
+                std::cout << "unknown engine\n";
+                return -1;
+            }
+            if (!options.autoEngine && (options.engine == Engine::Jit) && !JitCompiler::IsSupported())
+            {
+                std::cout << "the jit engine needs an x64 build\n";
+                return -1;
+            }
+        }
+        else if (option == L"-bench")
+        {
+            if (0 == swscanf_s(argv[arg + 1], L"%d", &options.benchIterations))
+            {
+                std::cout << "invalid number of bench iterations\n";
+                return -1;
+            }
+        }
+        else if (option == L"-transpile")
+        {
+            options.transpilePath = argv[arg + 1];
+        }
+        else if (option == L"-superinstructions")
+        {
+            options.superinstructionPath = argv[arg + 1];
+            options.pMiner = &miner;
+        }
+        else if (option == L"-testsets")
+        {
+            if (0 == swscanf_s(argv[arg + 1], L"%d", &options.testSetCount) || options.testSetCount < 1)
+            {
+                std::cout << "invalid number of test sets\n";
+                return -1;
+            }
+        }
+        else if (option == L"-calibration")
+        {
+            if (0 == swscanf_s(argv[arg + 1], L"%d", &options.calibrationCycles) || options.calibrationCycles < 1)
+            {
+                std::cout << "invalid number of calibration cycles\n";
+                return -1;
+            }
+        }
+        else if (option == L"-choices")
+        {
+            options.choicesPath = argv[arg + 1];
+            options.pChoices = &choices;
+            if (!ReadEngineChoices(options.choicesPath, choices))
+            {
+                std::cout << "invalid engine choices file\n";
+                return -1;
+            }
+        }
+        else if (option == L"-synthetic")
+        {
+            if ((2 != swscanf_s(argv[arg + 1], L"%dx%d", &options.syntheticWidth, &options.syntheticHeight))
+                || (options.syntheticWidth < 1) || (options.syntheticHeight < 1))
+            {
+                std::cout << "invalid synthetic grid size\n";
+                return -1;
+            }
+        }
+        else if (option == L"-threads")
+        {
+            if (0 == swscanf_s(argv[arg + 1], L"%d", &options.threadCount) || options.threadCount < 0)
+            {
+                std::cout << "invalid number of threads\n";
+                return -1;
+            }
+        }
+        else if (option == L"-concurrent")
+        {
+            if (0 == swscanf_s(argv[arg + 1], L"%d", &options.concurrentTestSets) || options.concurrentTestSets < 1)
+            {
+                std::cout << "invalid number of test sets\n";
+                return -1;
+            }
+        }
+        else if (option == L"-memo")
+        {
+            int megabytes = 0;
+            if (0 == swscanf_s(argv[arg + 1], L"%d", &megabytes) || megabytes < 0)
+            {
+                std::cout << "invalid memo size\n";
+                return -1;
+            }
+            options.memoMegabytes = static_cast<size_t>(megabytes);
+        }
+        else
+        {
+            break;
+        }
+    }
+    wchar_t* programName = argv[0];
+    argc -= arg - 1;
+    argv += arg - 1;
+
+    if ((argc == 1) && (options.syntheticWidth > 0))
+    {
+        int result = DoTest(0, nullptr, static_cast<int>(1e5), options, nullptr);
+        if ((result == 0) && (options.pChoices != nullptr))
+            return WriteEngineChoices(options);
+
+        return result;
+    }
+    else if ((argc == 3) && (std::wstring(argv[1]) == L"all"))
     {
         using namespace std::filesystem;
 
+        // Most saves are for puzzles whose layout has come up before.
+        GridPool pool;
+
         for (const path& entry : directory_iterator(argv[2]))
         {
             std::wstring saveFilename(entry.filename().generic_wstring());
@@ -178,12 +1094,29 @@ int wmain(int argc, wchar_t** argv)
             if (*end == L'\0')
             {
                 std::wcout << L"Save file: " << saveFilename << std::endl;
-                DoTest(puzzleNumber, entry.c_str(), static_cast<int>(1e5));
+                DoTest(puzzleNumber, entry.c_str(), static_cast<int>(1e5), options, &pool);
             }
         }
 
+        if ((options.pChoices != nullptr) && (WriteEngineChoices(options) != 0))
+            return 1;
+
+        if (options.pMiner != nullptr)
+            return WriteSuperinstructions(options);
+
         return 0;
     }
+    else if ((argc == 3) && (std::wstring(argv[1]) == L"check"))
+    {
+        int puzzleCount;
+        if ((0 == swscanf_s(argv[2], L"%d", &puzzleCount)) || (puzzleCount < 1))
+        {
+            std::cout << "invalid number of grids to check\n";
+            return -1;
+        }
+
+        return CheckEngine(options, puzzleCount);
+    }
     else if (argc == 3)
     {
         int puzzleNumber;
@@ -195,11 +1128,41 @@ int wmain(int argc, wchar_t** argv)
         }
         saveFilePath = argv[2];
 
-        return DoTest(puzzleNumber, saveFilePath, 0 /* no limit */);
+        int result = DoTest(puzzleNumber, saveFilePath, 0 /* no limit */, options, nullptr);
+        if ((result == 0) && (options.pChoices != nullptr) && (WriteEngineChoices(options) != 0))
+            return 1;
+
+        if ((result == 0) && (options.pMiner != nullptr))
+            return WriteSuperinstructions(options);
+
+        return result;
     }
     else
     {
-        std::cout << "usage: " << argv[0] << " <puzzle number> <save file>\n"
+        std::cout << "usage: " << programName << " [options] <puzzle number> <save file>\n"
+            "       " << programName << " [options] all <save directory>\n"
+            "       " << programName << " [options] -synthetic <width>x<height>\n"
+            "       " << programName << " [options] check <count>\n"
+            "\n"
+            "options:\n"
+            "  -engine <engine>                     how to execute the nodes, or auto for the fastest (default: interpreter)\n"
+            "  -calibration <cycles>                cycles each engine is timed for, with -engine auto (default: 20000)\n"
+            "  -choices <file>                      with -engine auto, reuse the engines recorded here, and record new choices\n"
+            "  -bench <iterations>                  repeat each test run and report cycles/sec and allocations\n"
+            "  -transpile <output.cpp>              write the solution out as a standalone C++ program\n"
+            "  -testsets <count>                    number of test sets to run or transpile (default: 3)\n"
+            "  -superinstructions <output.h>        profile the solutions, report superinstruction coverage and write mined ones\n"
+            "  -memo <megabytes>                    memory the memo engine can use (default: 64)\n"
+            "  -threads <count>                     most threads the parallel and timewarp engines can use (default: one per core)\n"
+            "  -concurrent <count>                  run up to count test sets at once on cloned grids, stopping at the first failure\n"
+            "  -synthetic <width>x<height>          run a generated pipeline puzzle on a grid of any size\n"
+            "\n"
+            "check runs count generated grids under the engine and the interpreter, and reports any that differ.\n"
+            "\n"
+            "engines:";
+        for (const auto& pair : s_engineNames)
+            std::cout << " " << pair.first;
+        std::cout << "\n"
             "\n"
             "look for saves in "
             R"(%USERPROFILE%\Documents\my games\TIS-100\<random number>\save)"